@@ -0,0 +1,55 @@
+#pragma once
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#define FRAME_LIMITER_SPIN_MS 1.0f // the end of a wait spins, sleeping overshoots by about a scheduler tick
+
+// Paces frame starts to a target rate. The wait happens before the frame samples its input, so a frame
+// that starts later than it could is also rendered from fresher input. A late frame doesn't make the
+// next ones start early to catch up.
+class FrameLimiter {
+private:
+    using Clock = std::chrono::steady_clock;
+    Clock::duration interval{0};
+    Clock::time_point nextStart;
+    bool started = false;
+    float targetFps = 0.0f;
+
+public:
+    // 0 disables the limit
+    void setTargetFps(float fps){
+        targetFps = std::max(fps, 0.0f);
+        interval = targetFps > 0.0f ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.0f / targetFps))
+                                    : Clock::duration(0);
+        started = false;
+    }
+
+    float getTargetFps() const{
+        return targetFps;
+    }
+
+    // Blocks until the next frame may start, returns the milliseconds waited
+    float wait(){
+        if (interval == Clock::duration(0))
+            return 0.0f;
+        Clock::time_point now = Clock::now();
+        if (!started) {
+            started = true;
+            nextStart = now + interval;
+            return 0.0f;
+        }
+
+        Clock::time_point waitStart = now;
+        if (now < nextStart) {
+            auto spin = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(FRAME_LIMITER_SPIN_MS));
+            if (nextStart - now > spin)
+                std::this_thread::sleep_until(nextStart - spin);
+            while ((now = Clock::now()) < nextStart) {
+                std::this_thread::yield();
+            }
+        }
+        nextStart = std::max(nextStart, now) + interval;
+        return std::chrono::duration<float, std::milli>(now - waitStart).count();
+    }
+};
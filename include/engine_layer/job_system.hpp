@@ -0,0 +1,348 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include "profiler.hpp"
+
+#define JOB_DEQUE_CAPACITY 4096 // per worker, a full deque runs new jobs inline
+
+class JobSystem;
+struct Job;
+
+// Counts the unfinished jobs started with it. wait() on it from any thread, or use it as the
+// dependency of other jobs which are only queued once it reaches zero. Must outlive its jobs.
+class JobCounter {
+private:
+    friend class JobSystem;
+    std::atomic<uint32_t> pending{0};
+    std::mutex dependentsMutex;
+    std::vector<Job*> dependents; // queued when pending reaches zero
+
+public:
+    bool isDone() const{
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+struct Job {
+    std::function<void()> function;
+    JobCounter* counter; // decremented once function returned, may be null
+    Job* next = nullptr; // injected queue or free list link
+};
+
+// Chase-Lev work stealing deque of jobs. The owner thread pushes and pops at the bottom, any other
+// thread steals from the top. Fixed capacity, push fails once full.
+class JobDeque {
+private:
+    std::atomic<int64_t> top{0};
+    std::atomic<int64_t> bottom{0};
+    std::unique_ptr<std::atomic<Job*>[]> jobs;
+    static constexpr int64_t mask = JOB_DEQUE_CAPACITY - 1;
+    static_assert((JOB_DEQUE_CAPACITY & mask) == 0, "JOB_DEQUE_CAPACITY must be a power of two");
+
+public:
+    JobDeque(): jobs(new std::atomic<Job*>[JOB_DEQUE_CAPACITY]){}
+
+    // Owner only
+    bool push(Job* job){
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= JOB_DEQUE_CAPACITY)
+            return false;
+        jobs[b & mask].store(job, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only, newest job first
+    Job* pop(){
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_seq_cst);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Job* job = jobs[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // last job, race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Any thread, oldest job first
+    Job* steal(){
+        int64_t t = top.load(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_seq_cst);
+        if (t >= b)
+            return nullptr;
+        Job* job = jobs[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+};
+
+// Fixed pool of worker threads running jobs. Jobs started from a worker go to its own deque and idle
+// workers steal from the others, jobs started from any other thread go through a shared queue.
+// Threads waiting on a counter run jobs meanwhile instead of blocking.
+class JobSystem {
+private:
+    struct Worker {
+        JobDeque deque;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex injectedMutex;
+    Job* injectedHead = nullptr; // jobs from non worker threads, oldest first
+    Job* injectedTail = nullptr;
+
+    // finished jobs are reused, a steady stream of small jobs allocates nothing
+    std::mutex freeJobsMutex;
+    Job* freeJobs = nullptr;
+
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<int64_t> queuedJobs{0}; // queued and not taken yet, workers sleep while it is 0
+    std::atomic<bool> stopping{false};
+
+    // worker of the calling thread, -1 outside of this system (the threads calling wait included)
+    static int& currentWorker(const JobSystem* system){
+        thread_local const JobSystem* owner = nullptr;
+        thread_local int index = -1;
+        if (owner != system) {
+            owner = system;
+            index = -1;
+        }
+        return index;
+    }
+
+    // function is moved into a recycled job, its captures fit in std::function without allocating
+    // as long as they are small
+    Job* allocateJob(std::function<void()>&& function, JobCounter* counter){
+        Job* job = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(freeJobsMutex);
+            if (freeJobs != nullptr) {
+                job = freeJobs;
+                freeJobs = job->next;
+            }
+        }
+        if (job == nullptr)
+            job = new Job{};
+        job->function = std::move(function);
+        job->counter = counter;
+        job->next = nullptr;
+        return job;
+    }
+
+    void recycleJob(Job* job){
+        job->function = nullptr; // releases the captures now rather than at the next reuse
+        std::lock_guard<std::mutex> lock(freeJobsMutex);
+        job->next = freeJobs;
+        freeJobs = job;
+    }
+
+    void enqueue(Job* job){
+        int worker = currentWorker(this);
+        queuedJobs.fetch_add(1, std::memory_order_seq_cst);
+        if (worker < 0 || !workers[worker]->deque.push(job)) {
+            if (worker >= 0) {
+                // deque full, run it here rather than growing it
+                queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                execute(job);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            job->next = nullptr;
+            if (injectedTail != nullptr)
+                injectedTail->next = job;
+            else
+                injectedHead = job;
+            injectedTail = job;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex); // no lost wakeup between a worker check and its wait
+        }
+        sleepCondition.notify_one();
+    }
+
+    Job* findJob(){
+        int worker = currentWorker(this);
+        Job* job = nullptr;
+        if (worker >= 0)
+            job = workers[worker]->deque.pop();
+
+        if (job == nullptr) {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            if (injectedHead != nullptr) {
+                job = injectedHead;
+                injectedHead = job->next;
+                if (injectedHead == nullptr)
+                    injectedTail = nullptr;
+            }
+        }
+
+        // steal from the others, starting after ourselves so thieves spread out
+        size_t start = worker + 1;
+        for (size_t i = 0; job == nullptr && i < workers.size(); ++i) {
+            size_t victim = (start + i) % workers.size();
+            if ((int)victim != worker)
+                job = workers[victim]->deque.steal();
+        }
+
+        if (job != nullptr)
+            queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    void execute(Job* job){
+        job->function();
+        JobCounter* counter = job->counter;
+        recycleJob(job);
+        if (counter != nullptr)
+            finish(*counter);
+    }
+
+    void finish(JobCounter& counter){
+        std::vector<Job*> released;
+        {
+            // decremented under the lock : wait() takes it before returning, so the counter can't be
+            // destroyed while the last job still touches it
+            std::lock_guard<std::mutex> lock(counter.dependentsMutex);
+            if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            released.swap(counter.dependents);
+        }
+        for (Job* job : released) {
+            enqueue(job);
+        }
+    }
+
+    void workerLoop(int index){
+        currentWorker(this) = index;
+        CRUMBS_PROFILE_THREAD("Job Worker " + std::to_string(index));
+        while (true) {
+            Job* job = findJob();
+            if (job != nullptr) {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, [&]{ return stopping.load() || queuedJobs.load() > 0; });
+            if (stopping.load() && queuedJobs.load() == 0)
+                return;
+        }
+    }
+
+public:
+    // threadCount is the number of threads running jobs, the calling thread included when it waits
+    explicit JobSystem(uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency())){
+        // one thread less than asked, the waiting thread makes up for it
+        uint32_t workerCount = std::max(threadCount, 1u) - 1;
+        for (uint32_t i = 0; i < workerCount; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (uint32_t i = 0; i < workerCount; ++i) {
+            workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    ~JobSystem(){
+        destroy();
+    }
+
+    // Finishes the queued jobs then joins the workers
+    void destroy(){
+        if (stopping.exchange(true))
+            return;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        sleepCondition.notify_all();
+        for (auto& worker : workers) {
+            if (worker->thread.joinable())
+                worker->thread.join();
+        }
+        // nothing left if no worker thread ran, drain on this one
+        while (Job* job = findJob()) {
+            execute(job);
+        }
+        std::lock_guard<std::mutex> lock(freeJobsMutex);
+        while (freeJobs != nullptr) {
+            Job* job = freeJobs;
+            freeJobs = job->next;
+            delete job;
+        }
+    }
+
+    // Threads that can run jobs at the same time, counting the one waiting
+    uint32_t getThreadCount() const{
+        return workers.size() + 1;
+    }
+
+    // Queues function, counter (if any) is incremented now and decremented once it returned
+    void run(std::function<void()> function, JobCounter* counter = nullptr){
+        if (counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        enqueue(allocateJob(std::move(function), counter));
+    }
+
+    // Same as run but the job is only queued once dependency reached zero
+    void runAfter(JobCounter& dependency, std::function<void()> function, JobCounter* counter = nullptr){
+        if (counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        Job* job = allocateJob(std::move(function), counter);
+        {
+            std::lock_guard<std::mutex> lock(dependency.dependentsMutex);
+            if (!dependency.isDone()) {
+                dependency.dependents.push_back(job);
+                return;
+            }
+        }
+        enqueue(job);
+    }
+
+    // Runs jobs until counter reaches zero, so waiting from inside a job never deadlocks
+    void wait(JobCounter& counter){
+        while (!counter.isDone()) {
+            Job* job = findJob();
+            if (job != nullptr)
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+        std::lock_guard<std::mutex> lock(counter.dependentsMutex);
+    }
+
+    // Calls function(begin, end) over [0, count) split in batches of at least minBatch, a few per
+    // thread so stealing can balance uneven batches. Returns once every batch is done.
+    void parallelFor(uint32_t count, uint32_t minBatch, const std::function<void(uint32_t begin, uint32_t end)>& function){
+        if (count == 0)
+            return;
+        uint32_t batchCount = std::min<uint32_t>((count + minBatch - 1) / std::max(minBatch, 1u), getThreadCount() * 4);
+        if (batchCount <= 1) {
+            function(0, count);
+            return;
+        }
+        JobCounter counter;
+        for (uint32_t b = 1; b < batchCount; ++b) {
+            uint32_t begin = (uint64_t)count * b / batchCount;
+            uint32_t end = (uint64_t)count * (b + 1) / batchCount;
+            run([&function, begin, end]{ function(begin, end); }, &counter);
+        }
+        function(0, (uint64_t)count / batchCount); // first batch on this thread
+        wait(counter);
+    }
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Read only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+private:
+    const uint8_t* bytes = nullptr;
+    size_t size = 0;
+
+public:
+    explicit MappedFile(const std::string& path){
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Couldn't open " + path);
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Couldn't stat " + path);
+        }
+        size = info.st_size;
+        if (size > 0) {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Couldn't map " + path);
+            }
+            bytes = static_cast<const uint8_t*>(mapping);
+        }
+        close(fd); // the mapping keeps the file alive
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile(){
+        destroy();
+    }
+
+    void destroy(){
+        if (bytes != nullptr) {
+            munmap(const_cast<uint8_t*>(bytes), size);
+            bytes = nullptr;
+        }
+    }
+
+    const uint8_t* data() const{
+        return bytes;
+    }
+
+    size_t getSize() const{
+        return size;
+    }
+};
@@ -2,11 +2,34 @@
 #include <glm/glm.hpp>
 #include "debug.hpp"
 #include <string>
+#include <vector>
+
+// Simplified level of a mesh : a range of Mesh::getLodIndices, indexing the same vertices as the full mesh
+struct MeshLod{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error; // largest distance to the full mesh surface, in model units
+};
+
+// Cluster of triangles, a contiguous range of Mesh::getTriangles, with what culling it as a whole needs
+struct Meshlet {
+    uint32_t firstIndex;
+    uint32_t triangleCount;
+    uint32_t vertexCount;
+    glm::vec3 center;  // bounding sphere
+    float radius;
+    glm::vec3 coneAxis;  // average normal of the triangles
+    float coneCutoff;    // sine of the angle the normals spread around the axis, 1 if they face every way
+};
+
 class Mesh{
     private:
         std::vector<glm::vec3> vertices; 
         std::vector<uint32_t> triangleIndices; 
         std::vector<glm::vec3> normals;
+        std::vector<uint32_t> lodIndices; // every level back to back
+        std::vector<MeshLod> lods;        // finest first
+        std::vector<Meshlet> meshlets;    // cover triangleIndices in order, empty for meshes culled whole
     
     public:
         
@@ -19,9 +42,27 @@ class Mesh{
         const std::vector<glm::vec3>& getNormals() const{
             return normals;
         }
-        Mesh(std::vector<glm::vec3> _vertices, std::vector<uint32_t> _triangleIndices, std::vector<glm::vec3> _normals): vertices(_vertices), triangleIndices(_triangleIndices), normals(_normals){
-            if(_normals.size() != _vertices.size()){
-                Debug::LogWarning("Mesh : number of vertices (" + std::to_string (_vertices.size()) + ") does not match number of normals " + std::to_string(_normals.size()) + ") !");
+        const std::vector<uint32_t>& getLodIndices() const{
+            return lodIndices;
+        }
+        const std::vector<MeshLod>& getLods() const{
+            return lods;
+        }
+        void setLods(std::vector<uint32_t> _lodIndices, std::vector<MeshLod> _lods){
+            lodIndices = std::move(_lodIndices);
+            lods = std::move(_lods);
+        }
+        const std::vector<Meshlet>& getMeshlets() const{
+            return meshlets;
+        }
+        // triangleIndices are replaced too, the meshlets are ranges of them
+        void setMeshlets(std::vector<uint32_t> _triangleIndices, std::vector<Meshlet> _meshlets){
+            triangleIndices = std::move(_triangleIndices);
+            meshlets = std::move(_meshlets);
+        }
+        Mesh(std::vector<glm::vec3> _vertices, std::vector<uint32_t> _triangleIndices, std::vector<glm::vec3> _normals): vertices(std::move(_vertices)), triangleIndices(std::move(_triangleIndices)), normals(std::move(_normals)){
+            if(normals.size() != vertices.size()){
+                Debug::LogWarning("Mesh : number of vertices (" + std::to_string (vertices.size()) + ") does not match number of normals " + std::to_string(normals.size()) + ") !");
             }
         }
 };
\ No newline at end of file
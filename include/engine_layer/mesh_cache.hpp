@@ -0,0 +1,296 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <sys/stat.h>
+#include "debug.hpp"
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
+#include "meshlet_builder.hpp"
+
+#define MESH_FILE_MAGIC 0x48534D43 // "CMSH" read as a little endian uint32
+#define MESH_FILE_VERSION 3        // bump on any layout change, older files are converted again
+#define MESH_CACHE_DIR "mesh_cache"
+
+#define MESH_FILE_OPTIMIZED 1 // indices and vertices went through optimizeMesh
+#define MESH_FILE_LODS 2      // LODs were generated, the file may still have none if the mesh couldn't be simplified
+#define MESH_FILE_MESHLETS 4  // meshlets were built, meshes under MESHLET_MIN_TRIANGLES still have none
+
+// Vertex as stored in a mesh file, same layout as the renderer Vertex so the mapped file can be
+// uploaded as is
+struct MeshFileVertex {
+    glm::vec3 pos;
+    glm::vec3 color;
+    glm::vec3 normal;
+};
+
+// Mesh file layout : header, vertexCount vertices, indexCount uint32_t indices, lodIndexCount uint32_t
+// indices of every LOD, lodCount MeshLod, meshletCount Meshlet. Native endianness.
+struct MeshFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;   // FNV-1a of the source file contents, the cache key
+    uint32_t vertexStride; // sizeof(MeshFileVertex) of the writer
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t flags;        // MESH_FILE_ flags
+    glm::vec3 boundsCenter; // model space bounding sphere
+    float boundsRadius;
+    uint32_t lodIndexCount;
+    uint32_t lodCount;
+    uint32_t meshletCount;
+};
+static_assert(sizeof(MeshFileHeader) % 4 == 0, "indices must stay 4 byte aligned");
+static_assert(sizeof(MeshLod) % 4 == 0, "LODs are stored right after the indices");
+static_assert(sizeof(Meshlet) % 4 == 0, "meshlets are stored right after the LODs");
+
+// 64 bit FNV-1a
+inline uint64_t hashBytes(const uint8_t* bytes, size_t size){
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t hashFile(const std::string& path){
+    MappedFile file(path);
+    return hashBytes(file.data(), file.getSize());
+}
+
+// A mapped mesh file, validated on open, indices included. The vertex and index arrays point into the mapping.
+class MappedMeshFile {
+private:
+    MappedFile file;
+    const MeshFileHeader* header;
+
+public:
+    explicit MappedMeshFile(const std::string& path): file(path){
+        if (file.getSize() < sizeof(MeshFileHeader))
+            throw std::runtime_error("Mesh file " + path + " is truncated");
+        header = reinterpret_cast<const MeshFileHeader*>(file.data());
+        if (header->magic != MESH_FILE_MAGIC)
+            throw std::runtime_error(path + " is not a mesh file");
+        if (header->version != MESH_FILE_VERSION)
+            throw std::runtime_error("Mesh file " + path + " has version " + std::to_string(header->version) +
+                                     ", expected " + std::to_string(MESH_FILE_VERSION));
+        if (header->vertexStride != sizeof(MeshFileVertex))
+            throw std::runtime_error("Mesh file " + path + " has an unknown vertex layout");
+        size_t expected = sizeof(MeshFileHeader) + (size_t)header->vertexCount * sizeof(MeshFileVertex) +
+                          ((size_t)header->indexCount + header->lodIndexCount) * sizeof(uint32_t) +
+                          (size_t)header->lodCount * sizeof(MeshLod) + (size_t)header->meshletCount * sizeof(Meshlet);
+        if (file.getSize() != expected)
+            throw std::runtime_error("Mesh file " + path + " size doesn't match its header");
+        for (uint32_t l = 0; l < header->lodCount; ++l) {
+            if ((uint64_t)getLods()[l].firstIndex + getLods()[l].indexCount > header->lodIndexCount)
+                throw std::runtime_error("Mesh file " + path + " has a LOD out of its index range");
+        }
+        // corrupt or foreign indices would read past the vertices, on the CPU and on the GPU
+        const uint32_t* indices = getIndices();
+        size_t allIndexCount = (size_t)header->indexCount + header->lodIndexCount; // LOD indices follow
+        uint32_t maxIndex = 0;
+        for (size_t i = 0; i < allIndexCount; ++i) {
+            maxIndex = std::max(maxIndex, indices[i]);
+        }
+        if (allIndexCount > 0 && maxIndex >= header->vertexCount)
+            throw std::runtime_error("Mesh file " + path + " has an index out of its vertex range");
+        for (uint32_t m = 0; m < header->meshletCount; ++m) {
+            if ((uint64_t)getMeshlets()[m].firstIndex + (uint64_t)getMeshlets()[m].triangleCount * 3 > header->indexCount)
+                throw std::runtime_error("Mesh file " + path + " has a meshlet out of its index range");
+        }
+    }
+
+    const MeshFileHeader& getHeader() const{
+        return *header;
+    }
+
+    const MeshFileVertex* getVertices() const{
+        return reinterpret_cast<const MeshFileVertex*>(file.data() + sizeof(MeshFileHeader));
+    }
+
+    const uint32_t* getIndices() const{
+        return reinterpret_cast<const uint32_t*>(file.data() + sizeof(MeshFileHeader) +
+                                                 (size_t)header->vertexCount * sizeof(MeshFileVertex));
+    }
+
+    const uint32_t* getLodIndices() const{
+        return getIndices() + header->indexCount;
+    }
+
+    const MeshLod* getLods() const{
+        return reinterpret_cast<const MeshLod*>(getLodIndices() + header->lodIndexCount);
+    }
+
+    const Meshlet* getMeshlets() const{
+        return reinterpret_cast<const Meshlet*>(getLods() + header->lodCount);
+    }
+
+    uint32_t getVertexCount() const{
+        return header->vertexCount;
+    }
+
+    uint32_t getIndexCount() const{
+        return header->indexCount;
+    }
+
+    uint32_t getLodCount() const{
+        return header->lodCount;
+    }
+
+    uint32_t getMeshletCount() const{
+        return header->meshletCount;
+    }
+};
+
+// Writes a mesh file next to path then renames it, readers never see a partial file
+inline void writeMeshFile(const std::string& path, const std::vector<MeshFileVertex>& vertices,
+                          const std::vector<uint32_t>& indices, uint64_t sourceHash, uint32_t flags = 0,
+                          const std::vector<uint32_t>& lodIndices = {}, const std::vector<MeshLod>& lods = {},
+                          const std::vector<Meshlet>& meshlets = {})
+{
+    MeshFileHeader header{};
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.sourceHash = sourceHash;
+    header.vertexStride = sizeof(MeshFileVertex);
+    header.vertexCount = vertices.size();
+    header.indexCount = indices.size();
+    header.flags = flags;
+    header.lodIndexCount = lodIndices.size();
+    header.lodCount = lods.size();
+    header.meshletCount = meshlets.size();
+
+    // sphere around the AABB center, the one the renderer culls with
+    glm::vec3 minPos(0.0f), maxPos(0.0f);
+    if (!vertices.empty())
+        minPos = maxPos = vertices[0].pos;
+    for (const MeshFileVertex& v : vertices) {
+        minPos = glm::min(minPos, v.pos);
+        maxPos = glm::max(maxPos, v.pos);
+    }
+    header.boundsCenter = (minPos + maxPos) * 0.5f;
+    for (const MeshFileVertex& v : vertices) {
+        header.boundsRadius = std::max(header.boundsRadius, glm::length(v.pos - header.boundsCenter));
+    }
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            throw std::runtime_error("Couldn't write mesh file " + tempPath);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(MeshFileVertex));
+        out.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(lodIndices.data()), lodIndices.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(lods.data()), lods.size() * sizeof(MeshLod));
+        out.write(reinterpret_cast<const char*>(meshlets.data()), meshlets.size() * sizeof(Meshlet));
+        if (!out.good())
+            throw std::runtime_error("Couldn't write mesh file " + tempPath);
+    }
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("Couldn't move mesh file to " + path);
+}
+
+// Vertex color is white, like the renderer gives imported meshes
+inline void writeMeshFile(const std::string& path, const Mesh& mesh, uint64_t sourceHash, uint32_t flags = 0){
+    const auto& positions = mesh.getVertices();
+    const auto& normals = mesh.getNormals();
+    std::vector<MeshFileVertex> vertices(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        vertices[i] = {positions[i], {1.0f, 1.0f, 1.0f}, i < normals.size() ? normals[i] : glm::vec3(0.0f, 1.0f, 0.0f)};
+    }
+    writeMeshFile(path, vertices, mesh.getTriangles(), sourceHash, flags, mesh.getLodIndices(), mesh.getLods(), mesh.getMeshlets());
+}
+
+// Optimized, meshlet and LOD flagged version of mesh, the way MeshCache and mesh_convert store it
+inline Mesh prepareMesh(Mesh mesh, const std::string& name, bool optimize, bool lods, bool meshlets, uint32_t& flags){
+    flags = 0;
+    if (optimize) {
+        mesh = optimizeMesh(mesh, name);
+        flags |= MESH_FILE_OPTIMIZED;
+    }
+    if (meshlets) {
+        generateMeshlets(mesh, name, optimize); // keeps the vertex cache order inside every meshlet
+        flags |= MESH_FILE_MESHLETS;
+    }
+    if (lods) {
+        generateLods(mesh, name); // after optimizeMesh and generateMeshlets, which renumber the vertices
+        flags |= MESH_FILE_LODS;
+    }
+    return mesh;
+}
+
+// Converted meshes keyed by the hash of their source file contents : an edited source gets a new
+// entry, an unchanged one is mapped without importing it again. With optimize, meshes are reordered
+// by optimizeMesh before being stored, with lods their simplified levels are generated too and with
+// meshlets large meshes are split into meshlets, so the cost is only paid at conversion.
+class MeshCache {
+public:
+    using Importer = std::function<Mesh(const std::string& sourcePath)>;
+
+private:
+    std::string directory;
+    bool optimize;
+    bool lods;
+    bool meshlets;
+
+public:
+    explicit MeshCache(std::string directory = MESH_CACHE_DIR, bool optimize = true, bool lods = true, bool meshlets = true)
+        : directory(std::move(directory)), optimize(optimize), lods(lods), meshlets(meshlets){}
+
+    std::string pathFor(uint64_t sourceHash) const{
+        std::ostringstream name;
+        name << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << sourceHash << ".cmesh";
+        return name.str();
+    }
+
+    // Converts sourcePath with import unless an up to date entry exists, returns the entry path
+    std::string convert(const std::string& sourcePath, const Importer& import){
+        uint64_t sourceHash = hashFile(sourcePath);
+        std::string cachedPath = pathFor(sourceHash);
+        if (isValid(cachedPath, sourceHash))
+            return cachedPath;
+
+        mkdir(directory.c_str(), 0755); // fails harmlessly if it exists
+        uint32_t flags;
+        Mesh mesh = prepareMesh(import(sourcePath), sourcePath, optimize, lods, meshlets, flags);
+        writeMeshFile(cachedPath, mesh, sourceHash, flags);
+        Debug::Log("Mesh cache : converted " + sourcePath + " to " + cachedPath);
+        return cachedPath;
+    }
+
+    std::unique_ptr<MappedMeshFile> load(const std::string& sourcePath, const Importer& import){
+        return std::make_unique<MappedMeshFile>(convert(sourcePath, import));
+    }
+
+private:
+    bool isValid(const std::string& cachedPath, uint64_t sourceHash) const{
+        struct stat info;
+        if (stat(cachedPath.c_str(), &info) != 0)
+            return false;
+        try {
+            MappedMeshFile file(cachedPath);
+            // an entry written with other settings is converted again
+            bool optimized = file.getHeader().flags & MESH_FILE_OPTIMIZED;
+            bool withLods = file.getHeader().flags & MESH_FILE_LODS;
+            bool withMeshlets = file.getHeader().flags & MESH_FILE_MESHLETS;
+            return file.getHeader().sourceHash == sourceHash && optimized == optimize && withLods == lods && withMeshlets == meshlets;
+        } catch (const std::exception& e) {
+            Debug::LogWarning("Mesh cache : " + std::string(e.what()) + ", converting again");
+            return false;
+        }
+    }
+};
@@ -0,0 +1,293 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include "debug.hpp"
+#include "mesh.hpp"
+
+#define VERTEX_CACHE_SIZE 16          // post transform cache entries assumed by the reordering and the stats
+#define OVERDRAW_CLUSTER_THRESHOLD 1.05f // clusters may cost this much more ACMR than the plain vertex cache order
+
+// Post transform cache efficiency of an index buffer, simulated with a FIFO cache
+struct VertexCacheStats {
+    float acmr; // transformed vertices per triangle, 0.5 at best on large grids, 3 at worst
+    float atvr; // transformed vertices per vertex, 1 at best
+};
+
+namespace mesh_optimizer_detail {
+
+// Triangles using every vertex, as offsets into one flat list
+struct Adjacency {
+    std::vector<uint32_t> offsets; // vertexCount + 1
+    std::vector<uint32_t> triangles;
+
+    Adjacency(const std::vector<uint32_t>& indices, uint32_t vertexCount): offsets(vertexCount + 1, 0), triangles(indices.size()){
+        for (uint32_t index : indices) {
+            offsets[index + 1]++;
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            triangles[cursors[indices[i]]++] = i / 3;
+        }
+    }
+};
+
+// FIFO post transform cache, counts the vertices it had to transform
+struct FifoCache {
+    std::vector<uint32_t> loadedAt; // misses right after the vertex was loaded, 0 if never
+    uint32_t misses = 0;
+    uint32_t size;
+
+    FifoCache(uint32_t vertexCount, uint32_t size): loadedAt(vertexCount, 0), size(size){}
+
+    // true if v had to be transformed
+    bool touch(uint32_t v){
+        if (loadedAt[v] != 0 && misses - loadedAt[v] < size)
+            return false;
+        loadedAt[v] = ++misses;
+        return true;
+    }
+
+    // empties the cache, pushing size misses nobody counts
+    void flush(){
+        misses += size;
+    }
+};
+
+} // namespace mesh_optimizer_detail
+
+inline VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount,
+                                           uint32_t cacheSize = VERTEX_CACHE_SIZE)
+{
+    mesh_optimizer_detail::FifoCache cache(vertexCount, cacheSize);
+    uint32_t transformed = 0;
+    for (uint32_t index : indices) {
+        transformed += cache.touch(index);
+    }
+    VertexCacheStats stats{0.0f, 0.0f};
+    if (indices.size() >= 3)
+        stats.acmr = transformed / (float)(indices.size() / 3);
+    if (vertexCount > 0)
+        stats.atvr = transformed / (float)vertexCount;
+    return stats;
+}
+
+// Tipsify (Sander et al. 2007) : fans around the vertex that is still in the cache and has the fewest
+// triangles left, so a vertex is rarely transformed twice. Returns the first triangle of every cluster,
+// a cluster starting wherever the fanning hit a dead end and had to jump elsewhere in the mesh.
+inline std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount,
+                                                 uint32_t cacheSize = VERTEX_CACHE_SIZE)
+{
+    using namespace mesh_optimizer_detail;
+    std::vector<uint32_t> clusters;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return clusters;
+
+    Adjacency adjacency(indices, vertexCount);
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds; // recently used vertices, where to look first once a fan is done
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    uint32_t time = cacheSize + 1;
+    uint32_t scanCursor = 0;
+    int64_t fanning = indices[0];
+    clusters.push_back(0);
+    while (fanning >= 0) {
+        candidates.clear();
+        for (uint32_t a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; ++a) {
+            uint32_t triangle = adjacency.triangles[a];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = true;
+            for (uint32_t c = 0; c < 3; ++c) {
+                uint32_t v = indices[triangle * 3 + c];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+        }
+
+        // the candidate still in cache that'll be there the longest once its fan is emitted
+        fanning = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates) {
+            if (liveTriangles[v] == 0)
+                continue;
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                fanning = v;
+            }
+        }
+        if (fanning >= 0)
+            continue;
+
+        // dead end, back to a recent vertex with triangles left or else the next one in input order
+        while (!deadEnds.empty() && fanning < 0) {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0)
+                fanning = v;
+        }
+        while (fanning < 0 && scanCursor < vertexCount) {
+            if (liveTriangles[scanCursor] > 0)
+                fanning = scanCursor;
+            scanCursor++;
+        }
+        if (fanning >= 0)
+            clusters.push_back(output.size() / 3);
+    }
+    indices.swap(output);
+    return clusters;
+}
+
+// Reorders the clusters of optimizeVertexCache so the ones facing away from the mesh center, likely to
+// occlude the rest, are drawn first. Clusters are split further while that keeps the ACMR within
+// OVERDRAW_CLUSTER_THRESHOLD of the input order, smaller clusters sort better.
+inline void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+                             const std::vector<uint32_t>& clusters)
+{
+    using namespace mesh_optimizer_detail;
+    size_t triangleCount = indices.size() / 3;
+    if (clusters.size() == 0 || triangleCount == 0)
+        return;
+
+    // split every cluster where the triangles since the last split already cache about as well as the
+    // whole cluster, each piece starting with a cold cache since it may be drawn after anything
+    FifoCache cache(positions.size(), VERTEX_CACHE_SIZE);
+    std::vector<uint32_t> splits;
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        size_t begin = clusters[c];
+        size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+        cache.flush();
+        uint32_t start = cache.misses;
+        for (size_t i = begin * 3; i < end * 3; ++i) {
+            cache.touch(indices[i]);
+        }
+        float clusterCost = (cache.misses - start) / (float)(end - begin);
+
+        splits.push_back(begin);
+        cache.flush();
+        start = cache.misses;
+        size_t splitBegin = begin;
+        for (size_t t = begin; t + 1 < end; ++t) {
+            for (uint32_t k = 0; k < 3; ++k) {
+                cache.touch(indices[t * 3 + k]);
+            }
+            size_t splitSize = t + 1 - splitBegin;
+            if (splitSize >= 8 && (cache.misses - start) / (float)splitSize <= clusterCost * OVERDRAW_CLUSTER_THRESHOLD) {
+                splits.push_back(t + 1);
+                splitBegin = t + 1;
+                cache.flush();
+                start = cache.misses;
+            }
+        }
+    }
+
+    glm::vec3 meshCentroid(0.0f);
+    for (const glm::vec3& position : positions) {
+        meshCentroid += position;
+    }
+    meshCentroid /= std::max<size_t>(positions.size(), 1);
+
+    // area weighted centroid and normal of every cluster, sorted by how much it faces outwards
+    std::vector<float> sortKeys(splits.size());
+    for (size_t s = 0; s < splits.size(); ++s) {
+        size_t end = s + 1 < splits.size() ? splits[s + 1] : triangleCount;
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = splits[s]; t < end; ++t) {
+            const glm::vec3& a = positions[indices[t * 3]];
+            const glm::vec3& b = positions[indices[t * 3 + 1]];
+            const glm::vec3& c = positions[indices[t * 3 + 2]];
+            glm::vec3 faceNormal = glm::cross(b - a, c - a); // length is twice the area
+            float faceArea = glm::length(faceNormal);
+            centroid += (a + b + c) * (faceArea / 3.0f);
+            normal += faceNormal;
+            area += faceArea;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float normalLength = glm::length(normal);
+        sortKeys[s] = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<uint32_t> order(splits.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){ return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for (uint32_t s : order) {
+        size_t end = s + 1 < splits.size() ? splits[s + 1] : triangleCount;
+        output.insert(output.end(), indices.begin() + splits[s] * 3, indices.begin() + end * 3);
+    }
+    indices.swap(output);
+}
+
+// Renumbers vertices in the order the indices first use them so vertex fetches walk memory forward.
+// Unreferenced vertices are dropped. normals must match vertices one to one.
+inline void optimizeVertexFetch(std::vector<uint32_t>& indices, std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals){
+    const uint32_t unused = UINT32_MAX;
+    std::vector<uint32_t> remap(vertices.size(), unused);
+    std::vector<glm::vec3> fetchVertices;
+    std::vector<glm::vec3> fetchNormals;
+    fetchVertices.reserve(vertices.size());
+    fetchNormals.reserve(normals.size());
+    for (uint32_t& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = fetchVertices.size();
+            fetchVertices.push_back(vertices[index]);
+            fetchNormals.push_back(normals[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(fetchVertices);
+    normals.swap(fetchNormals);
+}
+
+// Vertex cache order, then overdraw order of its clusters, then fetch order. Logs the cache stats
+// before and after under name.
+inline Mesh optimizeMesh(const Mesh& mesh, const std::string& name = "Mesh"){
+    std::vector<glm::vec3> vertices = mesh.getVertices();
+    std::vector<glm::vec3> normals = mesh.getNormals();
+    std::vector<uint32_t> indices = mesh.getTriangles();
+    // a normal per vertex or the fetch order would pair them with the wrong vertices
+    if (normals.size() != vertices.size()) {
+        Debug::LogWarning(name + " : normal count doesn't match the vertices, mesh left as is");
+        return mesh;
+    }
+    for (uint32_t index : indices) {
+        if (index >= vertices.size()) {
+            Debug::LogWarning(name + " : index out of range, mesh left as is");
+            return mesh;
+        }
+    }
+    VertexCacheStats before = analyzeVertexCache(indices, vertices.size());
+
+    std::vector<uint32_t> clusters = optimizeVertexCache(indices, vertices.size());
+    optimizeOverdraw(indices, vertices, clusters);
+    optimizeVertexFetch(indices, vertices, normals);
+
+    VertexCacheStats after = analyzeVertexCache(indices, vertices.size());
+    Debug::Log(name + " optimized : ACMR " + std::to_string(before.acmr) + " -> " + std::to_string(after.acmr) +
+               ", ATVR " + std::to_string(before.atvr) + " -> " + std::to_string(after.atvr));
+    return Mesh(std::move(vertices), std::move(indices), std::move(normals));
+}
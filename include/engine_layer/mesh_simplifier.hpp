@@ -0,0 +1,305 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include "debug.hpp"
+#include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+
+#define MAX_MESH_LODS 4                // levels generated below the full mesh
+#define LOD_TRIANGLE_RATIO 0.5f        // every level aims for this fraction of the triangles of the previous one
+#define LOD_MAX_RELATIVE_ERROR 0.05f   // no level deviates more than this fraction of the mesh radius
+
+namespace mesh_simplifier_detail {
+
+// Sum of squared distances to a set of planes, weighted by the area of the triangles they came from
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+
+    static Quadric fromPlane(const glm::vec3& n, float d, float w){
+        Quadric q;
+        q.a00 = w * n.x * n.x; q.a01 = w * n.x * n.y; q.a02 = w * n.x * n.z; q.a03 = w * n.x * d;
+        q.a11 = w * n.y * n.y; q.a12 = w * n.y * n.z; q.a13 = w * n.y * d;
+        q.a22 = w * n.z * n.z; q.a23 = w * n.z * d;
+        q.a33 = w * d * d;
+        q.weight = w;
+        return q;
+    }
+
+    void add(const Quadric& q){
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+    }
+
+    // mean squared distance of p to the planes
+    float distanceSquared(const glm::vec3& p) const{
+        if (weight <= 0.0)
+            return 0.0f;
+        double x = p.x, y = p.y, z = p.z;
+        double r = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                 + 2.0 * (a03 * x + a13 * y + a23 * z) + a33;
+        return std::max(r, 0.0) / weight;
+    }
+};
+
+struct PositionHash {
+    size_t operator()(const glm::vec3& p) const{
+        uint32_t bits[3];
+        std::memcpy(bits, &p, sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    float cost; // squared distance moving from onto to adds
+};
+
+} // namespace mesh_simplifier_detail
+
+// Edge collapse simplification driven by quadric error metrics (Garland & Heckbert 1997). A vertex only
+// ever collapses onto a neighbour so the result indexes the same vertices. Stops at targetIndexCount
+// indices or once a collapse would move the surface further than targetError, whichever comes first.
+// Vertices on borders, non manifold edges and attribute seams (one position, several vertices) stay where
+// they are. resultError receives the largest deviation introduced.
+inline std::vector<uint32_t> simplifyMesh(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                                          size_t targetIndexCount, float targetError, float* resultError = nullptr)
+{
+    using namespace mesh_simplifier_detail;
+    uint32_t vertexCount = positions.size();
+
+    // vertices sharing a position move together, through their first vertex
+    std::vector<uint32_t> weld(vertexCount);
+    std::vector<uint32_t> wedgeCount(vertexCount, 0);
+    std::unordered_map<glm::vec3, uint32_t, PositionHash> firstAt;
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        weld[v] = firstAt.emplace(positions[v], v).first->second;
+        wedgeCount[weld[v]]++;
+    }
+
+    std::vector<uint32_t> result = indices;
+    std::vector<uint32_t> corners(result.size());
+    for (size_t i = 0; i < result.size(); ++i) {
+        corners[i] = weld[result[i]];
+    }
+
+    // an edge not shared by exactly two triangles is a border or non manifold
+    std::vector<bool> locked(vertexCount, false);
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    for (size_t t = 0; t < corners.size() / 3; ++t) {
+        for (uint32_t k = 0; k < 3; ++k) {
+            uint32_t a = corners[t * 3 + k], b = corners[t * 3 + (k + 1) % 3];
+            edgeUses[(uint64_t)std::min(a, b) << 32 | std::max(a, b)]++;
+        }
+    }
+    for (const auto& edge : edgeUses) {
+        if (edge.second != 2) {
+            locked[edge.first >> 32] = true;
+            locked[edge.first & 0xFFFFFFFF] = true;
+        }
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        if (wedgeCount[v] > 1)
+            locked[v] = true;
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t t = 0; t < corners.size() / 3; ++t) {
+        const glm::vec3& a = positions[corners[t * 3]];
+        const glm::vec3& b = positions[corners[t * 3 + 1]];
+        const glm::vec3& c = positions[corners[t * 3 + 2]];
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float area = glm::length(normal);
+        if (area <= 0.0f)
+            continue;
+        normal /= area;
+        Quadric plane = Quadric::fromPlane(normal, -glm::dot(normal, a), area * 0.5f);
+        for (uint32_t k = 0; k < 3; ++k) {
+            quadrics[corners[t * 3 + k]].add(plane);
+        }
+    }
+
+    float maxError = targetError * targetError;
+    float worstCollapse = 0.0f;
+    std::vector<Collapse> collapses;
+    std::vector<bool> touched(vertexCount);
+    std::vector<uint32_t> collapsedTo(vertexCount);   // welded vertex collapsed onto this pass
+    std::vector<uint32_t> collapsedWedge(vertexCount); // its vertex in the triangles around the collapsed one
+    std::vector<uint32_t> ring;
+    const uint32_t kept = UINT32_MAX;
+
+    // every pass collapses the cheapest edges whose neighbourhoods don't overlap, then rebuilds the triangles
+    while (result.size() > targetIndexCount) {
+        mesh_optimizer_detail::Adjacency adjacency(corners, vertexCount);
+        collapses.clear();
+        for (size_t t = 0; t < corners.size() / 3; ++t) {
+            for (uint32_t k = 0; k < 3; ++k) {
+                uint32_t a = corners[t * 3 + k], b = corners[t * 3 + (k + 1) % 3];
+                if (a > b)
+                    continue; // every interior edge is seen from both of its triangles
+                float ab = locked[a] ? INFINITY : quadrics[a].distanceSquared(positions[b]);
+                float ba = locked[b] ? INFINITY : quadrics[b].distanceSquared(positions[a]);
+                if (std::min(ab, ba) <= maxError)
+                    collapses.push_back(ab <= ba ? Collapse{a, b, ab} : Collapse{b, a, ba});
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y){ return x.cost < y.cost; });
+
+        std::fill(touched.begin(), touched.end(), false);
+        std::fill(collapsedTo.begin(), collapsedTo.end(), kept);
+        size_t removable = (result.size() - targetIndexCount) / 3;
+        size_t removed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (removed >= removable)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            // reject collapses flipping or squashing a triangle around from
+            bool valid = true;
+            uint32_t sharedTriangles = 0;
+            uint32_t wedge = kept;
+            ring.clear();
+            for (uint32_t i = adjacency.offsets[collapse.from]; i < adjacency.offsets[collapse.from + 1] && valid; ++i) {
+                uint32_t first = adjacency.triangles[i] * 3;
+                const uint32_t* triangle = &corners[first];
+                ring.insert(ring.end(), triangle, triangle + 3);
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+                    for (uint32_t k = 0; k < 3; ++k) {
+                        if (triangle[k] == collapse.to)
+                            wedge = result[first + k];
+                    }
+                    sharedTriangles++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (uint32_t k = 0; k < 3; ++k) {
+                    p[k] = positions[triangle[k]];
+                    q[k] = triangle[k] == collapse.from ? positions[collapse.to] : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                valid = glm::dot(before, after) > 0.25f * glm::length(before) * glm::length(after);
+            }
+            if (!valid)
+                continue;
+
+            // the two vertices may only share the neighbours of the triangles on their edge, more and the
+            // collapse would fold the surface onto itself
+            std::sort(ring.begin(), ring.end());
+            ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+            uint32_t sharedNeighbours = 0;
+            for (uint32_t i = adjacency.offsets[collapse.to]; i < adjacency.offsets[collapse.to + 1]; ++i) {
+                for (uint32_t k = 0; k < 3; ++k) {
+                    uint32_t v = corners[adjacency.triangles[i] * 3 + k];
+                    if (v != collapse.from && v != collapse.to && std::binary_search(ring.begin(), ring.end(), v))
+                        sharedNeighbours++;
+                }
+            }
+            // every shared neighbour is counted once per triangle around to using it, twice for the edge ones
+            if (sharedNeighbours > 2 * sharedTriangles)
+                continue;
+
+            // the one ring of from changes shape, no other collapse may rely on it this pass
+            for (uint32_t i = adjacency.offsets[collapse.from]; i < adjacency.offsets[collapse.from + 1]; ++i) {
+                for (uint32_t k = 0; k < 3; ++k) {
+                    touched[corners[adjacency.triangles[i] * 3 + k]] = true;
+                }
+            }
+            collapsedTo[collapse.from] = collapse.to;
+            collapsedWedge[collapse.from] = wedge;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            worstCollapse = std::max(worstCollapse, collapse.cost);
+            removed += sharedTriangles;
+        }
+        if (removed == 0)
+            break;
+
+        // from has a single vertex, its corners take the vertex of to used by the triangles around it
+        size_t write = 0;
+        for (size_t t = 0; t < result.size() / 3; ++t) {
+            uint32_t triangle[3], welded[3];
+            for (uint32_t k = 0; k < 3; ++k) {
+                uint32_t v = result[t * 3 + k];
+                uint32_t w = corners[t * 3 + k];
+                if (collapsedTo[w] != kept) {
+                    v = collapsedWedge[w];
+                    w = collapsedTo[w];
+                }
+                triangle[k] = v;
+                welded[k] = w;
+            }
+            if (welded[0] == welded[1] || welded[1] == welded[2] || welded[0] == welded[2])
+                continue;
+            for (uint32_t k = 0; k < 3; ++k) {
+                result[write] = triangle[k];
+                corners[write++] = welded[k];
+            }
+        }
+        result.resize(write);
+        corners.resize(write);
+    }
+
+    if (resultError != nullptr)
+        *resultError = std::sqrt(worstCollapse);
+    return result;
+}
+
+// Builds up to MAX_MESH_LODS levels below mesh, each with about LOD_TRIANGLE_RATIO of the triangles of
+// the previous one, and stores them on the mesh. Every level is simplified from the full mesh so errors
+// don't add up, then reordered for the vertex cache. The chain ends early once a level can't get
+// smaller without deviating more than maxRelativeError times the mesh radius.
+inline void generateLods(Mesh& mesh, const std::string& name = "Mesh", float maxRelativeError = LOD_MAX_RELATIVE_ERROR){
+    const std::vector<glm::vec3>& vertices = mesh.getVertices();
+    const std::vector<uint32_t>& indices = mesh.getTriangles();
+    for (uint32_t index : indices) {
+        if (index >= vertices.size()) {
+            Debug::LogWarning(name + " : index out of range, no LODs generated");
+            return;
+        }
+    }
+    if (vertices.empty())
+        return;
+
+    glm::vec3 minPos = vertices[0], maxPos = vertices[0];
+    for (const glm::vec3& v : vertices) {
+        minPos = glm::min(minPos, v);
+        maxPos = glm::max(maxPos, v);
+    }
+    float radius = glm::length(maxPos - minPos) * 0.5f;
+
+    std::vector<uint32_t> lodIndices;
+    std::vector<MeshLod> lods;
+    std::string counts = std::to_string(indices.size() / 3);
+    size_t previousCount = indices.size();
+    float previousError = 0.0f;
+    for (uint32_t level = 0; level < MAX_MESH_LODS; ++level) {
+        size_t targetCount = (size_t)(previousCount / 3 * LOD_TRIANGLE_RATIO) * 3;
+        float error = 0.0f;
+        std::vector<uint32_t> lod = simplifyMesh(vertices, indices, targetCount, maxRelativeError * radius, &error);
+        // not worth a level if the simplification got stuck on seams, borders or the error limit
+        if (lod.empty() || lod.size() > previousCount * 0.9f)
+            break;
+        optimizeVertexCache(lod, vertices.size());
+
+        previousError = std::max(previousError, error); // selection assumes coarser levels never look better
+        lods.push_back({(uint32_t)lodIndices.size(), (uint32_t)lod.size(), previousError});
+        lodIndices.insert(lodIndices.end(), lod.begin(), lod.end());
+        previousCount = lod.size();
+        counts += " -> " + std::to_string(lod.size() / 3);
+    }
+    Debug::Log(name + " : " + std::to_string(lods.size()) + " LODs, triangles " + counts);
+    mesh.setLods(std::move(lodIndices), std::move(lods));
+}
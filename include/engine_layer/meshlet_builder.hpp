@@ -0,0 +1,210 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include "debug.hpp"
+#include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+
+#define MESHLET_MIN_TRIANGLES 1024 // smaller meshes are only culled as a whole
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_CONE_MIN_SPREAD 0.1f // below this dot between the axis and a triangle normal the cone never culls
+
+// True if no triangle of a meshlet can face cameraPosition, everything in the same space
+inline bool isMeshletBackFacing(const Meshlet& meshlet, const glm::vec3& cameraPosition){
+    glm::vec3 toCenter = meshlet.center - cameraPosition;
+    return glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
+
+inline void computeMeshletBounds(Meshlet& meshlet, const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions){
+    const uint32_t* triangles = &indices[meshlet.firstIndex];
+    glm::vec3 minPos = positions[triangles[0]], maxPos = minPos;
+    glm::vec3 normalSum(0.0f);
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.triangleCount);
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+        const glm::vec3& a = positions[triangles[t * 3]];
+        const glm::vec3& b = positions[triangles[t * 3 + 1]];
+        const glm::vec3& c = positions[triangles[t * 3 + 2]];
+        minPos = glm::min(glm::min(minPos, a), glm::min(b, c));
+        maxPos = glm::max(glm::max(maxPos, a), glm::max(b, c));
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        if (length > 0.0f) {
+            normals.push_back(normal / length);
+            normalSum += normals.back();
+        }
+    }
+
+    meshlet.center = (minPos + maxPos) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet.triangleCount * 3; ++i) {
+        meshlet.radius = std::max(meshlet.radius, glm::length(positions[triangles[i]] - meshlet.center));
+    }
+
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    float sumLength = glm::length(normalSum);
+    if (sumLength <= 0.0f)
+        return;
+    meshlet.coneAxis = normalSum / sumLength;
+    float minDot = 1.0f;
+    for (const glm::vec3& normal : normals) {
+        minDot = std::min(minDot, glm::dot(normal, meshlet.coneAxis));
+    }
+    if (minDot > MESHLET_CONE_MIN_SPREAD)
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+// Splits a mesh into meshlets of at most maxVertices vertices and maxTriangles triangles, reordering
+// the triangles so every meshlet is a contiguous index range. Meshlets grow through shared vertices,
+// taking the neighbouring triangle that adds the fewest new vertices, and start over from the next
+// triangle in input order when none fits so a vertex cache friendly order is mostly kept.
+inline std::vector<Meshlet> buildMeshlets(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+                                          uint32_t maxVertices = MESHLET_MAX_VERTICES, uint32_t maxTriangles = MESHLET_MAX_TRIANGLES)
+{
+    std::vector<Meshlet> meshlets;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return meshlets;
+
+    mesh_optimizer_detail::Adjacency adjacency(indices, positions.size());
+    std::vector<bool> emitted(triangleCount, false);
+    const uint32_t none = UINT32_MAX;
+    std::vector<uint32_t> usedBy(positions.size(), none); // meshlet last using every vertex
+    std::vector<uint32_t> vertices;                       // of the meshlet being built
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    auto newVertices = [&](uint32_t triangle){
+        uint32_t count = 0;
+        for (uint32_t k = 0; k < 3; ++k) {
+            count += usedBy[indices[triangle * 3 + k]] != meshlets.size() - 1;
+        }
+        return count;
+    };
+
+    size_t scanCursor = 0;
+    uint32_t triangle = 0;
+    meshlets.push_back({0, 0, 0});
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+        Meshlet* meshlet = &meshlets.back();
+        if (triangle == none || meshlet->triangleCount == maxTriangles || meshlet->vertexCount + newVertices(triangle) > maxVertices) {
+            // closed, the next one starts at the first triangle left in input order
+            if (meshlet->triangleCount > 0) {
+                meshlets.push_back({(uint32_t)output.size(), 0, 0});
+                meshlet = &meshlets.back();
+                vertices.clear();
+            }
+            while (emitted[scanCursor]) {
+                scanCursor++;
+            }
+            triangle = scanCursor;
+        }
+
+        emitted[triangle] = true;
+        for (uint32_t k = 0; k < 3; ++k) {
+            uint32_t v = indices[triangle * 3 + k];
+            output.push_back(v);
+            if (usedBy[v] != meshlets.size() - 1) {
+                usedBy[v] = meshlets.size() - 1;
+                vertices.push_back(v);
+                meshlet->vertexCount++;
+            }
+        }
+        meshlet->triangleCount++;
+
+        // neighbour adding the fewest vertices
+        triangle = none;
+        uint32_t bestNew = 4;
+        for (uint32_t v : vertices) {
+            for (uint32_t a = adjacency.offsets[v]; a < adjacency.offsets[v + 1] && bestNew > 0; ++a) {
+                uint32_t candidate = adjacency.triangles[a];
+                if (emitted[candidate])
+                    continue;
+                uint32_t added = newVertices(candidate);
+                if (added < bestNew) {
+                    bestNew = added;
+                    triangle = candidate;
+                }
+            }
+            if (bestNew == 0)
+                break;
+        }
+    }
+
+    indices.swap(output);
+    for (Meshlet& meshlet : meshlets) {
+        computeMeshletBounds(meshlet, indices, positions);
+    }
+    return meshlets;
+}
+
+// Post transform cache order inside every meshlet, which only reorders triangles within their range
+// so the meshlets and their bounds stay valid. Runs on meshlet local vertex numbers, a meshlet has
+// at most MESHLET_MAX_VERTICES.
+inline void optimizeMeshletVertexCache(std::vector<uint32_t>& indices, const std::vector<Meshlet>& meshlets, uint32_t vertexCount){
+    const uint32_t unused = UINT32_MAX;
+    std::vector<uint32_t> localOf(vertexCount, unused);
+    std::vector<uint32_t> globalOf;
+    std::vector<uint32_t> local;
+    for (const Meshlet& meshlet : meshlets) {
+        uint32_t* triangles = &indices[meshlet.firstIndex];
+        uint32_t count = meshlet.triangleCount * 3;
+        globalOf.clear();
+        local.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (localOf[triangles[i]] == unused) {
+                localOf[triangles[i]] = globalOf.size();
+                globalOf.push_back(triangles[i]);
+            }
+            local[i] = localOf[triangles[i]];
+        }
+        optimizeVertexCache(local, globalOf.size());
+        for (uint32_t i = 0; i < count; ++i) {
+            triangles[i] = globalOf[local[i]];
+        }
+        for (uint32_t v : globalOf) {
+            localOf[v] = unused;
+        }
+    }
+}
+
+// Splits meshes of MESHLET_MIN_TRIANGLES or more into meshlets, replacing their triangle order.
+// Meshlets are grown in the order of the input so an overdraw order mostly survives, and with
+// optimize every meshlet is then put in vertex cache order and the vertices renumbered in fetch
+// order. Before LODs are generated, they'd index the old numbering. Logs the final cache stats.
+inline void generateMeshlets(Mesh& mesh, const std::string& name = "Mesh", bool optimize = true){
+    const std::vector<glm::vec3>& vertices = mesh.getVertices();
+    std::vector<uint32_t> indices = mesh.getTriangles();
+    if (indices.size() / 3 < MESHLET_MIN_TRIANGLES)
+        return;
+    for (uint32_t index : indices) {
+        if (index >= vertices.size()) {
+            Debug::LogWarning(name + " : index out of range, no meshlets built");
+            return;
+        }
+    }
+
+    std::vector<Meshlet> meshlets = buildMeshlets(indices, vertices);
+    if (!optimize || mesh.getNormals().size() != vertices.size()) {
+        mesh.setMeshlets(std::move(indices), std::move(meshlets));
+        Debug::Log(name + " : " + std::to_string(mesh.getMeshlets().size()) + " meshlets");
+        return;
+    }
+    optimizeMeshletVertexCache(indices, meshlets, vertices.size());
+    std::vector<glm::vec3> fetchVertices = vertices;
+    std::vector<glm::vec3> fetchNormals = mesh.getNormals();
+    optimizeVertexFetch(indices, fetchVertices, fetchNormals); // meshlet bounds don't depend on the numbering
+
+    VertexCacheStats stats = analyzeVertexCache(indices, fetchVertices.size());
+    Debug::Log(name + " : " + std::to_string(meshlets.size()) + " meshlets, ACMR " + std::to_string(stats.acmr) +
+               ", ATVR " + std::to_string(stats.atvr));
+    Mesh split(std::move(fetchVertices), {}, std::move(fetchNormals)); // no LODs yet
+    split.setMeshlets(std::move(indices), std::move(meshlets));
+    mesh = std::move(split);
+}
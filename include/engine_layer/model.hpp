@@ -0,0 +1,65 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "mesh.hpp"
+
+// Node of a model hierarchy. The transform is relative to the parent node.
+struct ModelNode {
+    std::string name;
+    glm::mat4 transform;
+    int32_t parent;                // index in the model nodes, -1 for the root
+    std::vector<uint32_t> meshes;  // submeshes drawn at this node
+};
+
+// Submeshes of an imported file and the node hierarchy placing them. Nodes are stored parents first.
+class Model {
+private:
+    std::vector<Mesh> meshes;
+    std::vector<ModelNode> nodes;
+    std::vector<glm::mat4> worldTransforms; // node to model space, one per node
+
+public:
+    Model(std::vector<Mesh> _meshes, std::vector<ModelNode> _nodes): meshes(std::move(_meshes)), nodes(std::move(_nodes)){
+        worldTransforms.reserve(nodes.size());
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            const ModelNode& node = nodes[n];
+            if (node.parent >= (int32_t)n)
+                throw std::runtime_error("Model : node " + node.name + " comes before its parent");
+            for (uint32_t mesh : node.meshes) {
+                if (mesh >= meshes.size())
+                    throw std::runtime_error("Model : node " + node.name + " uses a missing mesh");
+            }
+            worldTransforms.push_back(node.parent < 0 ? node.transform : worldTransforms[node.parent] * node.transform);
+        }
+    }
+
+    const std::vector<Mesh>& getMeshes() const{
+        return meshes;
+    }
+
+    const std::vector<ModelNode>& getNodes() const{
+        return nodes;
+    }
+
+    const glm::mat4& getWorldTransform(uint32_t node) const{
+        return worldTransforms.at(node);
+    }
+
+    // Every submesh in one Mesh, node transforms left out. For consumers that only handle one mesh.
+    Mesh flatten() const{
+        std::vector<glm::vec3> vertices;
+        std::vector<glm::vec3> normals;
+        std::vector<uint32_t> indices;
+        for (const Mesh& mesh : meshes) {
+            uint32_t base = vertices.size();
+            vertices.insert(vertices.end(), mesh.getVertices().begin(), mesh.getVertices().end());
+            normals.insert(normals.end(), mesh.getNormals().begin(), mesh.getNormals().end());
+            for (uint32_t index : mesh.getTriangles()) {
+                indices.push_back(base + index);
+            }
+        }
+        return Mesh(std::move(vertices), std::move(indices), std::move(normals));
+    }
+};
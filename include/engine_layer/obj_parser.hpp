@@ -0,0 +1,309 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+#include "job_system.hpp"
+
+#define OBJ_MIN_CHUNK_SIZE (1 << 20) // bytes of text per parse job at least
+
+// One corner of an OBJ face. Negative OBJ indices count back from the vertices read so far, the chunk
+// they were read in doesn't know how many came before it : they are stored chunk relative and flagged.
+struct ObjCorner {
+    int32_t position;
+    int32_t normal;
+    uint8_t flags;       // OBJ_CORNER_* bits
+};
+#define OBJ_CORNER_RELATIVE_POSITION 1
+#define OBJ_CORNER_RELATIVE_NORMAL 2
+#define OBJ_CORNER_HAS_NORMAL 4
+
+// What one parse job read from its range of lines. Faces are already fanned into triangles.
+struct ObjChunk {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<ObjCorner> corners; // 3 per triangle
+    std::string error;
+};
+
+namespace obj_detail {
+
+inline const char* skipBlanks(const char* p, const char* end){
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    return p;
+}
+
+inline const char* lineEnd(const char* p, const char* end){
+    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline != nullptr ? newline : end;
+}
+
+inline const char* parseFloat(const char* p, const char* end, float& value){
+    p = skipBlanks(p, end);
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    if (p < end && *p == '+')
+        ++p; // from_chars refuses a leading plus
+    std::from_chars_result result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+#else
+    // no floating point from_chars on this standard library, strtof needs a terminated copy
+    char buffer[64];
+    size_t length = 0;
+    while (p + length < end && length < sizeof(buffer) - 1 && std::strchr("0123456789+-.eE", p[length]) != nullptr)
+        ++length;
+    std::memcpy(buffer, p, length);
+    buffer[length] = '\0';
+    char* parsedEnd;
+    value = std::strtof(buffer, &parsedEnd);
+    return parsedEnd == buffer ? nullptr : p + (parsedEnd - buffer);
+#endif
+}
+
+inline const char* parseInt(const char* p, const char* end, int32_t& value){
+    std::from_chars_result result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// Resolves an OBJ index read when count items of its kind were known in the chunk
+inline bool storeIndex(int32_t objIndex, int32_t count, int32_t& stored, uint8_t& flags, uint8_t relativeBit){
+    if (objIndex > 0) {
+        stored = objIndex - 1;
+    }
+    else if (objIndex < 0) {
+        stored = count + objIndex; // may go below zero, resolved with the chunk base later
+        flags |= relativeBit;
+    }
+    else {
+        return false; // OBJ indices start at 1
+    }
+    return true;
+}
+
+// Parses the whole lines of [begin, end)
+inline void parseChunk(const char* begin, const char* end, ObjChunk& chunk){
+    std::vector<ObjCorner> face;
+    const char* p = begin;
+    while (p < end) {
+        const char* eol = lineEnd(p, end);
+        p = skipBlanks(p, eol);
+
+        if (eol - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            glm::vec3 v;
+            const char* q = parseFloat(p + 2, eol, v.x);
+            if (q) q = parseFloat(q, eol, v.y);
+            if (q) q = parseFloat(q, eol, v.z);
+            if (!q) {
+                chunk.error = "malformed vertex \"" + std::string(p, eol) + "\"";
+                return;
+            }
+            chunk.positions.push_back(v); // w or vertex colors after xyz are ignored
+        }
+        else if (eol - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+            glm::vec3 n;
+            const char* q = parseFloat(p + 3, eol, n.x);
+            if (q) q = parseFloat(q, eol, n.y);
+            if (q) q = parseFloat(q, eol, n.z);
+            if (!q) {
+                chunk.error = "malformed normal \"" + std::string(p, eol) + "\"";
+                return;
+            }
+            chunk.normals.push_back(n);
+        }
+        else if (eol - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            // v, v/vt, v//vn or v/vt/vn per corner, texture coordinates are not kept
+            face.clear();
+            const char* q = skipBlanks(p + 2, eol);
+            while (q < eol) {
+                ObjCorner corner{0, 0, 0};
+                int32_t objIndex;
+                q = parseInt(q, eol, objIndex);
+                if (!q || !storeIndex(objIndex, chunk.positions.size(), corner.position, corner.flags, OBJ_CORNER_RELATIVE_POSITION))
+                    break;
+                if (q < eol && *q == '/') {
+                    ++q;
+                    if (q < eol && *q != '/') {
+                        q = parseInt(q, eol, objIndex); // texture coordinate
+                        if (!q)
+                            break;
+                    }
+                    if (q < eol && *q == '/') {
+                        ++q;
+                        q = parseInt(q, eol, objIndex);
+                        if (!q || !storeIndex(objIndex, chunk.normals.size(), corner.normal, corner.flags, OBJ_CORNER_RELATIVE_NORMAL))
+                            break;
+                        corner.flags |= OBJ_CORNER_HAS_NORMAL;
+                    }
+                }
+                face.push_back(corner);
+                q = skipBlanks(q, eol);
+            }
+            if (q != eol || face.size() < 3) {
+                chunk.error = "malformed face \"" + std::string(p, eol) + "\"";
+                return;
+            }
+            // convex polygons fanned around their first corner
+            for (size_t c = 1; c + 1 < face.size(); ++c) {
+                chunk.corners.push_back(face[0]);
+                chunk.corners.push_back(face[c]);
+                chunk.corners.push_back(face[c + 1]);
+            }
+        }
+        // vt, comments, groups, materials and smoothing groups are skipped
+        p = eol < end ? eol + 1 : end;
+    }
+}
+
+} // namespace obj_detail
+
+// Parses OBJ text into a Mesh. Vertices sharing a position and a normal are merged, corners without a
+// normal get the area weighted normal of their faces. With a job system, big inputs are split at line
+// boundaries and the chunks parsed in parallel.
+inline Mesh parseOBJ(const char* data, size_t size, JobSystem* jobs = nullptr, const std::string& name = "OBJ"){
+    using namespace obj_detail;
+    const char* end = data + size;
+
+    size_t chunkCount = 1;
+    if (jobs != nullptr)
+        chunkCount = std::max<size_t>(1, std::min<size_t>(jobs->getThreadCount() * 4, size / OBJ_MIN_CHUNK_SIZE));
+    std::vector<const char*> bounds(chunkCount + 1, end);
+    bounds[0] = data;
+    for (size_t c = 1; c < chunkCount; ++c) {
+        const char* split = std::max(data + size * c / chunkCount, bounds[c - 1]);
+        bounds[c] = std::min(lineEnd(split, end) + 1, end);
+    }
+
+    std::vector<ObjChunk> chunks(chunkCount);
+    if (chunkCount == 1) {
+        parseChunk(data, end, chunks[0]);
+    }
+    else {
+        jobs->parallelFor(chunkCount, 1, [&](uint32_t first, uint32_t last){
+            for (uint32_t c = first; c < last; ++c)
+                parseChunk(bounds[c], bounds[c + 1], chunks[c]);
+        });
+    }
+
+    size_t positionCount = 0, normalCount = 0, cornerCount = 0;
+    for (const ObjChunk& chunk : chunks) {
+        if (!chunk.error.empty())
+            throw std::runtime_error(name + " : " + chunk.error);
+        positionCount += chunk.positions.size();
+        normalCount += chunk.normals.size();
+        cornerCount += chunk.corners.size();
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> objNormals;
+    positions.reserve(positionCount);
+    objNormals.reserve(normalCount);
+    for (const ObjChunk& chunk : chunks) {
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        objNormals.insert(objNormals.end(), chunk.normals.begin(), chunk.normals.end());
+    }
+
+    // Output vertices are (position, normal) pairs, merged in file order so the output doesn't depend on
+    // the chunk count. The vertices sharing a position are chained from it : faces around a position are
+    // usually close in the file, which keeps this far more cache friendly than a hash map.
+    std::vector<uint32_t> indices;
+    indices.reserve(cornerCount);
+    std::vector<int32_t> firstVertexOf(normalCount > 0 ? positionCount : 0, -1);
+    std::vector<int32_t> nextVertex;   // next vertex with the same position, -1 ends the chain
+    std::vector<int32_t> vertexSource; // position of every output vertex
+    std::vector<int32_t> vertexNormal; // OBJ normal of every output vertex, -1 if none
+    vertexSource.reserve(positionCount);
+    vertexNormal.reserve(positionCount);
+    nextVertex.reserve(positionCount);
+    bool missingNormals = false;
+
+    int32_t positionBase = 0, normalBase = 0;
+    for (ObjChunk& chunk : chunks) {
+        for (const ObjCorner& corner : chunk.corners) {
+            int32_t position = corner.position;
+            if (corner.flags & OBJ_CORNER_RELATIVE_POSITION)
+                position += positionBase;
+            int32_t normal = -1;
+            if (corner.flags & OBJ_CORNER_HAS_NORMAL)
+                normal = corner.normal + ((corner.flags & OBJ_CORNER_RELATIVE_NORMAL) ? normalBase : 0);
+            if (position < 0 || position >= (int32_t)positionCount ||
+                ((corner.flags & OBJ_CORNER_HAS_NORMAL) && (normal < 0 || normal >= (int32_t)normalCount)))
+                throw std::runtime_error(name + " : face index out of range");
+            missingNormals |= normal < 0;
+
+            if (normalCount == 0) {
+                indices.push_back(position); // without normals a vertex is its position
+                continue;
+            }
+            int32_t vertex = firstVertexOf[position];
+            int32_t last = -1;
+            while (vertex >= 0 && vertexNormal[vertex] != normal) {
+                last = vertex;
+                vertex = nextVertex[vertex];
+            }
+            if (vertex < 0) {
+                vertex = vertexSource.size();
+                vertexSource.push_back(position);
+                vertexNormal.push_back(normal);
+                nextVertex.push_back(-1);
+                if (last < 0)
+                    firstVertexOf[position] = vertex;
+                else
+                    nextVertex[last] = vertex;
+            }
+            indices.push_back(vertex);
+        }
+        positionBase += chunk.positions.size();
+        normalBase += chunk.normals.size();
+        chunk = ObjChunk(); // release as we go
+    }
+
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<bool> generated; // vertices whose normal comes from their faces
+    if (normalCount == 0) {
+        vertices = std::move(positions);
+        normals.assign(vertices.size(), glm::vec3(0.0f));
+        generated.assign(vertices.size(), true);
+    }
+    else {
+        vertices.resize(vertexSource.size());
+        normals.resize(vertexSource.size(), glm::vec3(0.0f));
+        generated.resize(vertexSource.size());
+        for (size_t v = 0; v < vertexSource.size(); ++v) {
+            vertices[v] = positions[vertexSource[v]];
+            if (vertexNormal[v] >= 0)
+                normals[v] = objNormals[vertexNormal[v]];
+            generated[v] = vertexNormal[v] < 0;
+        }
+    }
+
+    if (missingNormals) {
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            uint32_t a = indices[t], b = indices[t + 1], c = indices[t + 2];
+            glm::vec3 faceNormal = glm::cross(vertices[b] - vertices[a], vertices[c] - vertices[a]); // length is twice the area
+            if (generated[a]) normals[a] += faceNormal;
+            if (generated[b]) normals[b] += faceNormal;
+            if (generated[c]) normals[c] += faceNormal;
+        }
+        for (size_t v = 0; v < vertices.size(); ++v) {
+            if (generated[v]) {
+                float length = glm::length(normals[v]);
+                normals[v] = length > 0.0f ? normals[v] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+            }
+        }
+    }
+
+    return Mesh(std::move(vertices), std::move(indices), std::move(normals));
+}
+
+inline Mesh parseOBJFile(const std::string& path, JobSystem* jobs = nullptr){
+    MappedFile file(path);
+    return parseOBJ(reinterpret_cast<const char*>(file.data()), file.getSize(), jobs, path);
+}
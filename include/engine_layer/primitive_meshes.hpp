@@ -3,6 +3,8 @@
 #include <glm/glm.hpp>
 #include "debug.hpp"
 #include "mesh.hpp"
+#include "model.hpp"
+#include "obj_parser.hpp"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
@@ -12,6 +14,7 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <memory>
 Mesh generateTetrahedron(){
     // Vertices of a regular tetrahedron centered at the origin
     std::vector<glm::vec3> vertices = {
@@ -109,7 +112,53 @@ Mesh generateSphere() {
 }
 
 
-Mesh importMesh(std::string meshPath){
+// Copies one aiMesh, faces that aren't triangles (points and lines) are dropped
+Mesh convertMesh(const aiMesh* mesh){
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<uint32_t> indices;
+    vertices.reserve(mesh->mNumVertices);
+    normals.reserve(mesh->mNumVertices);
+    indices.reserve(mesh->mNumFaces * 3);
+
+    // Vertices & normals
+    for (unsigned int v = 0; v < mesh->mNumVertices; ++v) {
+        aiVector3D pos = mesh->mVertices[v];
+        aiVector3D norm = mesh->HasNormals() ? mesh->mNormals[v] : aiVector3D(0,1,0);
+
+        vertices.push_back(glm::vec3(pos.x, pos.y, pos.z));
+        normals.push_back(glm::vec3(norm.x, norm.y, norm.z));
+    }
+
+    // Indices
+    for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+        const aiFace& face = mesh->mFaces[f];
+        if (face.mNumIndices != 3)
+            continue;
+        indices.insert(indices.end(), face.mIndices, face.mIndices + 3);
+    }
+    return Mesh(std::move(vertices), std::move(indices), std::move(normals));
+}
+
+// aiMatrix4x4 is row major, glm column major
+glm::mat4 convertMatrix(const aiMatrix4x4& m){
+    return glm::mat4(m.a1, m.b1, m.c1, m.d1,
+                     m.a2, m.b2, m.c2, m.d2,
+                     m.a3, m.b3, m.c3, m.d3,
+                     m.a4, m.b4, m.c4, m.d4);
+}
+
+void appendNodes(const aiNode* node, int32_t parent, std::vector<ModelNode>& nodes){
+    int32_t index = nodes.size();
+    nodes.push_back({node->mName.C_Str(), convertMatrix(node->mTransformation), parent,
+                     std::vector<uint32_t>(node->mMeshes, node->mMeshes + node->mNumMeshes)});
+    for (unsigned int c = 0; c < node->mNumChildren; ++c) {
+        appendNodes(node->mChildren[c], index, nodes);
+    }
+}
+
+// One Model submesh per aiMesh, converted in parallel when given a job system
+Model importModel(const std::string& meshPath, JobSystem* jobs = nullptr){
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(meshPath,
         aiProcess_Triangulate |
@@ -122,72 +171,35 @@ Mesh importMesh(std::string meshPath){
         throw std::runtime_error("Couldn't load mesh " + meshPath);
     }
 
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> normals;
-    std::vector<uint32_t> indices;
-
-    for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
-        aiMesh* mesh = scene->mMeshes[m];
-
-        // Vertices & normals
-        for (unsigned int v = 0; v < mesh->mNumVertices; ++v) {
-            aiVector3D pos = mesh->mVertices[v];
-            aiVector3D norm = mesh->HasNormals() ? mesh->mNormals[v] : aiVector3D(0,1,0);
-
-            vertices.push_back(glm::vec3(pos.x, pos.y, pos.z));
-            normals.push_back(glm::vec3(norm.x, norm.y, norm.z));
-        }
-
-        // Indices
-        for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
-            aiFace face = mesh->mFaces[f];
-            for (unsigned int i = 0; i < face.mNumIndices; ++i) {
-                indices.push_back(face.mIndices[i]);
-            }
-        }
-    }
-    return Mesh(vertices, indices, normals);
-}
-
-Mesh loadOBJ(const std::string& path) {
-    std::vector<glm::vec3> vertices; 
-    std::vector<glm::vec3> normals;
-    std::vector<uint32_t> indices;
-    std::ifstream file(path);
-    if (!file.is_open()){
-        Debug::LogError("Can't load mesh " + path + " !");
-        throw std::runtime_error("Couldn't load mesh " + path);
+    // Mesh has no empty state, every job fills its own slot then they're moved out in order
+    std::vector<std::unique_ptr<Mesh>> converted(scene->mNumMeshes);
+    auto convertRange = [&](uint32_t first, uint32_t last){
+        for (uint32_t m = first; m < last; ++m)
+            converted[m] = std::make_unique<Mesh>(convertMesh(scene->mMeshes[m]));
+    };
+    if (jobs != nullptr)
+        jobs->parallelFor(scene->mNumMeshes, 1, convertRange);
+    else
+        convertRange(0, scene->mNumMeshes);
+
+    std::vector<Mesh> meshes;
+    meshes.reserve(converted.size());
+    for (auto& mesh : converted) {
+        meshes.push_back(std::move(*mesh));
     }
 
+    std::vector<ModelNode> nodes;
+    if (scene->mRootNode != nullptr)
+        appendNodes(scene->mRootNode, -1, nodes);
+    return Model(std::move(meshes), std::move(nodes));
+}
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::stringstream ss(line);
-        std::string prefix;
-        ss >> prefix;
-
-        if (prefix == "v") {
-            glm::vec3 v;
-            ss >> v.x >> v.y >> v.z;
-            vertices.push_back(v);
-        } 
-        else if (prefix == "vn") {
-            glm::vec3 n;
-            ss >> n.x >> n.y >> n.z;
-            normals.push_back(n);
-        } 
-        else if (prefix == "f") {
-            std::string vertStr;
-            for (int i = 0; i < 3; ++i) {
-                ss >> vertStr;
-                std::replace(vertStr.begin(), vertStr.end(), '/', ' ');
-                std::stringstream vss(vertStr);
-                int vi, ti, ni;
-                vss >> vi >> ti >> ni; // ignore texture index
-                indices.push_back(vi - 1); // store vertex index
-            }
-        }
-    }
+// Every submesh merged into one mesh, see Model::flatten
+Mesh importMesh(const std::string& meshPath){
+    return importModel(meshPath).flatten();
+}
 
-    return Mesh(vertices, indices, normals);
+// Normals come from the vn indices of every corner, or are generated for corners without one
+Mesh loadOBJ(const std::string& path, JobSystem* jobs = nullptr) {
+    return parseOBJFile(path, jobs);
 }
\ No newline at end of file
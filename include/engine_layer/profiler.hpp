@@ -0,0 +1,269 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define PROFILER_RING_CAPACITY 65536 // zones kept per thread, the oldest are overwritten
+#define PROFILER_FRAME_HISTORY 256   // frame starts kept to pick the frames an export covers
+
+// Scoped CPU zones, compiled in with CRUMBS_ENABLE_PROFILER only (the CMake option of the same name).
+// Without it the macros expand to nothing. Zone names must be string literals, only the pointer is kept.
+#ifdef CRUMBS_ENABLE_PROFILER
+#define CRUMBS_PROFILE_CONCAT_INNER(a, b) a##b
+#define CRUMBS_PROFILE_CONCAT(a, b) CRUMBS_PROFILE_CONCAT_INNER(a, b)
+#define CRUMBS_PROFILE_SCOPE(name) ProfileZone CRUMBS_PROFILE_CONCAT(crumbsProfileZone, __LINE__)(name)
+#define CRUMBS_PROFILE_FUNCTION() CRUMBS_PROFILE_SCOPE(__func__)
+#define CRUMBS_PROFILE_FRAME() Profiler::markFrame()
+#define CRUMBS_PROFILE_THREAD(name) Profiler::setThreadName(name)
+#else
+#define CRUMBS_PROFILE_SCOPE(name)
+#define CRUMBS_PROFILE_FUNCTION()
+#define CRUMBS_PROFILE_FRAME()
+#define CRUMBS_PROFILE_THREAD(name)
+#endif
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t start; // Profiler::now() ticks
+    uint64_t end;
+};
+
+// Ring entry. Exports copy entries while their owner may overwrite them : the fields are atomics so
+// the copy isn't a data race, and a copy is only kept if sequence held its zone before and after it.
+struct ProfileSlot {
+    std::atomic<uint64_t> sequence{0}; // zone index + 1, 0 while being written
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> end{0};
+};
+
+// Zones of one thread. Only the owner thread writes, the event is stored before the count is
+// published. Owned by the profiler so the zones of finished threads can still be exported, until a
+// new thread takes the ring over.
+struct ProfilerThreadBuffer {
+    std::unique_ptr<ProfileSlot[]> events{new ProfileSlot[PROFILER_RING_CAPACITY]};
+    std::atomic<uint64_t> written{0}; // zones ever written, the last PROFILER_RING_CAPACITY are kept
+    uint64_t first = 0;               // first zone of the current owner, guarded by the profiler mutex
+    uint32_t threadId = 0;
+    std::string threadName;           // guarded by the profiler mutex
+};
+
+// Collects the zones of every thread and exports a range of frames as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev both open. Recording a zone is two clock reads and a store
+// into the ring of the thread, no lock and no allocation after the first zone of a thread. On x86
+// the clock is the time stamp counter, read in a fraction of a steady_clock::now() and converted
+// to nanoseconds against the steady clock at export.
+class Profiler {
+private:
+    struct State {
+        std::mutex mutex; // threads registering, naming and exports
+        std::vector<std::unique_ptr<ProfilerThreadBuffer>> threads;
+        std::vector<ProfilerThreadBuffer*> freeBuffers; // rings of exited threads, reused before allocating
+        uint32_t nextThreadId = 1;
+        std::atomic<uint64_t> frameCount{0};
+        std::atomic<uint64_t> frameStarts[PROFILER_FRAME_HISTORY];
+        uint64_t baseTicks = now(); // calibration start
+        uint64_t baseNanoseconds = steadyNanoseconds();
+    };
+
+    static State& state(){
+        static State instance;
+        return instance;
+    }
+
+    // Ring of the calling thread, the one of an exited thread if any so thread churn doesn't grow memory
+    static ProfilerThreadBuffer* registerThread(){
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        ProfilerThreadBuffer* buffer;
+        if (!s.freeBuffers.empty()) {
+            buffer = s.freeBuffers.back();
+            s.freeBuffers.pop_back();
+            buffer->first = buffer->written.load(std::memory_order_relaxed); // the zones of the last owner go
+        } else {
+            s.threads.push_back(std::make_unique<ProfilerThreadBuffer>());
+            buffer = s.threads.back().get();
+        }
+        buffer->threadId = s.nextThreadId++;
+        buffer->threadName = "Thread " + std::to_string(buffer->threadId);
+        return buffer;
+    }
+
+    static void releaseThread(ProfilerThreadBuffer* buffer){
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.freeBuffers.push_back(buffer);
+    }
+
+    // Hands the ring back when its thread exits, its zones stay exportable until it is reused
+    struct ThreadRegistration {
+        ProfilerThreadBuffer* buffer = registerThread();
+
+        ~ThreadRegistration(){
+            releaseThread(buffer);
+        }
+    };
+
+    static void writeEscaped(std::ofstream& out, const std::string& text){
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            if ((unsigned char)c >= 0x20)
+                out << c;
+        }
+    }
+
+    static uint64_t steadyNanoseconds(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Nanoseconds per now() tick, measured over the time since the first zone
+    static double nanosecondsPerTick(){
+#if defined(__x86_64__) || defined(__i386__)
+        State& s = state();
+        uint64_t ticks = now() - s.baseTicks;
+        uint64_t nanoseconds = steadyNanoseconds() - s.baseNanoseconds;
+        return ticks > 0 && nanoseconds > 0 ? (double)nanoseconds / ticks : 1.0;
+#else
+        return 1.0;
+#endif
+    }
+
+public:
+    // Zone clock, only differences are meaningful
+    static uint64_t now(){
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc(); // invariant on every CPU this runs on, constant rate across cores and sleep states
+#else
+        return steadyNanoseconds();
+#endif
+    }
+
+    static ProfilerThreadBuffer& threadBuffer(){
+        thread_local ThreadRegistration registration;
+        return *registration.buffer;
+    }
+
+    static void record(const char* name, uint64_t start, uint64_t end){
+        ProfilerThreadBuffer& buffer = threadBuffer();
+        uint64_t index = buffer.written.load(std::memory_order_relaxed);
+        ProfileSlot& slot = buffer.events[index % PROFILER_RING_CAPACITY];
+        // release stores, plain moves on x86 : a reader seeing any field also sees the sequence reset
+        slot.sequence.store(0, std::memory_order_relaxed);
+        slot.name.store(name, std::memory_order_release);
+        slot.start.store(start, std::memory_order_release);
+        slot.end.store(end, std::memory_order_release);
+        slot.sequence.store(index + 1, std::memory_order_release);
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+    // Shown as the track name of the calling thread
+    static void setThreadName(const std::string& name){
+        ProfilerThreadBuffer& buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(state().mutex);
+        buffer.threadName = name;
+    }
+
+    // Start of a frame, from the thread driving the frames
+    static void markFrame(){
+        State& s = state();
+        uint64_t frame = s.frameCount.load(std::memory_order_relaxed);
+        s.frameStarts[frame % PROFILER_FRAME_HISTORY].store(now(), std::memory_order_relaxed);
+        s.frameCount.store(frame + 1, std::memory_order_release);
+    }
+
+    static uint64_t getFrameCount(){
+        return state().frameCount.load(std::memory_order_acquire);
+    }
+
+    // Writes the zones of every thread overlapping the last frameCount complete frames, false if
+    // fewer frames were marked or the file can't be written. Threads keep recording meanwhile, zones
+    // they overwrite during the copy are left out.
+    static bool writeChromeTrace(const std::string& path, uint32_t frameCount){
+        State& s = state();
+        uint64_t marked = getFrameCount();
+        // the last frame marked is still being built
+        if (frameCount == 0 || marked < frameCount + 1 || frameCount + 1 > PROFILER_FRAME_HISTORY)
+            return false;
+        uint64_t rangeStart = s.frameStarts[(marked - 1 - frameCount) % PROFILER_FRAME_HISTORY].load(std::memory_order_relaxed);
+        uint64_t rangeEnd = s.frameStarts[(marked - 1) % PROFILER_FRAME_HISTORY].load(std::memory_order_relaxed);
+
+        std::ofstream out(path, std::ios::trunc);
+        if (!out.is_open())
+            return false;
+
+        double tickNanoseconds = nanosecondsPerTick();
+        out.setf(std::ios::fixed);
+        out.precision(3); // microseconds
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        std::vector<ProfileEvent> events;
+        for (const auto& thread : s.threads) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->threadId << ",\"args\":{\"name\":\"";
+            writeEscaped(out, thread->threadName);
+            out << "\"}}";
+            first = false;
+
+            uint64_t written = thread->written.load(std::memory_order_acquire);
+            uint64_t begin = std::max<uint64_t>(thread->first, written > PROFILER_RING_CAPACITY ? written - PROFILER_RING_CAPACITY : 0);
+            events.clear();
+            for (uint64_t i = begin; i < written; ++i) {
+                const ProfileSlot& slot = thread->events[i % PROFILER_RING_CAPACITY];
+                uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+                ProfileEvent event{slot.name.load(std::memory_order_acquire), slot.start.load(std::memory_order_acquire),
+                                   slot.end.load(std::memory_order_acquire)};
+                // the owner wrapped over it meanwhile
+                if (sequence == i + 1 && slot.sequence.load(std::memory_order_relaxed) == i + 1)
+                    events.push_back(event);
+            }
+
+            for (const ProfileEvent& event : events) {
+                if (event.end < rangeStart || event.start > rangeEnd)
+                    continue;
+                out << ",\n{\"name\":\"";
+                writeEscaped(out, event.name);
+                out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->threadId
+                    << ",\"ts\":" << (int64_t)(event.start - rangeStart) * tickNanoseconds / 1000.0
+                    << ",\"dur\":" << (event.end - event.start) * tickNanoseconds / 1000.0 << "}";
+            }
+        }
+        out << "\n]}\n";
+        return out.good();
+    }
+
+    static constexpr bool isCompiledIn(){
+#ifdef CRUMBS_ENABLE_PROFILER
+        return true;
+#else
+        return false;
+#endif
+    }
+};
+
+// Records its lifetime as a zone of the calling thread, through CRUMBS_PROFILE_SCOPE
+class ProfileZone {
+private:
+    const char* name;
+    uint64_t start;
+
+public:
+    explicit ProfileZone(const char* name): name(name), start(Profiler::now()){}
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+    ~ProfileZone(){
+        Profiler::record(name, start, Profiler::now());
+    }
+};
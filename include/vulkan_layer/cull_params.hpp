@@ -0,0 +1,11 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// Push constants of cull.comp.glsl and meshlet_cull.comp.glsl
+struct CullParams
+{
+   glm::vec4 frustumPlanes[6]; // xyz normal pointing inside, w distance
+   glm::vec4 cameraPosition;   // world space, w unused
+   uint32_t objectCount;
+   uint32_t meshletDrawCount;
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <map>
+
+// Best fit range allocator over [0, capacity). Only does the offset bookkeeping, the memory
+// itself belongs to the caller. Free ranges are coalesced with their neighbours on release.
+class FreeListAllocator {
+public:
+    struct Range {
+        uint64_t begin = 0;  // start of the taken range, alignment padding included
+        uint64_t offset = 0; // aligned offset handed to the caller
+        uint64_t end = 0;
+    };
+
+private:
+    uint64_t capacity = 0;
+    uint64_t freeBytes = 0;
+    std::map<uint64_t, uint64_t> freeByOffset;      // begin -> end
+    std::multimap<uint64_t, uint64_t> freeBySize;   // size -> begin
+
+    void insertFree(uint64_t begin, uint64_t end){
+        if (begin == end)
+            return;
+        freeByOffset[begin] = end;
+        freeBySize.emplace(end - begin, begin);
+    }
+
+    void eraseFree(std::map<uint64_t, uint64_t>::iterator it){
+        auto sized = freeBySize.equal_range(it->second - it->first);
+        for (auto s = sized.first; s != sized.second; ++s) {
+            if (s->second == it->first) {
+                freeBySize.erase(s);
+                break;
+            }
+        }
+        freeByOffset.erase(it);
+    }
+
+public:
+    FreeListAllocator() = default;
+
+    explicit FreeListAllocator(uint64_t capacity): capacity(capacity), freeBytes(capacity){
+        insertFree(0, capacity);
+    }
+
+    uint64_t getCapacity() const{
+        return capacity;
+    }
+
+    uint64_t getFreeBytes() const{
+        return freeBytes;
+    }
+
+    size_t getFreeRangeCount() const{
+        return freeByOffset.size();
+    }
+
+    uint64_t getLargestFreeRange() const{
+        return freeBySize.empty() ? 0 : freeBySize.rbegin()->first;
+    }
+
+    // Smallest free range that still fits size once aligned. alignment must be a power of two.
+    bool allocate(uint64_t size, uint64_t alignment, Range& range){
+        if (alignment == 0)
+            alignment = 1;
+        for (auto it = freeBySize.lower_bound(size); it != freeBySize.end(); ++it) {
+            uint64_t begin = it->second;
+            uint64_t end = begin + it->first;
+            uint64_t offset = (begin + alignment - 1) & ~(alignment - 1);
+            if (offset + size > end)
+                continue;
+
+            eraseFree(freeByOffset.find(begin));
+            insertFree(offset + size, end);
+            range = {begin, offset, offset + size};
+            freeBytes -= range.end - range.begin;
+            return true;
+        }
+        return false;
+    }
+
+    void free(const Range& range){
+        uint64_t begin = range.begin;
+        uint64_t end = range.end;
+        freeBytes += end - begin;
+
+        auto next = freeByOffset.lower_bound(begin);
+        if (next != freeByOffset.end() && next->first == end) {
+            end = next->second;
+            auto after = std::next(next);
+            eraseFree(next);
+            next = after;
+        }
+        if (next != freeByOffset.begin()) {
+            auto previous = std::prev(next);
+            if (previous->second == begin) {
+                begin = previous->first;
+                eraseFree(previous);
+            }
+        }
+        insertFree(begin, end);
+    }
+
+    void reset(){
+        freeByOffset.clear();
+        freeBySize.clear();
+        freeBytes = capacity;
+        insertFree(0, capacity);
+    }
+};
@@ -1,8 +1,46 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
 
+// Offsets are relative to the buffers of the geometry pool page holding the mesh
 struct MeshDrawInfo{
     uint32_t vertexOffset;
     uint32_t indexOffset;
     uint32_t indexCount;
-};
\ No newline at end of file
+    uint32_t page;
+};
+
+// Bounding sphere of a mesh in model space, indexed like MeshDrawInfo. Same layout as a vec4 in the cull shader.
+struct MeshBounds{
+    glm::vec3 center;
+    float radius;
+};
+
+#define MESHLET_DRAW 0xFFFFFFFFu // indirect command slot of objects drawn per meshlet, skipped by the object cull pass
+
+// Meshlet as meshlet_cull.comp.glsl reads it
+struct MeshletBounds{
+    glm::vec4 sphere;    // model space center, radius
+    glm::vec4 cone;      // axis, cutoff
+    uint32_t firstIndex; // relative to the mesh indices
+    uint32_t indexCount;
+    uint32_t pad[2];
+};
+
+// Draw call culled and drawn per meshlet, same layout as in meshlet_cull.comp.glsl
+struct MeshletDraw{
+    uint32_t objectIndex;
+    uint32_t instanceSlot;
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+    uint32_t commandBase;
+    uint32_t indexOffset;
+    int32_t vertexOffset;
+    uint32_t pad;
+};
+
+// Level of detail picked by the draw calls of a frame
+struct LodStats{
+    uint64_t trianglesDrawn; // before culling
+    uint64_t trianglesSaved; // full mesh triangles minus drawn ones
+};
@@ -1,6 +1,42 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>  
+#include <array>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <cstddef>
+
+// Layout of the vertices in the GPU vertex buffer, picked once for the whole renderer
+enum class VertexFormat {
+    Float,        // Vertex as is, 36 bytes
+    Compact,      // CompactVertex, 12 bytes, white
+    CompactColor  // CompactColorVertex, 16 bytes
+};
+
+// Positions quantized to 16 bits over the bounding box of their mesh, octahedral normal
+struct CompactVertex {
+    uint16_t pos[4]; // w unused, 3 component 16 bit formats aren't required for vertex buffers
+    int16_t normal[2];
+};
+
+struct CompactColorVertex {
+    uint16_t pos[4];
+    int16_t normal[2];
+    uint8_t color[4];
+};
+static_assert(sizeof(CompactVertex) == 12 && sizeof(CompactColorVertex) == 16 &&
+              offsetof(CompactColorVertex, normal) == offsetof(CompactVertex, normal),
+              "CompactVertex must be a prefix of CompactColorVertex");
+
+// Undoes the position quantization of a mesh : pos = offset + quantized * scale, quantized in [0, 1].
+// vec4s to match the std430 layout of the vertex shader.
+struct MeshQuantization {
+    glm::vec4 offset;
+    glm::vec4 scale;
+};
+
 struct Vertex {
     const glm::vec3 pos; 
     const glm::vec3 color; 
@@ -37,4 +73,100 @@ struct Vertex {
 
         return attribs;
     }
+
+    static uint32_t getStride(VertexFormat format){
+        switch (format) {
+            case VertexFormat::Compact:      return sizeof(CompactVertex);
+            case VertexFormat::CompactColor: return sizeof(CompactColorVertex);
+            default:                         return sizeof(Vertex);
+        }
+    }
+
+    static VkVertexInputBindingDescription getBindingDescription(VertexFormat format) {
+        VkVertexInputBindingDescription binding = getBindingDescription();
+        binding.stride = getStride(format);
+        return binding;
+    }
+
+    // Same locations as the float layout, the compact vertex shaders decode them
+    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(VertexFormat format) {
+        if (format == VertexFormat::Float) {
+            auto attribs = getAttributeDescriptions();
+            return {attribs.begin(), attribs.end()};
+        }
+        std::vector<VkVertexInputAttributeDescription> attribs(2);
+
+        // Position, normalized to the mesh bounds
+        attribs[0].binding  = 0;
+        attribs[0].location = 0;
+        attribs[0].format   = VK_FORMAT_R16G16B16A16_UNORM;
+        attribs[0].offset   = offsetof(CompactVertex, pos);
+
+        // Normal, octahedral
+        attribs[1].binding  = 0;
+        attribs[1].location = 2;
+        attribs[1].format   = VK_FORMAT_R16G16_SNORM;
+        attribs[1].offset   = offsetof(CompactVertex, normal);
+
+        if (format == VertexFormat::CompactColor) {
+            VkVertexInputAttributeDescription color{};
+            color.binding  = 0;
+            color.location = 1;
+            color.format   = VK_FORMAT_R8G8B8A8_UNORM;
+            color.offset   = offsetof(CompactColorVertex, color);
+            attribs.push_back(color);
+        }
+        return attribs;
+    }
+
+    // Identity for the float layout, else the bounding box of the vertices
+    static MeshQuantization computeQuantization(const Vertex* vertices, uint32_t count, VertexFormat format){
+        if (format == VertexFormat::Float || count == 0)
+            return {glm::vec4(0.0f), glm::vec4(1.0f)};
+        glm::vec3 minPos = vertices[0].pos, maxPos = vertices[0].pos;
+        for (uint32_t v = 1; v < count; ++v) {
+            minPos = glm::min(minPos, vertices[v].pos);
+            maxPos = glm::max(maxPos, vertices[v].pos);
+        }
+        // flat meshes still get a non zero scale so decoding stays finite
+        glm::vec3 extent = glm::max(maxPos - minPos, glm::vec3(1e-6f));
+        return {glm::vec4(minPos, 0.0f), glm::vec4(extent, 0.0f)};
+    }
+
+    // Writes count vertices in format to out, getStride(format) bytes each
+    static void encode(const Vertex* vertices, uint32_t count, VertexFormat format, const MeshQuantization& quantization, uint8_t* out){
+        if (format == VertexFormat::Float) {
+            std::copy(reinterpret_cast<const uint8_t*>(vertices), reinterpret_cast<const uint8_t*>(vertices + count), out);
+            return;
+        }
+        uint32_t stride = getStride(format);
+        for (uint32_t v = 0; v < count; ++v) {
+            CompactColorVertex packed{}; // CompactVertex is its prefix
+            for (int c = 0; c < 3; ++c) {
+                float unit = (vertices[v].pos[c] - quantization.offset[c]) / quantization.scale[c];
+                packed.pos[c] = (uint16_t)std::lround(std::min(std::max(unit, 0.0f), 1.0f) * 65535.0f);
+            }
+            glm::vec2 octahedral = encodeOctahedral(vertices[v].normal);
+            packed.normal[0] = (int16_t)std::lround(octahedral.x * 32767.0f);
+            packed.normal[1] = (int16_t)std::lround(octahedral.y * 32767.0f);
+            for (int c = 0; c < 3; ++c) {
+                packed.color[c] = (uint8_t)std::lround(std::min(std::max(vertices[v].color[c], 0.0f), 1.0f) * 255.0f);
+            }
+            packed.color[3] = 255;
+            std::copy(reinterpret_cast<const uint8_t*>(&packed), reinterpret_cast<const uint8_t*>(&packed) + stride, out + (size_t)v * stride);
+        }
+    }
+
+    // Unit vector folded onto the octahedron then flattened to [-1, 1]^2
+    static glm::vec2 encodeOctahedral(const glm::vec3& n){
+        float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        if (l1 == 0.0f)
+            return glm::vec2(0.0f);
+        glm::vec2 p(n.x / l1, n.y / l1);
+        if (n.z < 0.0f) {
+            p = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                          (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+        }
+        return p;
+    }
 };
@@ -0,0 +1,432 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include "vulkan_device.hpp"
+#include "free_list_allocator.hpp"
+#include "debug.hpp"
+
+#define ALLOCATOR_BLOCK_SIZE (64ull * 1024 * 1024)
+
+// Buffers and optimal tiling images never share a block so bufferImageGranularity can be ignored
+enum class VulkanResourceKind {
+    Buffer,
+    Image
+};
+
+// FreeList blocks reuse freed ranges. Linear blocks only bump an offset and are reset once every
+// allocation in them is freed, for resources that are released all together.
+enum class VulkanAllocationStrategy {
+    FreeList,
+    Linear
+};
+
+struct VulkanAllocation {
+    VkDeviceMemory memory{ VK_NULL_HANDLE };
+    VkDeviceSize offset = 0;      // offset of the resource in memory
+    VkDeviceSize size = 0;
+    VkDeviceSize alignment = 0;
+    void* mapped = nullptr;       // host pointer to offset, null when not host visible
+    uint32_t memoryType = 0;
+    bool coherent = true;
+
+    // bookkeeping for the allocator
+    int32_t pool = -1;            // -1 for dedicated allocations
+    uint32_t block = 0;
+    FreeListAllocator::Range range;
+
+    bool isValid() const{
+        return memory != VK_NULL_HANDLE;
+    }
+};
+
+struct VulkanAllocatorStats {
+    uint32_t blockCount = 0;
+    uint32_t dedicatedAllocationCount = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize bytesAllocated = 0; // device memory held, blocks and dedicated allocations
+    VkDeviceSize bytesUsed = 0;      // bytes handed out to resources
+    VkDeviceSize bytesWasted = 0;    // alignment padding, and dead space in linear blocks
+    VkDeviceSize bytesFree = 0;      // reusable space left in the blocks
+};
+
+// Engine level GPU memory allocator. Memory is taken from the driver in large blocks, one list
+// per (memory type, resource kind, strategy), and resources are sub-allocated inside them.
+// Host visible blocks are mapped once for their whole lifetime. Requests larger than half a block
+// get a dedicated vkAllocateMemory.
+class VulkanAllocator {
+public:
+    // Called by defragment for every allocation it wants to relocate. Memory of a buffer or image
+    // can't be rebound, so the callee creates a new resource bound to the new location, copies the
+    // content over and replaces its handles (VulkanBuffer::relocate does all of it for host visible
+    // buffers), or returns false to keep it in place. It doesn't free from, defragment does.
+    using MoveCallback = std::function<bool(const VulkanAllocation& from, const VulkanAllocation& to)>;
+
+private:
+    struct LiveRange {
+        VkDeviceSize offset;
+        VkDeviceSize end;
+        VkDeviceSize alignment;
+    };
+
+    struct Block {
+        VkDeviceMemory memory{ VK_NULL_HANDLE };
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+        FreeListAllocator freeList;
+        VkDeviceSize linearOffset = 0;
+        uint32_t allocationCount = 0;
+        VkDeviceSize bytesUsed = 0;
+        VkDeviceSize bytesWasted = 0;
+        std::map<VkDeviceSize, LiveRange> liveRanges; // range begin -> allocation, used by defragment
+    };
+
+    struct Pool {
+        uint32_t memoryType;
+        VulkanResourceKind kind;
+        VulkanAllocationStrategy strategy;
+        std::vector<Block> blocks;
+    };
+
+    VulkanDevice& device;
+    std::vector<Pool> pools;
+    std::mutex mutex;
+    uint32_t dedicatedCount = 0;
+    VkDeviceSize dedicatedBytes = 0;
+    uint32_t liveAllocations = 0;
+
+    bool isHostVisible(uint32_t memoryType) const{
+        return device.getMemoryProperties().memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    }
+
+    bool isCoherent(uint32_t memoryType) const{
+        return device.getMemoryProperties().memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+
+    VkDeviceSize blockSizeFor(uint32_t memoryType) const{
+        const auto& memProperties = device.getMemoryProperties();
+        VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryType].heapIndex].size;
+        return std::min<VkDeviceSize>(ALLOCATOR_BLOCK_SIZE, heapSize / 8); // small heaps get smaller blocks
+    }
+
+    VkDeviceMemory allocateMemory(uint32_t memoryType, VkDeviceSize size, void** mapped){
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(device.getDevice(), &allocInfo, nullptr, &memory) != VK_SUCCESS)
+            throw std::runtime_error("Failed to allocate device memory!");
+
+        *mapped = nullptr;
+        if (isHostVisible(memoryType) && vkMapMemory(device.getDevice(), memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            vkFreeMemory(device.getDevice(), memory, nullptr);
+            throw std::runtime_error("Failed to map device memory!");
+        }
+        return memory;
+    }
+
+    void freeMemory(VkDeviceMemory memory, void* mapped){
+        if (mapped != nullptr)
+            vkUnmapMemory(device.getDevice(), memory);
+        vkFreeMemory(device.getDevice(), memory, nullptr);
+    }
+
+    uint32_t findPool(uint32_t memoryType, VulkanResourceKind kind, VulkanAllocationStrategy strategy){
+        for (uint32_t i = 0; i < pools.size(); ++i) {
+            if (pools[i].memoryType == memoryType && pools[i].kind == kind && pools[i].strategy == strategy)
+                return i;
+        }
+        pools.push_back({memoryType, kind, strategy, {}});
+        return pools.size() - 1;
+    }
+
+    bool allocateFromBlock(Pool& pool, Block& block, VkDeviceSize size, VkDeviceSize alignment, FreeListAllocator::Range& range){
+        if (pool.strategy == VulkanAllocationStrategy::Linear) {
+            VkDeviceSize offset = (block.linearOffset + alignment - 1) & ~(alignment - 1);
+            if (offset + size > block.size)
+                return false;
+            range = {block.linearOffset, offset, offset + size};
+            block.linearOffset = offset + size;
+            return true;
+        }
+        return block.freeList.allocate(size, alignment, range);
+    }
+
+    void releaseFromBlock(Pool& pool, Block& block, const FreeListAllocator::Range& range){
+        block.allocationCount--;
+        block.bytesUsed -= range.end - range.offset;
+        block.bytesWasted -= range.offset - range.begin;
+        block.liveRanges.erase(range.begin);
+        if (pool.strategy == VulkanAllocationStrategy::Linear) {
+            if (block.allocationCount == 0)
+                block.linearOffset = 0;
+        } else {
+            block.freeList.free(range);
+        }
+    }
+
+    // Expects the lock to be held. skipBlock is never allocated from
+    bool tryAllocate(uint32_t poolIndex, VkDeviceSize size, VkDeviceSize alignment, VulkanAllocation& allocation,
+                     bool allowNewBlock, int32_t skipBlock = -1){
+        Pool& pool = pools[poolIndex];
+        FreeListAllocator::Range range;
+        for (uint32_t b = 0; b <= pool.blocks.size(); ++b) {
+            if ((int32_t)b == skipBlock)
+                continue;
+            if (b == pool.blocks.size()) {
+                if (!allowNewBlock)
+                    return false;
+                Block block;
+                block.size = blockSizeFor(pool.memoryType);
+                block.memory = allocateMemory(pool.memoryType, block.size, &block.mapped);
+                block.freeList = FreeListAllocator(block.size);
+                pool.blocks.push_back(block);
+                Debug::Log("Allocator : new " + std::to_string(block.size >> 20) + "MB block for memory type " + std::to_string(pool.memoryType));
+            }
+            Block& block = pool.blocks[b];
+            if (!allocateFromBlock(pool, block, size, alignment, range))
+                continue;
+
+            block.allocationCount++;
+            block.bytesUsed += range.end - range.offset;
+            block.bytesWasted += range.offset - range.begin;
+            block.liveRanges[range.begin] = {range.offset, range.end, alignment};
+
+            allocation.memory = block.memory;
+            allocation.offset = range.offset;
+            allocation.size = size;
+            allocation.alignment = alignment;
+            allocation.mapped = block.mapped ? static_cast<uint8_t*>(block.mapped) + range.offset : nullptr;
+            allocation.memoryType = pool.memoryType;
+            allocation.coherent = isCoherent(pool.memoryType);
+            allocation.pool = poolIndex;
+            allocation.block = b;
+            allocation.range = range;
+            liveAllocations++;
+            return true;
+        }
+        return false;
+    }
+
+    // Live allocations of a block
+    std::vector<VulkanAllocation> collectLive(uint32_t poolIndex, uint32_t blockIndex){
+        Pool& pool = pools[poolIndex];
+        Block& block = pool.blocks[blockIndex];
+        std::vector<VulkanAllocation> result;
+        for (const auto& taken : block.liveRanges) {
+            VulkanAllocation allocation;
+            allocation.memory = block.memory;
+            allocation.offset = taken.second.offset;
+            allocation.size = taken.second.end - taken.second.offset;
+            allocation.alignment = taken.second.alignment;
+            allocation.mapped = block.mapped ? static_cast<uint8_t*>(block.mapped) + allocation.offset : nullptr;
+            allocation.memoryType = pool.memoryType;
+            allocation.coherent = isCoherent(pool.memoryType);
+            allocation.pool = poolIndex;
+            allocation.block = blockIndex;
+            allocation.range = {taken.first, taken.second.offset, taken.second.end};
+            result.push_back(allocation);
+        }
+        return result;
+    }
+
+    // Non coherent ranges must be aligned to nonCoherentAtomSize
+    VkMappedMemoryRange atomAlignedRange(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const{
+        VkDeviceSize atom = device.getProperties().limits.nonCoherentAtomSize;
+        VkDeviceSize begin = allocation.offset + offset;
+        VkDeviceSize end = allocation.offset + (size == VK_WHOLE_SIZE ? allocation.size : offset + size);
+        VkMappedMemoryRange range{};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = allocation.memory;
+        range.offset = begin - begin % atom;
+        end = (end + atom - 1) / atom * atom;
+        // a dedicated allocation may not be a multiple of the atom, its tail is flushed with VK_WHOLE_SIZE
+        range.size = allocation.pool < 0 && end >= allocation.size ? VK_WHOLE_SIZE : end - range.offset;
+        return range;
+    }
+
+public:
+    VulkanAllocator(VulkanDevice& device): device(device){}
+
+    ~VulkanAllocator(){
+        destroy();
+    }
+
+    void destroy(){
+        std::lock_guard<std::mutex> lock(mutex);
+        if (liveAllocations > 0)
+            Debug::LogWarning("Allocator destroyed with " + std::to_string(liveAllocations) + " live allocations !");
+        for (auto& pool : pools) {
+            for (auto& block : pool.blocks) {
+                freeMemory(block.memory, block.mapped);
+            }
+        }
+        pools.clear();
+    }
+
+    VulkanDevice& getDevice(){
+        return device;
+    }
+
+    // Allocation from an explicit memory type, for callers with their own type fallbacks
+    VulkanAllocation allocateFromType(const VkMemoryRequirements& requirements, uint32_t memoryType, VulkanResourceKind kind,
+                              VulkanAllocationStrategy strategy = VulkanAllocationStrategy::FreeList){
+        VkDeviceSize alignment = requirements.alignment;
+        if (isHostVisible(memoryType) && !isCoherent(memoryType)) {
+            // keep neighbours out of each other's flush/invalidate atoms
+            alignment = std::max(alignment, device.getProperties().limits.nonCoherentAtomSize);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        VulkanAllocation allocation;
+        if (requirements.size > blockSizeFor(memoryType) / 2) {
+            allocation.memory = allocateMemory(memoryType, requirements.size, &allocation.mapped);
+            allocation.size = requirements.size;
+            allocation.alignment = alignment;
+            allocation.memoryType = memoryType;
+            allocation.coherent = isCoherent(memoryType);
+            dedicatedCount++;
+            dedicatedBytes += requirements.size;
+            liveAllocations++;
+            return allocation;
+        }
+
+        uint32_t pool = findPool(memoryType, kind, strategy);
+        if (!tryAllocate(pool, requirements.size, alignment, allocation, true))
+            throw std::runtime_error("Failed to sub-allocate device memory!");
+        return allocation;
+    }
+
+    VulkanAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, VulkanResourceKind kind,
+                              VulkanAllocationStrategy strategy = VulkanAllocationStrategy::FreeList){
+        return allocateFromType(requirements, device.findMemoryType(requirements.memoryTypeBits, properties), kind, strategy);
+    }
+
+    void free(VulkanAllocation& allocation){
+        if (!allocation.isValid())
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        liveAllocations--;
+        if (allocation.pool < 0) {
+            freeMemory(allocation.memory, allocation.mapped);
+            dedicatedCount--;
+            dedicatedBytes -= allocation.size;
+        } else {
+            Pool& pool = pools[allocation.pool];
+            releaseFromBlock(pool, pool.blocks[allocation.block], allocation.range);
+        }
+        allocation = VulkanAllocation{};
+    }
+
+    // Returns the memory of every empty block to the driver, keeping the first block of each pool
+    uint32_t releaseEmptyBlocks(){
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t released = 0;
+        for (auto& pool : pools) {
+            // only trailing blocks can go, allocations refer to their block by index
+            while (pool.blocks.size() > 1 && pool.blocks.back().allocationCount == 0) {
+                freeMemory(pool.blocks.back().memory, pool.blocks.back().mapped);
+                pool.blocks.pop_back();
+                released++;
+            }
+        }
+        return released;
+    }
+
+    // Defragmentation hook : tries to empty the last block of every free list pool by moving its
+    // allocations into the other blocks. The destinations are reserved under the lock, then move is
+    // called once per relocation without it, so the callee may allocate and free. When it accepts,
+    // the caller's handle must be replaced by the new allocation (also reported in moves) and the old
+    // range is freed. The allocations of those blocks must not be freed by anyone else meanwhile.
+    // Emptied blocks are released. Returns the bytes moved.
+    VkDeviceSize defragment(const MoveCallback& move, std::vector<std::pair<VulkanAllocation, VulkanAllocation>>* moves = nullptr){
+        std::vector<std::pair<VulkanAllocation, VulkanAllocation>> candidates;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint32_t p = 0; p < pools.size(); ++p) {
+                Pool& pool = pools[p];
+                if (pool.strategy != VulkanAllocationStrategy::FreeList || pool.blocks.size() < 2)
+                    continue;
+                uint32_t last = pool.blocks.size() - 1;
+                for (auto& live : collectLive(p, last)) {
+                    VulkanAllocation to;
+                    if (!tryAllocate(p, live.size, live.alignment, to, false, last))
+                        break; // the other blocks are full
+                    candidates.push_back({live, to});
+                }
+            }
+        }
+
+        VkDeviceSize movedBytes = 0;
+        for (auto& candidate : candidates) {
+            const VulkanAllocation& from = candidate.first;
+            const VulkanAllocation& to = candidate.second;
+            bool moved = move(from, to);
+            std::lock_guard<std::mutex> lock(mutex);
+            const VulkanAllocation& released = moved ? from : to;
+            Pool& pool = pools[released.pool];
+            liveAllocations--;
+            releaseFromBlock(pool, pool.blocks[released.block], released.range);
+            if (moved) {
+                movedBytes += from.size;
+                if (moves)
+                    moves->push_back(candidate);
+            }
+        }
+        releaseEmptyBlocks();
+        return movedBytes;
+    }
+
+    void flush(const VulkanAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE){
+        if (allocation.coherent || allocation.mapped == nullptr)
+            return;
+        VkMappedMemoryRange range = atomAlignedRange(allocation, offset, size);
+        vkFlushMappedMemoryRanges(device.getDevice(), 1, &range);
+    }
+
+    void invalidate(const VulkanAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE){
+        if (allocation.coherent || allocation.mapped == nullptr)
+            return;
+        VkMappedMemoryRange range = atomAlignedRange(allocation, offset, size);
+        vkInvalidateMappedMemoryRanges(device.getDevice(), 1, &range);
+    }
+
+    VulkanAllocatorStats getStats(){
+        std::lock_guard<std::mutex> lock(mutex);
+        VulkanAllocatorStats stats;
+        stats.dedicatedAllocationCount = dedicatedCount;
+        stats.allocationCount = liveAllocations;
+        stats.bytesAllocated = dedicatedBytes;
+        stats.bytesUsed = dedicatedBytes;
+        for (const auto& pool : pools) {
+            for (const auto& block : pool.blocks) {
+                stats.blockCount++;
+                stats.bytesAllocated += block.size;
+                stats.bytesUsed += block.bytesUsed;
+                stats.bytesWasted += block.bytesWasted;
+                if (pool.strategy == VulkanAllocationStrategy::Linear) {
+                    // freed space in a linear block is dead until the block empties
+                    stats.bytesWasted += block.linearOffset - block.bytesUsed - block.bytesWasted;
+                    stats.bytesFree += block.size - block.linearOffset;
+                } else {
+                    stats.bytesFree += block.freeList.getFreeBytes();
+                }
+            }
+        }
+        return stats;
+    }
+
+    void logStats(){
+        VulkanAllocatorStats stats = getStats();
+        Debug::Log("Allocator : " + std::to_string(stats.allocationCount) + " allocations in " +
+                   std::to_string(stats.blockCount) + " blocks + " + std::to_string(stats.dedicatedAllocationCount) + " dedicated, " +
+                   std::to_string(stats.bytesUsed >> 10) + "KB used / " + std::to_string(stats.bytesAllocated >> 10) + "KB allocated, " +
+                   std::to_string(stats.bytesWasted >> 10) + "KB wasted, " + std::to_string(stats.bytesFree >> 10) + "KB free");
+    }
+};
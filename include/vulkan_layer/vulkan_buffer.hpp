@@ -5,11 +5,26 @@
 #include <stdexcept>
 #include "vertex.hpp"
 #include "vulkan_device.hpp"
+#include "vulkan_allocator.hpp"
+#include "profiler.hpp"
 
 enum class VulkanBufferType {
     Vertex,
     Index,
-    Uniform
+    Uniform,
+    Readback,
+    Staging,
+    Storage,
+    Indirect
+};
+
+// Where the buffer memory lives. Host visible buffers stay mapped for their whole lifetime.
+// HostCached is faster for CPU reads but may be non coherent, writes then need flush() and reads
+// invalidate(). DeviceLocal buffers are not host visible and are filled through a VulkanStagingRing
+enum class VulkanMemoryPlacement {
+    HostVisible,
+    HostCached,
+    DeviceLocal
 };
 
 class VulkanBuffer {
@@ -17,10 +32,44 @@ class VulkanBuffer {
 private:
     
     VkBuffer buffer{ VK_NULL_HANDLE };
-    VkDeviceMemory memory{ VK_NULL_HANDLE };
+    VulkanAllocation allocation;
     VkDeviceSize size; 
     VkDeviceSize alignedObjectSize;
     bool dynamic;
+    VulkanMemoryPlacement placement;
+    VkBufferUsageFlags usage = 0;
+    std::string name;
+
+    uint32_t chooseMemoryType(uint32_t typeFilter){
+        switch (placement) {
+            case VulkanMemoryPlacement::DeviceLocal:
+                return device.findMemoryType(typeFilter, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            case VulkanMemoryPlacement::HostCached:
+                try {
+                    return device.findMemoryType(typeFilter, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+                } catch (const std::runtime_error&) {
+                    break; // no cached type on this device, fall back to coherent memory
+                }
+            case VulkanMemoryPlacement::HostVisible:
+                break;
+        }
+        return device.findMemoryType(typeFilter, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+
+    VkBuffer createBuffer(){
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VkBuffer created;
+        if (vkCreateBuffer(device.getDevice(), &bufferInfo, nullptr, &created) != VK_SUCCESS)
+            throw std::runtime_error("Failed to create buffer!");
+        device.nameObject((uint64_t)created, VK_OBJECT_TYPE_BUFFER, name);
+        return created;
+    }
+
 public:
     
     const VkBuffer& getBuffer() const{
@@ -34,50 +83,84 @@ public:
     const VkDeviceSize getAlignedObjectSize() const{
         return alignedObjectSize;
     }
+
+    VulkanBufferType getType() const{
+        return type;
+    }
+
+    VulkanMemoryPlacement getPlacement() const{
+        return placement;
+    }
+
+    bool isCoherent() const{
+        return allocation.coherent;
+    }
+
+    const VulkanAllocation& getAllocation() const{
+        return allocation;
+    }
+
+    // Persistent mapping of the whole buffer, null for device local buffers
+    void* getMapped() const{
+        return allocation.mapped;
+    }
+
+    // Typed pointer into the mapping, writes through it need a flush() on non coherent memory
+    template<typename T>
+    T* data(VkDeviceSize offset = 0) const{
+        return reinterpret_cast<T*>(static_cast<uint8_t*>(allocation.mapped) + offset);
+    }
+
+    template<typename T>
+    void write(const T& value, VkDeviceSize offset){
+        std::memcpy(static_cast<uint8_t*>(allocation.mapped) + offset, &value, sizeof(T));
+    }
     
-    VulkanBuffer(VulkanDevice& deviceRef, VulkanBufferType type, VkDeviceSize size, const void* data = nullptr, bool dynamic = false, VkDeviceSize alignedObjectSize = 0, std::string name = "Buffer")
-        : device(deviceRef), type(type), size(size), dynamic(dynamic), alignedObjectSize(alignedObjectSize)
+    VulkanBuffer(VulkanAllocator& allocator, VulkanBufferType type, VkDeviceSize size, const void* data = nullptr, bool dynamic = false, VkDeviceSize alignedObjectSize = 0, std::string name = "Buffer",
+                 VulkanMemoryPlacement placement = VulkanMemoryPlacement::HostVisible,
+                 VulkanAllocationStrategy strategy = VulkanAllocationStrategy::FreeList)
+        : device(allocator.getDevice()), allocator(allocator), type(type), size(size), dynamic(dynamic), alignedObjectSize(alignedObjectSize), placement(placement),
+          name(std::move(name))
     {
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = size;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
         switch (type) {
             case VulkanBufferType::Vertex:
-                bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+                usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
                 break;
             case VulkanBufferType::Index:
-                bufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+                usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
                 break;
             case VulkanBufferType::Uniform:
-                bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+                usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+                break;
+            case VulkanBufferType::Readback:
+                usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+                break;
+            case VulkanBufferType::Staging:
+                usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+                break;
+            case VulkanBufferType::Storage:
+                usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+                break;
+            case VulkanBufferType::Indirect:
+                usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT; // compute can fill it
                 break;
         }
+        if (placement == VulkanMemoryPlacement::DeviceLocal)
+            usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT; // filled by staging copies
 
-        if (vkCreateBuffer(device.getDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
-            throw std::runtime_error("Failed to create buffer!");
-
-        deviceRef.nameObject((uint64_t)buffer, VK_OBJECT_TYPE_BUFFER, name);
+        buffer = createBuffer();
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device.getDevice(), buffer, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = device.findMemoryType(
-            memRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-
-        if (vkAllocateMemory(device.getDevice(), &allocInfo, nullptr, &memory) != VK_SUCCESS)
-            throw std::runtime_error("Failed to allocate buffer memory!");
-
-        vkBindBufferMemory(device.getDevice(), buffer, memory, 0);
+        allocation = allocator.allocateFromType(memRequirements, chooseMemoryType(memRequirements.memoryTypeBits), VulkanResourceKind::Buffer, strategy);
+        vkBindBufferMemory(device.getDevice(), buffer, allocation.memory, allocation.offset);
 
         
-        if (data) 
+        if (data) {
+            if (placement == VulkanMemoryPlacement::DeviceLocal)
+                throw std::runtime_error("Device local buffers must be filled through a staging upload!");
             update(data, size, 0);
+        }
     }
 
     ~VulkanBuffer() {
@@ -87,22 +170,56 @@ public:
     void destroy() {
         if (buffer != VK_NULL_HANDLE)
             vkDestroyBuffer(device.getDevice(), buffer, nullptr);
-        if (memory != VK_NULL_HANDLE)
-            vkFreeMemory(device.getDevice(), memory, nullptr);
         buffer = VK_NULL_HANDLE;
-        memory = VK_NULL_HANDLE;
+        allocator.free(allocation);
+    }
+
+    // Moves the buffer to, for a VulkanAllocator::defragment callback : a new VkBuffer is bound to
+    // to, the content copied and the old buffer destroyed, getBuffer() changes. False if from isn't
+    // this buffer's allocation, or for device local buffers whose content needs a GPU copy. The GPU
+    // must be done with the old buffer and descriptors using it have to be rewritten.
+    bool relocate(const VulkanAllocation& from, const VulkanAllocation& to) {
+        if (allocation.memory != from.memory || allocation.offset != from.offset || placement == VulkanMemoryPlacement::DeviceLocal)
+            return false;
+        VkBuffer moved = createBuffer();
+        vkBindBufferMemory(device.getDevice(), moved, to.memory, to.offset);
+        allocator.invalidate(allocation);
+        std::memcpy(to.mapped, allocation.mapped, static_cast<size_t>(size));
+        allocator.flush(to);
+
+        vkDestroyBuffer(device.getDevice(), buffer, nullptr);
+        buffer = moved;
+        allocation = to; // the old range is freed by defragment
+        return true;
     }
 
     void update(const void* data, VkDeviceSize size, VkDeviceSize offset) {
-        void* mapped;
-        vkMapMemory(device.getDevice(), memory, offset, size, 0, &mapped);
-        std::memcpy(mapped, data, static_cast<size_t>(size));
-        vkUnmapMemory(device.getDevice(), memory);
+        CRUMBS_PROFILE_SCOPE("VulkanBuffer::update");
+        if (placement == VulkanMemoryPlacement::DeviceLocal)
+            throw std::runtime_error("Device local buffers can't be mapped, use a staging upload!");
+        std::memcpy(static_cast<uint8_t*>(allocation.mapped) + offset, data, static_cast<size_t>(size));
+        flush(offset, size);
+    }
+
+    // Makes host writes in the range visible to the device, no-op on coherent memory
+    void flush(VkDeviceSize offset = 0, VkDeviceSize rangeSize = VK_WHOLE_SIZE) {
+        allocator.flush(allocation, offset, rangeSize);
+    }
+
+    // Makes device writes in the range visible to the host, no-op on coherent memory
+    void invalidate(VkDeviceSize offset = 0, VkDeviceSize rangeSize = VK_WHOLE_SIZE) {
+        allocator.invalidate(allocation, offset, rangeSize);
     }
     const VkDeviceSize getSize() const{
             return size;
     }
+
+    void read(void* data, VkDeviceSize size, VkDeviceSize offset) {
+        invalidate(offset, size);
+        std::memcpy(data, static_cast<const uint8_t*>(allocation.mapped) + offset, static_cast<size_t>(size));
+    }
 private:
     VulkanDevice& device;
+    VulkanAllocator& allocator;
     VulkanBufferType type;
 };
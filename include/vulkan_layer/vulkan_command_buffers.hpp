@@ -1,6 +1,7 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include "vulkan_device.hpp"
 #include "vulkan_swapchain.hpp"
@@ -9,7 +10,22 @@
 #include "vulkan_framebuffers.hpp"
 #include "vulkan_descriptor.hpp"
 #include "vulkan_pipeline.hpp"
+#include "vulkan_compute_pipeline.hpp"
+#include "vulkan_frame_context.hpp"
+#include "vulkan_secondary_recorder.hpp"
+#include "vulkan_gpu_profiler.hpp"
+#include "vulkan_geometry_pool.hpp"
 #include "mesh_draw_info.hpp"
+#include "cull_params.hpp"
+
+// How record2 issues the frame draws, from the cheapest to record to the most portable. The first
+// three read VkDrawIndexedIndirectCommand records from the indirect buffer, Direct replays them on the CPU.
+enum class VulkanDrawPath {
+    IndirectCount,      // one call, draw count read by the GPU
+    MultiDrawIndirect,  // one call, draw count from the CPU
+    Indirect,           // one indirect call per draw, no multiDrawIndirect
+    Direct              // no drawIndirectFirstInstance, plain vkCmdDrawIndexed
+};
 
 class VulkanCommandBuffers {
 private: 
@@ -17,10 +33,10 @@ private:
 public:
     std::vector<VkCommandBuffer> commandBuffers;
 
-    VulkanCommandBuffers(VulkanDevice& device,
-                         VulkanFramebuffers& framebuffers): pDevice(device)
+    // one command buffer per frame in flight, recorded again every time its frame comes around
+    VulkanCommandBuffers(VulkanDevice& device, uint32_t count): pDevice(device)
     {
-        commandBuffers.resize(framebuffers.getFramebuffers().size());
+        commandBuffers.resize(count);
 
         VkCommandBufferAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -121,29 +137,193 @@ public:
         }
     }
 
+    // Binds the pipeline, the viewport and scissor covering extent and the descriptor sets the frame
+    // draws read, the geometry is bound per page. Secondary buffers inherit none of it and need their
+    // own calls.
+    static void bindDrawState(VkCommandBuffer commandBuffer,
+                              VulkanPipeline& graphicsPipeline,
+                              const VulkanFrameContext& frame,
+                              VkExtent2D extent)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline.getPipeline());
+
+        VkViewport viewport{};
+        viewport.width  = (float) extent.width;
+        viewport.height = (float) extent.height;
+        viewport.minDepth = 0.0f; viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        VkRect2D scissor{{0, 0}, extent};
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        vkCmdBindDescriptorSets(
+            commandBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            graphicsPipeline.getLayout(),
+            0,                       
+            1,                        // number of descriptor sets
+            &frame.sceneSet,
+            0,                        // dynamic offset count (0 for static UBO)
+            nullptr                   // dynamic offsets
+        );
+
+        // per object data is fetched in the shader through the instance indices, bound once
+        vkCmdBindDescriptorSets(
+            commandBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            graphicsPipeline.getLayout(),
+            1, 1, &frame.objectsSet,
+            0, nullptr
+        );
+    }
+
+    // Issues draws [first, first + count). The indirect paths read the commands at commandsOffset of
+    // indirectBuffer, Direct replays the host copy in commands. IndirectCount ignores first.
+    static void recordDraws(VulkanDevice& device,
+                            VkCommandBuffer commandBuffer,
+                            VulkanBuffer& indirectBuffer,
+                            VulkanDrawPath drawPath,
+                            VkDeviceSize countOffset,
+                            VkDeviceSize commandsOffset,
+                            const VkDrawIndexedIndirectCommand* commands,
+                            uint32_t first,
+                            uint32_t count,
+                            uint32_t maxDrawCount)
+    {
+        const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+        switch (drawPath) {
+            case VulkanDrawPath::IndirectCount:
+                device.cmdDrawIndexedIndirectCount(commandBuffer, indirectBuffer.getBuffer(), commandsOffset,
+                                                   indirectBuffer.getBuffer(), countOffset, maxDrawCount, stride);
+                break;
+            case VulkanDrawPath::MultiDrawIndirect:
+                if (count > 0)
+                    vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer.getBuffer(), commandsOffset + first * stride, count, stride);
+                break;
+            case VulkanDrawPath::Indirect:
+                for (uint32_t d = first; d < first + count; ++d) {
+                    vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer.getBuffer(), commandsOffset + d * stride, 1, stride);
+                }
+                break;
+            case VulkanDrawPath::Direct:
+                for (uint32_t d = first; d < first + count; ++d) {
+                    vkCmdDrawIndexed(commandBuffer, commands[d].indexCount, commands[d].instanceCount,
+                                     commands[d].firstIndex, commands[d].vertexOffset, commands[d].firstInstance);
+                }
+                break;
+        }
+    }
+
+    static void bindGeometry(VkCommandBuffer commandBuffer, VulkanBuffer& vertexBuffer, VulkanBuffer& indexBuffer){
+        VkBuffer vertexBuffers[] = { vertexBuffer.getBuffer() };
+        VkDeviceSize offsets[] = { 0 };
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+        
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer.getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+    }
+
+    // recordDraws over the part of every range within [first, first + count), binding the geometry page
+    // of each. IndirectCount draws everything in one call so it only applies to a single range, with
+    // several pages it falls back to one call per range or per draw.
+    static void recordDrawRanges(VulkanDevice& device,
+                                 VkCommandBuffer commandBuffer,
+                                 VulkanGeometryPool& geometry,
+                                 const std::vector<GeometryDrawRange>& drawRanges,
+                                 VulkanBuffer& indirectBuffer,
+                                 VulkanDrawPath drawPath,
+                                 VkDeviceSize countOffset,
+                                 VkDeviceSize commandsOffset,
+                                 const VkDrawIndexedIndirectCommand* commands,
+                                 uint32_t first,
+                                 uint32_t count,
+                                 uint32_t maxDrawCount)
+    {
+        if (drawPath == VulkanDrawPath::IndirectCount && drawRanges.size() > 1)
+            drawPath = device.getEnabledFeatures().multiDrawIndirect ? VulkanDrawPath::MultiDrawIndirect : VulkanDrawPath::Indirect;
+
+        for (const GeometryDrawRange& range : drawRanges) {
+            uint32_t begin = std::max(first, range.first);
+            uint32_t end = std::min(first + count, range.first + range.count);
+            if (begin >= end)
+                continue;
+            bindGeometry(commandBuffer, geometry.getVertexBuffer(range.page), geometry.getIndexBuffer(range.page));
+            recordDraws(device, commandBuffer, indirectBuffer, drawPath, countOffset, commandsOffset, commands,
+                        begin, end - begin, maxDrawCount);
+        }
+    }
+
+    // Only the paths issuing one call per draw are worth splitting across threads
+    static bool splitsDraws(VulkanDrawPath drawPath){
+        return drawPath == VulkanDrawPath::Indirect || drawPath == VulkanDrawPath::Direct;
+    }
+
     void record2(VulkanDevice& device,
                 VulkanSwapchain& swapchain,
                 VulkanRenderPass& renderPass,
                 VulkanFramebuffers& framebuffers,
-                VulkanBuffer& vertexBuffer,
-                VulkanBuffer& indexBuffer,
-                VulkanDescriptor& sceneUBDescriptor,
-                VulkanDescriptor& objectsUBDescriptor,
+                VulkanGeometryPool& geometry,
+                const std::vector<GeometryDrawRange>& drawRanges, // one per geometry page drawn this frame
                 VulkanPipeline& graphicsPipeline,
-                std::vector<MeshDrawInfo> meshPool,
-                std::vector<uint32_t> meshDrawIndices, 
-                int commandBufferIndex
+                VulkanBuffer& indirectBuffer,
+                VulkanDrawPath drawPath,
+                uint32_t drawCount,
+                uint32_t maxDrawCount,
+                VulkanComputePipeline* cullPipeline, // null when culling is off
+                VulkanComputePipeline* meshletCullPipeline, // run with cullPipeline when there are meshlet draws
+                const CullParams& cullParams,
+                VulkanSecondaryRecorder* recorder,   // null to record every draw on this thread
+                VulkanGpuProfiler* profiler,         // null for no scopes, labels or queries
+                const VulkanFrameContext& frame,
+                uint32_t imageIndex
                 )
     
     {
-        vkResetCommandBuffer(commandBuffers[commandBufferIndex], 0);
+        CRUMBS_PROFILE_SCOPE("record2");
+        VkCommandBuffer commandBuffer = frame.commandBuffer;
+        vkResetCommandBuffer(commandBuffer, 0);
         const auto& fbos = framebuffers.getFramebuffers();
-        auto extent = swapchain.getExtent();
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-        if (vkBeginCommandBuffer(commandBuffers[commandBufferIndex], &beginInfo) != VK_SUCCESS)
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
             throw std::runtime_error("Failed to begin recording command buffer!");
+
+        bool secondaries = recorder != nullptr && splitsDraws(drawPath) && recorder->chunkCountFor(drawCount) > 1;
+        if (profiler != nullptr) {
+            profiler->beginFrame(commandBuffer, frame.getIndex());
+            profiler->beginScope(commandBuffer, "Frame");
+            // a query can only stay active over secondary buffers that inherit it
+            if (!secondaries || device.getEnabledFeatures().inheritedQueries)
+                profiler->beginStatistics(commandBuffer);
+        }
+
+        if (cullPipeline != nullptr) {
+            // frustum culling : visible objects are appended to their mesh command, before the render pass reads them
+            if (profiler != nullptr) profiler->beginScope(commandBuffer, "Cull");
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline->getPipeline());
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline->getLayout(),
+                                    0, 1, &frame.cullSet, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, cullPipeline->getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullParams), &cullParams);
+            vkCmdDispatch(commandBuffer, (cullParams.objectCount + 63) / 64, 1, 1);
+            if (profiler != nullptr) profiler->endScope(commandBuffer);
+
+            // meshlet culling : one workgroup per meshlet draw writes the commands of its meshlets, no
+            // overlap with the object pass. Same layout and push constants.
+            if (meshletCullPipeline != nullptr && cullParams.meshletDrawCount > 0) {
+                if (profiler != nullptr) profiler->beginScope(commandBuffer, "Meshlet Cull");
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipeline->getPipeline());
+                vkCmdDispatch(commandBuffer, cullParams.meshletDrawCount, 1, 1);
+                if (profiler != nullptr) profiler->endScope(commandBuffer);
+            }
+
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                                 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
         
         VkClearValue clearValues[2];
         clearValues[0].color = {{0.1f, 0.1f, 0.1f, 1.0f}};  // color attachment
@@ -152,59 +332,47 @@ public:
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
         renderPassInfo.renderPass = renderPass.getRenderPass();
-        renderPassInfo.framebuffer = framebuffers.getFramebuffers()[commandBufferIndex];       // framebuffer for this swapchain image
+        renderPassInfo.framebuffer = fbos[imageIndex];       // framebuffer for this swapchain image
         renderPassInfo.renderArea.offset = {0, 0};
         renderPassInfo.renderArea.extent = swapchain.getExtent();
         renderPassInfo.clearValueCount = 2;
         renderPassInfo.pClearValues = clearValues;
 
-        vkCmdBeginRenderPass(commandBuffers[commandBufferIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(commandBuffers[commandBufferIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline.getPipeline());
-        VkBuffer vertexBuffers[] = { vertexBuffer.getBuffer() };
-        VkDeviceSize offsets[] = { 0 };
-        vkCmdBindVertexBuffers(commandBuffers[commandBufferIndex], 0, 1, vertexBuffers, offsets);
-        
-        vkCmdBindIndexBuffer(commandBuffers[commandBufferIndex], indexBuffer.getBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-        vkCmdBindDescriptorSets(
-            commandBuffers[commandBufferIndex],
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
-            graphicsPipeline.getLayout(),
-            0,                       
-            1,                        // number of descriptor sets
-            &sceneUBDescriptor.getDescriptorSet(),
-            0,                        // dynamic offset count (0 for static UBO)
-            nullptr                   // dynamic offsets
-        );
-
-        for (size_t j = 0; j < meshDrawIndices.size(); ++j) {
-            uint32_t dynamicOffset = static_cast<uint32_t>(objectsUBDescriptor.getAlignedObjectSize() * j);
+        // the frame slice of the indirect buffer holds the draw count then one command per drawn mesh
+        VkDeviceSize countOffset = frame.indirectOffset;
+        VkDeviceSize commandsOffset = frame.indirectOffset + INDIRECT_COMMANDS_OFFSET;
+        const VkDrawIndexedIndirectCommand* commands = indirectBuffer.data<VkDrawIndexedIndirectCommand>(commandsOffset);
 
-            // Bind the descriptor set with the dynamic offset
-            vkCmdBindDescriptorSets(
-                commandBuffers[commandBufferIndex],
-                VK_PIPELINE_BIND_POINT_GRAPHICS,
-                graphicsPipeline.getLayout(),
-                1, 1, &objectsUBDescriptor.getDescriptorSet(),
-                1, &dynamicOffset
-            );
+        if (profiler != nullptr) profiler->beginScope(commandBuffer, "Draw");
+        if (secondaries) {
+            // the subpass then only holds vkCmdExecuteCommands, every chunk binds its own state
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            const std::vector<VkCommandBuffer>& chunks = recorder->record(
+                frame.getIndex(), renderPass.getRenderPass(), fbos[imageIndex], drawCount,
+                [&](VkCommandBuffer chunk, uint32_t first, uint32_t count){
+                    bindDrawState(chunk, graphicsPipeline, frame, swapchain.getExtent());
+                    recordDrawRanges(device, chunk, geometry, drawRanges, indirectBuffer, drawPath, countOffset, commandsOffset,
+                                     commands, first, count, maxDrawCount);
+                }, profiler != nullptr ? profiler->getStatisticsFlags() : 0);
+            vkCmdExecuteCommands(commandBuffer, chunks.size(), chunks.data());
+        }
+        else {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            bindDrawState(commandBuffer, graphicsPipeline, frame, swapchain.getExtent());
+            recordDrawRanges(device, commandBuffer, geometry, drawRanges, indirectBuffer, drawPath, countOffset, commandsOffset,
+                             commands, 0, drawCount, maxDrawCount);
+        }
 
-            // Draw using the information in MeshDrawInfo
-            const MeshDrawInfo& drawInfo = meshPool[meshDrawIndices[j]];
+        vkCmdEndRenderPass(commandBuffer);
 
-            vkCmdDrawIndexed(
-                commandBuffers[commandBufferIndex],
-                drawInfo.indexCount,    // number of indices to draw
-                1,                      // instance count
-                drawInfo.indexOffset,    // first index
-                drawInfo.vertexOffset,   // vertex offset
-                0                       // first instance
-            );
+        if (profiler != nullptr) {
+            profiler->endScope(commandBuffer); // Draw
+            profiler->endStatistics(commandBuffer);
+            profiler->endScope(commandBuffer); // Frame
+            profiler->endFrame();
         }
 
-        vkCmdEndRenderPass(commandBuffers[commandBufferIndex]);
-
-        if (vkEndCommandBuffer(commandBuffers[commandBufferIndex]) != VK_SUCCESS)
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
             throw std::runtime_error("Failed to record command buffer!");
     
     }
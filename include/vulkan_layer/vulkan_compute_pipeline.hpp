@@ -0,0 +1,75 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "vulkan_device.hpp"
+#include "vulkan_pipeline.hpp"
+
+// Single compute shader pipeline. The layout is built from the given descriptor set layouts
+// and one push constant range of pushConstantSize bytes (none if 0).
+class VulkanComputePipeline {
+private:
+    VkPipeline pipeline{ VK_NULL_HANDLE };
+    VkPipelineLayout layout{ VK_NULL_HANDLE };
+    VulkanDevice& pDevice;
+public:
+
+    VkPipeline getPipeline(){return pipeline;}
+    VkPipelineLayout getLayout(){return layout;}
+
+    VulkanComputePipeline(VulkanDevice& device, const std::vector<VkDescriptorSetLayout>& descLayouts, const std::string& compPath,
+                          uint32_t pushConstantSize = 0, const std::string& name = "Compute Pipeline"): pDevice(device){
+
+        VkShaderModule compShaderModule = createShaderModule(readFile(compPath), device.getDevice());
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = pushConstantSize;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = descLayouts.size();
+        pipelineLayoutInfo.pSetLayouts = descLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+        pipelineLayoutInfo.pPushConstantRanges = pushConstantSize > 0 ? &pushConstantRange : nullptr;
+        if (vkCreatePipelineLayout(device.getDevice(), &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS) {
+            vkDestroyShaderModule(device.getDevice(), compShaderModule, nullptr);
+            throw std::runtime_error("Couldn't create compute pipeline layout !");
+        }
+
+        VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+        compShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        compShaderStageInfo.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+        compShaderStageInfo.module = compShaderModule;
+        compShaderStageInfo.pName  = "main";
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage = compShaderStageInfo;
+        pipelineInfo.layout = layout;
+
+        auto buildStart = std::chrono::steady_clock::now();
+        VkResult result = vkCreateComputePipelines(device.getDevice(), device.getPipelineCache().getCache(), 1, &pipelineInfo, nullptr, &pipeline);
+        device.getPipelineCache().addBuildTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
+        vkDestroyShaderModule(device.getDevice(), compShaderModule, nullptr); // not needed once the pipeline exists
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Couldn't create compute pipeline !");
+        }
+        device.nameObject((uint64_t)pipeline, VK_OBJECT_TYPE_PIPELINE, name);
+    }
+    ~VulkanComputePipeline(){
+        destroy();
+    }
+    void destroy() {
+        if (layout != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(pDevice.getDevice(), layout, nullptr);
+            layout = VK_NULL_HANDLE;
+        }
+        if (pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(pDevice.getDevice(), pipeline, nullptr);
+            pipeline = VK_NULL_HANDLE;
+        }
+    }
+};
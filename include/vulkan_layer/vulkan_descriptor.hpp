@@ -1,15 +1,30 @@
-
 #include <vulkan/vulkan.h>
+#include <vector>
 #include "vulkan_device.hpp"
 #include "vulkan_buffer.hpp"
 #include "ubo.hpp"
+
+// One buffer binding of a descriptor set. Set i of the descriptor sees [offset + i * setStride, + range)
+struct VulkanDescriptorBinding {
+    VulkanBuffer* buffer;
+    VkDeviceSize range;
+    VkDeviceSize setStride = 0;
+    VkDeviceSize offset = 0;
+};
+
 class VulkanDescriptor {
 private:
     VulkanDevice& device;
     VkDescriptorSetLayout layout{ VK_NULL_HANDLE };
     VkDescriptorPool pool{ VK_NULL_HANDLE };
-    VkDescriptorSet descriptorSet{ VK_NULL_HANDLE };
-    VkDeviceSize alignedObjectSize;
+    std::vector<VkDescriptorSet> descriptorSets;
+    VkDeviceSize alignedObjectSize = 0;
+
+    static VkDescriptorType descriptorTypeOf(const VulkanBuffer& buffer){
+        if (buffer.getType() == VulkanBufferType::Storage || buffer.getType() == VulkanBufferType::Indirect)
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        return buffer.isDynamic()? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    }
 public:
 
     const VkDescriptorSetLayout& getLayout() const{
@@ -19,67 +34,79 @@ public:
     const VkDeviceSize& getAlignedObjectSize() const{
         return alignedObjectSize;
     }
-    VulkanDescriptor(VulkanDevice& device, VulkanBuffer& uniformBuffer, VkShaderStageFlags stageFlags, VkDeviceSize unalignedObjectSize): device(device){
-        VkDescriptorType descriptorType = uniformBuffer.isDynamic()? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        alignedObjectSize = uniformBuffer.getAlignedObjectSize();
-        //binding for the ubo 
-        VkDescriptorSetLayoutBinding uboLayout;
-        uboLayout.binding = 0;
-        uboLayout.descriptorType = descriptorType;
-        uboLayout.descriptorCount = 1;
-        uboLayout.stageFlags = stageFlags;
-        uboLayout.pImmutableSamplers = nullptr;
-
-        //second binding will be texture to sample 
+
+    // setCount sets share the layout, set i points at uniformBuffer + i * setStride (one slice per frame in flight)
+    VulkanDescriptor(VulkanDevice& device, VulkanBuffer& uniformBuffer, VkShaderStageFlags stageFlags, VkDeviceSize unalignedObjectSize,
+                     uint32_t setCount = 1, VkDeviceSize setStride = 0)
+        : VulkanDescriptor(device, {{&uniformBuffer, unalignedObjectSize, setStride}}, stageFlags, setCount){}
+
+    // Binding n of the layout is bindings[n], the descriptor type follows the buffer type
+    VulkanDescriptor(VulkanDevice& device, const std::vector<VulkanDescriptorBinding>& bindings, VkShaderStageFlags stageFlags,
+                     uint32_t setCount = 1): device(device){
+        alignedObjectSize = bindings[0].buffer->getAlignedObjectSize();
+
+        std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindings.size());
+        std::vector<VkDescriptorPoolSize> poolSizes(bindings.size());
+        for (uint32_t b = 0; b < bindings.size(); ++b) {
+            layoutBindings[b].binding = b;
+            layoutBindings[b].descriptorType = descriptorTypeOf(*bindings[b].buffer);
+            layoutBindings[b].descriptorCount = 1;
+            layoutBindings[b].stageFlags = stageFlags;
+            layoutBindings[b].pImmutableSamplers = nullptr;
+
+            poolSizes[b].type = layoutBindings[b].descriptorType;
+            poolSizes[b].descriptorCount = setCount;
+        }
 
         //layout from all the bindings created
         VkDescriptorSetLayoutCreateInfo layoutInfo{};
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = 1;
-        layoutInfo.pBindings = &uboLayout;
+        layoutInfo.bindingCount = layoutBindings.size();
+        layoutInfo.pBindings = layoutBindings.data();
 
         if (vkCreateDescriptorSetLayout(device.getDevice(), &layoutInfo, nullptr, &layout) != VK_SUCCESS)
             throw std::runtime_error("Failed to create descriptor set layout!");
 
-        VkDescriptorPoolSize poolSize{};
-        poolSize.type = descriptorType;
-        poolSize.descriptorCount = 1;
-
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = 1;
-        poolInfo.pPoolSizes = &poolSize;
-        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = poolSizes.size();
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
 
         if (vkCreateDescriptorPool(device.getDevice(), &poolInfo, nullptr, &pool) != VK_SUCCESS)
             throw std::runtime_error("Failed to create descriptor pool!");
 
+        std::vector<VkDescriptorSetLayout> layouts(setCount, layout);
+        descriptorSets.resize(setCount);
         VkDescriptorSetAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         allocInfo.descriptorPool = pool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts = &layout;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
 
-        if (vkAllocateDescriptorSets(device.getDevice(), &allocInfo, &descriptorSet) != VK_SUCCESS)
+        if (vkAllocateDescriptorSets(device.getDevice(), &allocInfo, descriptorSets.data()) != VK_SUCCESS)
             throw std::runtime_error("Failed to allocate descriptor set!");
 
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uniformBuffer.getBuffer();
-        bufferInfo.offset = 0;
-        bufferInfo.range = unalignedObjectSize; // covers all UBOs in the buffer
-
-        VkWriteDescriptorSet descriptorWrite{};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = descriptorSet;                 // which descriptor set to update
-        descriptorWrite.dstBinding = 0;                         // binding number (matches shader)
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = descriptorType; // ⚠ must match layout
-        descriptorWrite.descriptorCount = 1;
-        descriptorWrite.pBufferInfo = &bufferInfo;              // points to your buffer
-        descriptorWrite.pImageInfo = nullptr;                   // only used for samplers/images
-        descriptorWrite.pTexelBufferView = nullptr;
-        vkUpdateDescriptorSets(device.getDevice(), 1, &descriptorWrite, 0, nullptr);
-        
+        for (uint32_t i = 0; i < setCount; ++i) {
+            for (uint32_t b = 0; b < bindings.size(); ++b) {
+                VkDescriptorBufferInfo bufferInfo{};
+                bufferInfo.buffer = bindings[b].buffer->getBuffer();
+                bufferInfo.offset = bindings[b].offset + i * bindings[b].setStride;
+                bufferInfo.range = bindings[b].range;
+
+                VkWriteDescriptorSet descriptorWrite{};
+                descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrite.dstSet = descriptorSets[i];             // which descriptor set to update
+                descriptorWrite.dstBinding = b;                         // binding number (matches shader)
+                descriptorWrite.dstArrayElement = 0;
+                descriptorWrite.descriptorType = layoutBindings[b].descriptorType; // ⚠ must match layout
+                descriptorWrite.descriptorCount = 1;
+                descriptorWrite.pBufferInfo = &bufferInfo;              // points to your buffer
+                descriptorWrite.pImageInfo = nullptr;                   // only used for samplers/images
+                descriptorWrite.pTexelBufferView = nullptr;
+                vkUpdateDescriptorSets(device.getDevice(), 1, &descriptorWrite, 0, nullptr);
+            }
+        }
     }
     ~VulkanDescriptor() {
         destroy();
@@ -94,7 +121,8 @@ public:
             vkDestroyDescriptorSetLayout(device.getDevice(), layout, nullptr);
             layout = VK_NULL_HANDLE;
         }
+        descriptorSets.clear(); // freed with the pool
     }
-    const VkDescriptorSet& getDescriptorSet() const { return descriptorSet; }
+    const VkDescriptorSet& getDescriptorSet(uint32_t index = 0) const { return descriptorSets[index]; }
 
 };
@@ -1,16 +1,20 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include "vulkan_instance.hpp"
+#include "vulkan_pipeline_cache.hpp"
 #include <iostream>
-#include "vulkan_instance.hpp"
+#include <cstring>
+#include <memory>
 class VulkanDevice {
 
 private: 
     VkPhysicalDevice physicalDevice;
     VkPhysicalDeviceProperties properties; 
+    VkPhysicalDeviceMemoryProperties memoryProperties;
     VkDevice device;
     VkQueue graphicsQueue;
     uint32_t graphicsFamilyIndex;
+    uint32_t timestampValidBits = 0; // of the graphics queue, 0 without timestamp support
     
     VkCommandPool commandPool;
 
@@ -18,6 +22,11 @@ private:
     PFN_vkCmdBeginDebugUtilsLabelEXT vkCmdBeginDebugUtilsLabelEXT = nullptr;
     PFN_vkCmdEndDebugUtilsLabelEXT vkCmdEndDebugUtilsLabelEXT = nullptr;
     PFN_vkCmdInsertDebugUtilsLabelEXT vkCmdInsertDebugUtilsLabelEXT = nullptr;
+    PFN_vkCmdDrawIndexedIndirectCount vkCmdDrawIndexedIndirectCount = nullptr; // core 1.2 or VK_KHR_draw_indirect_count
+
+    VkPhysicalDeviceFeatures enabledFeatures{};
+
+    std::unique_ptr<VulkanPipelineCache> pipelineCache;
 
 public:
     
@@ -39,8 +48,55 @@ public:
     const VkQueue& getGraphicsQueue() const{
         return graphicsQueue;
     }
+
+    uint32_t getGraphicsFamilyIndex() const{
+        return graphicsFamilyIndex;
+    }
+
+    // Optional features are only enabled when the device supports them
+    const VkPhysicalDeviceFeatures& getEnabledFeatures() const{
+        return enabledFeatures;
+    }
+
+    // Every pipeline is created through it, persisted across launches
+    VulkanPipelineCache& getPipelineCache(){
+        return *pipelineCache;
+    }
+
+    const VulkanPipelineCache& getPipelineCache() const{
+        return *pipelineCache;
+    }
+
+    // Bits of a timestamp written on the graphics queue that are meaningful, 0 if it can't write any
+    uint32_t getTimestampValidBits() const{
+        return timestampValidBits;
+    }
+
+    bool supportsDrawIndirectCount() const{
+        return vkCmdDrawIndexedIndirectCount != nullptr;
+    }
+
+    void cmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+                                     VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride){
+        vkCmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+    }
     
-    VulkanDevice(VulkanInstance& instance){
+    bool isExtensionSupported(const char* extensionName) const{
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> available(extensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, available.data());
+        for(const auto& extension : available){
+            if(strcmp(extension.extensionName, extensionName) == 0){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The pipeline cache is loaded from pipelineCachePath and written back on destroy, an empty path
+    // keeps it in memory only
+    VulkanDevice(VulkanInstance& instance, const std::string& pipelineCachePath = PIPELINE_CACHE_FILE){
         VkSurfaceKHR surface = instance.getSurface();
         //First call to get the device Count
         uint32_t deviceCount = 0; 
@@ -73,6 +129,7 @@ public:
 
         physicalDevice = devices[0];
         vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
         //find a queueIndex
         graphicsFamilyIndex = -1;
         uint32_t queueFamilyCount = 0; 
@@ -85,6 +142,7 @@ public:
             if(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT){
                 std::cout << "Found graphics queue family: " << i << "\n";
                 graphicsFamilyIndex = i;
+                timestampValidBits = families[i].timestampValidBits;
                 break;
             }
         }
@@ -100,13 +158,48 @@ public:
         queueCreateInfo.queueCount = 1;
         queueCreateInfo.pQueuePriorities = &queuePriority;
 
-        std::vector<const char*> deviceExtensions = {
-            VK_KHR_SWAPCHAIN_EXTENSION_NAME,   
-            "VK_KHR_portability_subset"        // required on macOS
-        };
+        std::vector<const char*> deviceExtensions;
+        if(!instance.isHeadless()){
+            deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        }
+        if(isExtensionSupported("VK_KHR_portability_subset")){
+            deviceExtensions.push_back("VK_KHR_portability_subset"); // required on macOS
+        }
+
+        // features used by the indirect draw path
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+        enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+        enabledFeatures.fillModeNonSolid = supportedFeatures.fillModeNonSolid; // wireframe pipeline variants
+        // GPU profiler counters, inherited by the secondary buffers drawing a frame while they count
+        enabledFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+        enabledFeatures.inheritedQueries = supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries;
+
+        VkPhysicalDeviceVulkan12Features enabled12{};
+        enabled12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        const char* drawIndirectCountName = nullptr;
+        if(VK_API_VERSION_MINOR(properties.apiVersion) >= 2){
+            VkPhysicalDeviceVulkan12Features supported12{};
+            supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            VkPhysicalDeviceFeatures2 supported2{};
+            supported2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            supported2.pNext = &supported12;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supported2);
+            if(supported12.drawIndirectCount){
+                enabled12.drawIndirectCount = VK_TRUE;
+                drawIndirectCountName = "vkCmdDrawIndexedIndirectCount";
+            }
+        }
+        else if(isExtensionSupported("VK_KHR_draw_indirect_count")){
+            deviceExtensions.push_back("VK_KHR_draw_indirect_count");
+            drawIndirectCountName = "vkCmdDrawIndexedIndirectCountKHR";
+        }
 
         VkDeviceCreateInfo deviceCreateInfo{};
         deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        deviceCreateInfo.pNext = VK_API_VERSION_MINOR(properties.apiVersion) >= 2 ? &enabled12 : nullptr;
+        deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
         deviceCreateInfo.queueCreateInfoCount = 1;
         deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
         deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
@@ -124,6 +217,10 @@ public:
 
         vkCmdInsertDebugUtilsLabelEXT =(PFN_vkCmdInsertDebugUtilsLabelEXT)(vkGetDeviceProcAddr(device, "vkCmdInsertDebugUtilsLabelEXT"));
 
+        if(drawIndirectCountName){
+            vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCount)(vkGetDeviceProcAddr(device, drawIndirectCountName));
+        }
+
         vkGetDeviceQueue(device, graphicsFamilyIndex, 0, &graphicsQueue);
 
         VkCommandPoolCreateInfo poolInfo{};
@@ -134,6 +231,9 @@ public:
         if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create command pool!");
         }   
+
+        pipelineCache = std::make_unique<VulkanPipelineCache>(device, properties, pipelineCachePath);
+        nameObject((uint64_t)pipelineCache->getCache(), VK_OBJECT_TYPE_PIPELINE_CACHE, "Pipeline Cache");
         
     }
 
@@ -142,6 +242,7 @@ public:
     }
 
     void destroy() {
+        pipelineCache.reset(); // saved to disk here
         if (commandPool != VK_NULL_HANDLE) {
             vkDestroyCommandPool(device, commandPool, nullptr);
             commandPool = VK_NULL_HANDLE;
@@ -152,9 +253,12 @@ public:
         }
     }
 
+    const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const{
+        return memoryProperties;
+    }
+
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties){
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+        const VkPhysicalDeviceMemoryProperties& memProperties = memoryProperties;
 
         for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
             if ((typeFilter & (1 << i)) &&
@@ -166,7 +270,74 @@ public:
         throw std::runtime_error("failed to find suitable memory type!");
     }
 
+    // Records into a throwaway command buffer, submitted and waited on by endSingleTimeCommands
+    VkCommandBuffer beginSingleTimeCommands(){
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error("Failed to allocate single time command buffer!");
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        return commandBuffer;
+    }
+
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer){
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        vkQueueWaitIdle(graphicsQueue);
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    }
+
+    // Labelled regions of a command buffer, shown by capture tools and validation messages. No-ops when
+    // debug utils are not enabled on this instance.
+    void cmdBeginLabel(VkCommandBuffer commandBuffer, const char* name, const float color[4] = nullptr){
+        if(vkCmdBeginDebugUtilsLabelEXT == nullptr){
+            return;
+        }
+        VkDebugUtilsLabelEXT label{};
+        label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+        label.pLabelName = name;
+        if(color != nullptr){
+            memcpy(label.color, color, sizeof(label.color));
+        }
+        vkCmdBeginDebugUtilsLabelEXT(commandBuffer, &label);
+    }
+
+    void cmdEndLabel(VkCommandBuffer commandBuffer){
+        if(vkCmdEndDebugUtilsLabelEXT == nullptr){
+            return;
+        }
+        vkCmdEndDebugUtilsLabelEXT(commandBuffer);
+    }
+
+    void cmdInsertLabel(VkCommandBuffer commandBuffer, const char* name){
+        if(vkCmdInsertDebugUtilsLabelEXT == nullptr){
+            return;
+        }
+        VkDebugUtilsLabelEXT label{};
+        label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+        label.pLabelName = name;
+        vkCmdInsertDebugUtilsLabelEXT(commandBuffer, &label);
+    }
+
     void nameObject(uint64_t vulkanObject, VkObjectType type, std::string name){
+        if(vkSetDebugUtilsObjectNameEXT == nullptr){
+            return; // debug utils not enabled on this instance
+        }
         VkDebugUtilsObjectNameInfoEXT nameInfo{};
         nameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
         nameInfo.objectType = type; // example
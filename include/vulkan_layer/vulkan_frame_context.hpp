@@ -0,0 +1,105 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+#include <string>
+#include "vulkan_device.hpp"
+
+#define DEFAULT_FRAMES_IN_FLIGHT 3
+#define INDIRECT_COMMANDS_OFFSET 16 // draw count first, commands after it in a frame indirect slice
+
+// Where the CPU spent a frame waiting, in milliseconds
+struct FramePacingStats {
+    float limiterWaitMs = 0.0f; // CPU idling in the frame limiter
+    float gpuWaitMs = 0.0f;     // CPU blocked on frame fences, the GPU was behind
+    float acquireWaitMs = 0.0f; // CPU blocked acquiring an image, presentation was behind
+    float cpuWorkMs = 0.0f;     // from the end of the waits to the present
+};
+
+// Everything the CPU touches while building one frame in flight : its sync objects, command buffer,
+// descriptor sets and the slices of the per-frame uniform buffers they point to. Frame N+1 is built
+// in its own context while the GPU still renders frame N, wait() must be called before writing.
+class VulkanFrameContext {
+private:
+    VulkanDevice& pDevice;
+    uint32_t index;
+
+    VkSemaphore imageAvailableSemaphore{ VK_NULL_HANDLE };
+    VkSemaphore renderFinishedSemaphore{ VK_NULL_HANDLE };
+    VkFence inFlightFence{ VK_NULL_HANDLE };
+
+public:
+    // the command buffer comes from VulkanCommandBuffers and the descriptor sets from their
+    // VulkanDescriptor, both allocated one per frame in flight
+    VkCommandBuffer commandBuffer{ VK_NULL_HANDLE };
+    VkDeviceSize objectsOffset = 0;
+    VkDeviceSize instancesOffset = 0;
+    VkDeviceSize indirectOffset = 0;
+    VkDeviceSize cullOffset = 0;
+    VkDeviceSize meshletDrawOffset = 0;
+    VkDeviceSize sceneOffset = 0;
+    VkDescriptorSet objectsSet{ VK_NULL_HANDLE };
+    VkDescriptorSet sceneSet{ VK_NULL_HANDLE };
+    VkDescriptorSet cullSet{ VK_NULL_HANDLE };
+
+    VulkanFrameContext(VulkanDevice& device, uint32_t index): pDevice(device), index(index){
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // Start signaled so first frame runs immediately
+
+        if (vkCreateSemaphore(device.getDevice(), &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
+            vkCreateSemaphore(device.getDevice(), &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS ||
+            vkCreateFence(device.getDevice(), &fenceInfo, nullptr, &inFlightFence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create synchronization objects!");
+        }
+        device.nameObject((uint64_t)inFlightFence, VK_OBJECT_TYPE_FENCE, "Frame " + std::to_string(index) + " Fence");
+    }
+
+    ~VulkanFrameContext(){
+        destroy();
+    }
+
+    void destroy(){
+        if (inFlightFence != VK_NULL_HANDLE) {
+            vkDestroyFence(pDevice.getDevice(), inFlightFence, nullptr);
+            inFlightFence = VK_NULL_HANDLE;
+        }
+        if (renderFinishedSemaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(pDevice.getDevice(), renderFinishedSemaphore, nullptr);
+            renderFinishedSemaphore = VK_NULL_HANDLE;
+        }
+        if (imageAvailableSemaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(pDevice.getDevice(), imageAvailableSemaphore, nullptr);
+            imageAvailableSemaphore = VK_NULL_HANDLE;
+        }
+    }
+
+    // Blocks until the GPU is done with the last submission of this frame
+    void wait(){
+        vkWaitForFences(pDevice.getDevice(), 1, &inFlightFence, VK_TRUE, UINT64_MAX);
+    }
+
+    // Must only be called right before a submit that signals the fence again
+    void resetFence(){
+        vkResetFences(pDevice.getDevice(), 1, &inFlightFence);
+    }
+
+    uint32_t getIndex() const{
+        return index;
+    }
+
+    const VkSemaphore& getImageAvailableSemaphore() const{
+        return imageAvailableSemaphore;
+    }
+
+    const VkSemaphore& getRenderFinishedSemaphore() const{
+        return renderFinishedSemaphore;
+    }
+
+    const VkFence& getFence() const{
+        return inFlightFence;
+    }
+};
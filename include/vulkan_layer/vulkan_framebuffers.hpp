@@ -20,7 +20,12 @@ public:
 
     VulkanFramebuffers(VulkanDevice& dev, VulkanSwapchain& sc, VulkanRenderPass& rp)
         : device(dev), swapchain(sc), renderPass(rp) {
-        
+        create();
+    }
+
+    // One framebuffer per swapchain image at its current extent, after a swapchain recreate
+    void create(){
+        destroy();
         framebuffers.resize(swapchain.getImageViews().size());
         
         for (size_t i = 0; i < swapchain.getImageViews().size(); ++i) {
@@ -39,7 +44,6 @@ public:
             
             device.nameObject((uint64_t) framebuffers[i], VK_OBJECT_TYPE_FRAMEBUFFER, "Framebuffer " + std::to_string(i));
         }
-    
     }
 
     ~VulkanFramebuffers() {
@@ -0,0 +1,161 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include "vulkan_allocator.hpp"
+#include "vulkan_buffer.hpp"
+#include "free_list_allocator.hpp"
+
+#define MAX_GEOMETRY_PAGES 8 // bounds the geometry footprint, loads fail past it
+
+// Vertices and indices of one or more meshes, in a single page of the pool. Offsets and sizes count
+// vertices and indices, not bytes.
+struct GeometryAllocation {
+    uint32_t page = 0;
+    FreeListAllocator::Range vertices;
+    FreeListAllocator::Range indices;
+
+    uint32_t getVertexOffset() const{
+        return vertices.offset;
+    }
+
+    uint32_t getIndexOffset() const{
+        return indices.offset;
+    }
+};
+
+// Draws [first, first + count) of the frame commands all read the geometry of page
+struct GeometryDrawRange {
+    uint32_t page;
+    uint32_t first;
+    uint32_t count;
+};
+
+// DeviceLocal vertex and index buffers shared by every mesh. Space is handed out by best fit free lists
+// and reclaimed on free, a new page of buffers is chained once no page has room. Draws bind the page of
+// their geometry, vertex offsets are relative to it.
+class VulkanGeometryPool {
+private:
+    struct Page {
+        std::unique_ptr<VulkanBuffer> vertexBuffer;
+        std::unique_ptr<VulkanBuffer> indexBuffer;
+        FreeListAllocator vertexSpace; // in vertices
+        FreeListAllocator indexSpace;  // in indices
+    };
+
+    VulkanAllocator& allocator;
+    uint32_t vertexStride;
+    uint32_t pageVertexCount;
+    uint32_t pageIndexCount;
+    std::vector<Page> pages;
+
+    bool allocateFromPage(uint32_t page, uint32_t vertexCount, uint32_t indexCount, GeometryAllocation& allocation){
+        // empty ranges would confuse the free list merges
+        vertexCount = std::max(vertexCount, 1u);
+        indexCount = std::max(indexCount, 1u);
+        Page& p = pages[page];
+        if (!p.vertexSpace.allocate(vertexCount, 1, allocation.vertices))
+            return false;
+        if (!p.indexSpace.allocate(indexCount, 1, allocation.indices)) {
+            p.vertexSpace.free(allocation.vertices);
+            return false;
+        }
+        allocation.page = page;
+        return true;
+    }
+
+    void addPage(uint32_t vertexCount, uint32_t indexCount){
+        // a mesh larger than a page gets a page of its own size
+        vertexCount = std::max(vertexCount, pageVertexCount);
+        indexCount = std::max(indexCount, pageIndexCount);
+        std::string index = std::to_string(pages.size());
+
+        Page page;
+        page.vertexBuffer = std::make_unique<VulkanBuffer>(allocator, VulkanBufferType::Vertex, (VkDeviceSize)vertexCount * vertexStride,
+                                                           nullptr, false, 0, "Vertex Buffer " + index, VulkanMemoryPlacement::DeviceLocal);
+        page.indexBuffer = std::make_unique<VulkanBuffer>(allocator, VulkanBufferType::Index, (VkDeviceSize)indexCount * sizeof(uint32_t),
+                                                          nullptr, false, 0, "Index Buffer " + index, VulkanMemoryPlacement::DeviceLocal);
+        page.vertexSpace = FreeListAllocator(vertexCount);
+        page.indexSpace = FreeListAllocator(indexCount);
+        pages.push_back(std::move(page));
+    }
+
+public:
+    // Pages hold pageVertexCount vertices of vertexStride bytes and pageIndexCount indices. The first
+    // one is created right away.
+    VulkanGeometryPool(VulkanAllocator& allocator, uint32_t vertexStride, uint32_t pageVertexCount, uint32_t pageIndexCount)
+        : allocator(allocator), vertexStride(vertexStride), pageVertexCount(pageVertexCount), pageIndexCount(pageIndexCount)
+    {
+        addPage(pageVertexCount, pageIndexCount);
+    }
+
+    ~VulkanGeometryPool(){
+        destroy();
+    }
+
+    // The buffers must not be in use by the GPU anymore
+    void destroy(){
+        pages.clear();
+    }
+
+    // Room for vertexCount vertices and indexCount indices in one page, chaining a new page if none has
+    // it. Throws once MAX_GEOMETRY_PAGES pages are full.
+    GeometryAllocation allocate(uint32_t vertexCount, uint32_t indexCount){
+        GeometryAllocation allocation;
+        for (uint32_t page = 0; page < pages.size(); ++page) {
+            if (allocateFromPage(page, vertexCount, indexCount, allocation))
+                return allocation;
+        }
+        if (pages.size() >= MAX_GEOMETRY_PAGES)
+            throw std::runtime_error("Geometry pool is full!");
+        addPage(vertexCount, indexCount);
+        if (!allocateFromPage(pages.size() - 1, vertexCount, indexCount, allocation))
+            throw std::runtime_error("Geometry pool page allocation failed!");
+        return allocation;
+    }
+
+    // The GPU must be done with the geometry, the space is reused by the next allocate
+    void free(const GeometryAllocation& allocation){
+        Page& page = pages.at(allocation.page);
+        page.vertexSpace.free(allocation.vertices);
+        page.indexSpace.free(allocation.indices);
+    }
+
+    uint32_t getPageCount() const{
+        return pages.size();
+    }
+
+    VulkanBuffer& getVertexBuffer(uint32_t page){
+        return *pages.at(page).vertexBuffer;
+    }
+
+    VulkanBuffer& getIndexBuffer(uint32_t page){
+        return *pages.at(page).indexBuffer;
+    }
+
+    uint32_t getVertexStride() const{
+        return vertexStride;
+    }
+
+    // Bytes of device memory held by the pages, used or not
+    VkDeviceSize getCapacityBytes() const{
+        VkDeviceSize bytes = 0;
+        for (const Page& page : pages) {
+            bytes += page.vertexSpace.getCapacity() * vertexStride + page.indexSpace.getCapacity() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    // Bytes of device memory currently allocated to geometry
+    VkDeviceSize getUsedBytes() const{
+        VkDeviceSize bytes = 0;
+        for (const Page& page : pages) {
+            bytes += (page.vertexSpace.getCapacity() - page.vertexSpace.getFreeBytes()) * vertexStride +
+                     (page.indexSpace.getCapacity() - page.indexSpace.getFreeBytes()) * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+};
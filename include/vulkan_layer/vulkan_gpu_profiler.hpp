@@ -0,0 +1,287 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "debug.hpp"
+#include "vulkan_device.hpp"
+
+#define GPU_PROFILER_MAX_SCOPES 32 // timed scopes in one frame, the next ones only get their debug label
+
+// GPU time of one scope, in the order the scopes began
+struct GpuScopeTiming {
+    std::string name;
+    uint32_t depth;     // 0 for the outermost scopes
+    float milliseconds;
+};
+
+// Counted from the start of the cull pass to the end of the render pass, in the order Vulkan writes them
+struct GpuPipelineStats {
+    uint64_t inputVertices = 0;
+    uint64_t inputPrimitives = 0;
+    uint64_t vertexInvocations = 0;
+    uint64_t clippingInvocations = 0;
+    uint64_t clippingPrimitives = 0;
+    uint64_t fragmentInvocations = 0;
+    uint64_t computeInvocations = 0;
+};
+
+// Times labelled scopes of the frame command buffers with timestamp queries and counts pipeline
+// statistics over the frame. Every frame in flight has its own query pools, read back when the frame
+// comes around again : its fence was waited on by then, the results are framesInFlight frames old but
+// reading them never stalls. Scopes always get their debug label, timed or not.
+class VulkanGpuProfiler {
+private:
+    struct Scope {
+        std::string name;
+        uint32_t depth;
+        uint32_t query; // begin timestamp, the end one follows it. UINT32_MAX when not timed.
+    };
+
+    struct FrameQueries {
+        VkQueryPool timestamps = VK_NULL_HANDLE;
+        VkQueryPool statistics = VK_NULL_HANDLE;
+        std::vector<Scope> scopes;
+        uint32_t queryCount = 0;
+        bool statisticsWritten = false;
+        bool submitted = false; // written by a recorded frame, not read back yet
+    };
+
+    static constexpr VkQueryPipelineStatisticFlags statisticsFlags =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+    VulkanDevice& device;
+    std::vector<FrameQueries> frames;
+    FrameQueries* recording = nullptr;  // frame between beginFrame and endFrame, null when not profiled
+    std::vector<uint32_t> openScopes;   // into recording->scopes, UINT32_MAX for scopes only labelled
+    bool statisticsActive = false;
+    bool enabled = false;
+    bool warnedScopeLimit = false;
+
+    bool timestampsSupported;
+    bool statisticsSupported;
+    double nanosecondsPerTick;
+    uint64_t timestampMask;
+
+    std::vector<uint64_t> ticks;        // readback scratch, GPU_PROFILER_MAX_SCOPES * 2 entries
+    std::vector<GpuScopeTiming> timings;
+    GpuPipelineStats stats{};
+    bool hasResults = false;
+
+    // Results of the last frame recorded with f, its fence must have been waited on
+    void readBack(FrameQueries& f){
+        if (!f.submitted)
+            return;
+        f.submitted = false;
+
+        // no WAIT bit : the fence was waited on, NOT_READY only means a query was never written
+        if (f.queryCount > 0 &&
+            vkGetQueryPoolResults(device.getDevice(), f.timestamps, 0, f.queryCount, f.queryCount * sizeof(uint64_t),
+                                  ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            timings.clear();
+            for (const Scope& scope : f.scopes) {
+                if (scope.query == UINT32_MAX)
+                    continue;
+                uint64_t elapsed = (ticks[scope.query + 1] - ticks[scope.query]) & timestampMask;
+                timings.push_back({scope.name, scope.depth, (float)(elapsed * nanosecondsPerTick / 1e6)});
+            }
+            hasResults = true;
+        }
+
+        uint64_t counters[7];
+        if (f.statisticsWritten &&
+            vkGetQueryPoolResults(device.getDevice(), f.statistics, 0, 1, sizeof(counters), counters,
+                                  sizeof(counters), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            stats.inputVertices = counters[0];
+            stats.inputPrimitives = counters[1];
+            stats.vertexInvocations = counters[2];
+            stats.clippingInvocations = counters[3];
+            stats.clippingPrimitives = counters[4];
+            stats.fragmentInvocations = counters[5];
+            stats.computeInvocations = counters[6];
+        }
+    }
+
+public:
+    VulkanGpuProfiler(VulkanDevice& device, uint32_t framesInFlight)
+        : device(device), frames(framesInFlight)
+    {
+        const VkPhysicalDeviceLimits& limits = device.getProperties().limits;
+        uint32_t validBits = device.getTimestampValidBits();
+        // compute timestamps too, the cull passes are timed
+        timestampsSupported = validBits > 0 && limits.timestampComputeAndGraphics;
+        statisticsSupported = device.getEnabledFeatures().pipelineStatisticsQuery;
+        nanosecondsPerTick = limits.timestampPeriod;
+        timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+        ticks.resize(GPU_PROFILER_MAX_SCOPES * 2);
+
+        for (uint32_t i = 0; i < framesInFlight; ++i) {
+            FrameQueries& f = frames[i];
+            if (timestampsSupported) {
+                VkQueryPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                poolInfo.queryCount = GPU_PROFILER_MAX_SCOPES * 2;
+                if (vkCreateQueryPool(device.getDevice(), &poolInfo, nullptr, &f.timestamps) != VK_SUCCESS)
+                    throw std::runtime_error("Couldn't create timestamp query pool!");
+                device.nameObject((uint64_t)f.timestamps, VK_OBJECT_TYPE_QUERY_POOL, "Frame " + std::to_string(i) + " Timestamps");
+            }
+            if (statisticsSupported) {
+                VkQueryPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+                poolInfo.queryCount = 1;
+                poolInfo.pipelineStatistics = statisticsFlags;
+                if (vkCreateQueryPool(device.getDevice(), &poolInfo, nullptr, &f.statistics) != VK_SUCCESS)
+                    throw std::runtime_error("Couldn't create pipeline statistics query pool!");
+                device.nameObject((uint64_t)f.statistics, VK_OBJECT_TYPE_QUERY_POOL, "Frame " + std::to_string(i) + " Pipeline Statistics");
+            }
+        }
+    }
+
+    VulkanGpuProfiler(const VulkanGpuProfiler&) = delete;
+    VulkanGpuProfiler& operator=(const VulkanGpuProfiler&) = delete;
+
+    ~VulkanGpuProfiler(){
+        destroy();
+    }
+
+    void destroy(){
+        for (FrameQueries& f : frames) {
+            if (f.timestamps != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device.getDevice(), f.timestamps, nullptr);
+                f.timestamps = VK_NULL_HANDLE;
+            }
+            if (f.statistics != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device.getDevice(), f.statistics, nullptr);
+                f.statistics = VK_NULL_HANDLE;
+            }
+        }
+        frames.clear();
+        recording = nullptr;
+    }
+
+    // Off by default, frames recorded while off only get their debug labels
+    void setEnabled(bool on){
+        enabled = on;
+    }
+
+    bool isEnabled() const{
+        return enabled;
+    }
+
+    bool supportsTimestamps() const{
+        return timestampsSupported;
+    }
+
+    bool supportsStatistics() const{
+        return statisticsSupported;
+    }
+
+    // Frames between the one recorded and the one its results are read back in
+    uint32_t getLatency() const{
+        return frames.size();
+    }
+
+    // Right after vkBeginCommandBuffer of frameIndex, once the fence of that frame was waited on. Reads
+    // back what the previous use of its queries measured then resets them.
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex){
+        FrameQueries& f = frames.at(frameIndex);
+        readBack(f);
+        f.scopes.clear();
+        f.queryCount = 0;
+        f.statisticsWritten = false;
+        openScopes.clear();
+        statisticsActive = false;
+        recording = enabled ? &f : nullptr;
+        if (recording == nullptr)
+            return;
+        if (f.timestamps != VK_NULL_HANDLE)
+            vkCmdResetQueryPool(commandBuffer, f.timestamps, 0, GPU_PROFILER_MAX_SCOPES * 2);
+        if (f.statistics != VK_NULL_HANDLE)
+            vkCmdResetQueryPool(commandBuffer, f.statistics, 0, 1);
+    }
+
+    // Right before vkEndCommandBuffer, the frame is expected to be submitted
+    void endFrame(){
+        if (!openScopes.empty())
+            throw std::runtime_error("GPU profiler scope left open at the end of the frame!");
+        if (recording != nullptr)
+            recording->submitted = true;
+        recording = nullptr;
+    }
+
+    // Outside of render passes : secondary buffers can't hold the timestamps. The begin timestamp is
+    // written once the previous commands are done, the scopes of a frame follow each other instead of
+    // overlapping.
+    void beginScope(VkCommandBuffer commandBuffer, const char* name){
+        device.cmdBeginLabel(commandBuffer, name);
+        uint32_t scopeIndex = UINT32_MAX;
+        if (recording != nullptr && recording->timestamps != VK_NULL_HANDLE) {
+            if (recording->queryCount + 2 <= GPU_PROFILER_MAX_SCOPES * 2) {
+                scopeIndex = recording->scopes.size();
+                recording->scopes.push_back({name, (uint32_t)openScopes.size(), recording->queryCount});
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, recording->timestamps, recording->queryCount);
+                recording->queryCount += 2;
+            }
+            else if (!warnedScopeLimit) {
+                warnedScopeLimit = true;
+                Debug::LogWarning("More than " + std::to_string(GPU_PROFILER_MAX_SCOPES) + " GPU profiler scopes in a frame, the next ones aren't timed");
+            }
+        }
+        openScopes.push_back(scopeIndex);
+    }
+
+    void endScope(VkCommandBuffer commandBuffer){
+        if (openScopes.empty())
+            throw std::runtime_error("GPU profiler scope ended without being begun!");
+        uint32_t scopeIndex = openScopes.back();
+        openScopes.pop_back();
+        if (scopeIndex != UINT32_MAX) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, recording->timestamps,
+                                recording->scopes[scopeIndex].query + 1);
+        }
+        device.cmdEndLabel(commandBuffer);
+    }
+
+    // Once per frame, around every pass to count. Secondary buffers executed in between must inherit
+    // getStatisticsFlags().
+    void beginStatistics(VkCommandBuffer commandBuffer){
+        if (recording == nullptr || recording->statistics == VK_NULL_HANDLE || recording->statisticsWritten)
+            return;
+        vkCmdBeginQuery(commandBuffer, recording->statistics, 0, 0);
+        recording->statisticsWritten = true;
+        statisticsActive = true;
+    }
+
+    void endStatistics(VkCommandBuffer commandBuffer){
+        if (!statisticsActive)
+            return;
+        vkCmdEndQuery(commandBuffer, recording->statistics, 0);
+        statisticsActive = false;
+    }
+
+    // Counters of the statistics query being recorded, 0 when none is
+    VkQueryPipelineStatisticFlags getStatisticsFlags() const{
+        return statisticsActive ? statisticsFlags : 0;
+    }
+
+    // Of the last frame read back, getLatency() frames behind the last one recorded
+    const std::vector<GpuScopeTiming>& getScopeTimings() const{
+        return timings;
+    }
+
+    const GpuPipelineStats& getPipelineStats() const{
+        return stats;
+    }
+
+    bool hasTimings() const{
+        return hasResults;
+    }
+};
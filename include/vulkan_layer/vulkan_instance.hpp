@@ -1,6 +1,7 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include <vector> 
+#include <cstring>
 #include <GLFW/glfw3.h>
 #include "debug.hpp"
 VkApplicationInfo defaultAppInfo(){
@@ -17,8 +18,8 @@ VkApplicationInfo defaultAppInfo(){
 
 class VulkanInstance {
     private:
-        VkInstance instance;
-        VkSurfaceKHR surface;
+        VkInstance instance = VK_NULL_HANDLE;
+        VkSurfaceKHR surface = VK_NULL_HANDLE;
         VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE; 
 
         static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
@@ -57,35 +58,78 @@ class VulkanInstance {
                 std::cerr << "⚠️ Failed to create debug messenger.\n";
             }
         }
-    public:
-        VulkanInstance(GLFWwindow* window){
+        static bool isLayerAvailable(const char* layerName){
+            uint32_t layerCount = 0;
+            vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+            std::vector<VkLayerProperties> layers(layerCount);
+            vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+            for(const auto& layer : layers){
+                if(strcmp(layer.layerName, layerName) == 0){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static bool isExtensionAvailable(const char* extensionName){
+            uint32_t extensionCount = 0;
+            vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+            std::vector<VkExtensionProperties> available(extensionCount);
+            vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, available.data());
+            for(const auto& extension : available){
+                if(strcmp(extension.extensionName, extensionName) == 0){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void createInstance(std::vector<const char*> extensions){
             VkApplicationInfo appInfo = defaultAppInfo();
-            uint32_t glfwExtensionCount = 0;
-            const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
             const char* validationLayers[] = {"VK_LAYER_KHRONOS_validation"};
-            std::vector<const char*> extensions;
-            for(int i = 0; i < glfwExtensionCount; i++){
-                extensions.push_back(glfwExtensions[i]);
-            }
-            // Add this one for macOS (MoltenVK)
-            extensions.push_back("VK_KHR_portability_enumeration");
-            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
             VkInstanceCreateInfo createInfo{}; 
             createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
             createInfo.pApplicationInfo = &appInfo;
+
+            // macOS (MoltenVK) needs portability enumeration, other loaders may not expose it
+            if(isExtensionAvailable(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)){
+                extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+                createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+            }
+            if(isExtensionAvailable(VK_EXT_DEBUG_UTILS_EXTENSION_NAME)){
+                extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+            }
             createInfo.enabledExtensionCount = extensions.size();
             createInfo.ppEnabledExtensionNames = extensions.data();
-            createInfo.enabledLayerCount = 1;
-            createInfo.ppEnabledLayerNames = validationLayers;
 
-            // macOS-specific: required flag for MoltenVK
-            createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+            // CI machines usually don't ship the validation layers
+            if(isLayerAvailable(validationLayers[0])){
+                createInfo.enabledLayerCount = 1;
+                createInfo.ppEnabledLayerNames = validationLayers;
+            }
+            else{
+                Debug::LogWarning("Validation layers not available, running without them.");
+            }
 
             if(vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS){
                 throw std::runtime_error("Failed to create Vulkan instance!");
             }
-            if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+        }
+    public:
+        // A null window gives a headless instance : no window system extensions and no surface,
+        // rendering then goes to offscreen images
+        VulkanInstance(GLFWwindow* window = nullptr){
+            std::vector<const char*> extensions;
+            if(window != nullptr){
+                uint32_t glfwExtensionCount = 0;
+                const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+                for(int i = 0; i < glfwExtensionCount; i++){
+                    extensions.push_back(glfwExtensions[i]);
+                }
+            }
+            createInstance(extensions);
+            if (window != nullptr && glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
                 throw std::runtime_error("Failed to create window surface!");
             setupDebugMessenger();
         }
@@ -116,6 +160,9 @@ class VulkanInstance {
         const VkSurfaceKHR& getSurface() const{
             return surface;
         }
+        bool isHeadless() const{
+            return surface == VK_NULL_HANDLE;
+        }
 };
 
         
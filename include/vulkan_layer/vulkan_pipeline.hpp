@@ -2,11 +2,19 @@
 #include <vulkan/vulkan.h>
 #include <string>
 #include <fstream>
+#include <chrono>
+#include <functional>
 #include "vertex.hpp"
 #include "vulkan_device.hpp"
 #include "vulkan_render_pass.hpp"
 
 VkShaderModule createShaderModule(std::vector<char> code, const VkDevice &device) {
+    // a file caught while the compiler rewrites it must not reach the driver
+    const uint32_t spirvMagic = 0x07230203;
+    if (code.size() < 20 || code.size() % 4 != 0 || *reinterpret_cast<const uint32_t*>(code.data()) != spirvMagic) {
+        throw std::runtime_error("Shader code is not valid SPIR-V!");
+    }
+
     VkShaderModuleCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.codeSize = code.size();
@@ -24,7 +32,7 @@ std::vector<char> readFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
     if (!file.is_open()) {
-        throw std::runtime_error("Failed to open file!");
+        throw std::runtime_error("Failed to open file " + filename + "!");
     }
 
     size_t fileSize = (size_t) file.tellg();
@@ -37,26 +45,71 @@ std::vector<char> readFile(const std::string& filename) {
     return buffer;
 }
 
+// Everything a graphics pipeline variant is built from, two equal states give the same pipeline
+struct GraphicsPipelineState {
+    std::string vertPath;
+    std::string fragPath;
+    VertexFormat vertexFormat = VertexFormat::Float; // the vertex shader must decode it
+    VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL; // line needs the fillModeNonSolid feature
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    bool depthTest = true;
+    bool depthWrite = true;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+    bool blend = false; // source alpha over the destination
+
+    bool operator==(const GraphicsPipelineState& other) const{
+        return vertPath == other.vertPath && fragPath == other.fragPath && vertexFormat == other.vertexFormat &&
+               polygonMode == other.polygonMode && cullMode == other.cullMode && frontFace == other.frontFace &&
+               depthTest == other.depthTest && depthWrite == other.depthWrite && depthCompareOp == other.depthCompareOp &&
+               blend == other.blend;
+    }
+
+    uint64_t hash() const{
+        uint64_t seed = 0;
+        auto combine = [&seed](uint64_t value){
+            seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+        };
+        combine(std::hash<std::string>{}(vertPath));
+        combine(std::hash<std::string>{}(fragPath));
+        combine((uint64_t)vertexFormat);
+        combine((uint64_t)polygonMode);
+        combine((uint64_t)cullMode);
+        combine((uint64_t)frontFace);
+        combine((uint64_t)depthTest | (uint64_t)depthWrite << 1 | (uint64_t)blend << 2);
+        combine((uint64_t)depthCompareOp);
+        return seed;
+    }
+};
+
+// Graphics pipeline of one state. The layout belongs to the caller, every variant drawing the same
+// descriptor sets shares it. Shader modules only live for the creation.
 class VulkanPipeline {
 private:
-    VkPipeline pipeline;
+    VkPipeline pipeline{ VK_NULL_HANDLE };
     VkPipelineLayout layout;
-    VkShaderModule vertShaderModule; 
-    VkShaderModule fragShaderModule; 
     VulkanDevice& pDevice;
 public:
     
     VkPipeline getPipeline(){return pipeline;}
     VkPipelineLayout getLayout(){return layout;}
 
-    VulkanPipeline(VulkanDevice& device, VulkanRenderPass& renderPass, VulkanSwapchain& swapchain, VulkanDescriptor& sceneDataUBDescriptor, VulkanDescriptor& objectsUBDescriptor,
-                   const std::string& vertPath, const std::string& fragPath): pDevice(device){
+    // Safe to call from any thread, nothing is shared with other pipelines but the pipeline cache
+    VulkanPipeline(VulkanDevice& device, VulkanRenderPass& renderPass, VkPipelineLayout layout,
+                   const GraphicsPipelineState& state, const std::string& name = "Graphics Pipeline"): layout(layout), pDevice(device){
         
-        auto vertShaderCode = readFile("./shaders/test.vert.spv");
-        auto fragShaderCode = readFile("./shaders/test.frag.spv");
+        auto vertShaderCode = readFile(state.vertPath);
+        auto fragShaderCode = readFile(state.fragPath);
 
-        vertShaderModule = createShaderModule(vertShaderCode, device.getDevice());
-        fragShaderModule = createShaderModule(fragShaderCode, device.getDevice());
+        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode, device.getDevice());
+        VkShaderModule fragShaderModule;
+        try {
+            fragShaderModule = createShaderModule(fragShaderCode, device.getDevice());
+        }
+        catch (...) {
+            vkDestroyShaderModule(device.getDevice(), vertShaderModule, nullptr);
+            throw;
+        }
 
         VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
         vertShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -72,8 +125,8 @@ public:
 
         VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+        auto bindingDescription = Vertex::getBindingDescription(state.vertexFormat);
+        auto attributeDescriptions = Vertex::getAttributeDescriptions(state.vertexFormat);
         
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -87,31 +140,26 @@ public:
         inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-        VkViewport viewport{};
-        viewport.x = 0.0f; viewport.y = 0.0f;
-        viewport.width  = (float) swapchain.getExtent().width;
-        viewport.height = (float) swapchain.getExtent().height;
-        viewport.minDepth = 0.0f; viewport.maxDepth = 1.0f;
-
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = swapchain.getExtent();
-
+        // viewport and scissor are set when drawing, a resize doesn't rebuild any pipeline
         VkPipelineViewportStateCreateInfo viewportState{};
         viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
         viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+
+        VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = 2;
+        dynamicState.pDynamicStates = dynamicStates;
 
         VkPipelineRasterizationStateCreateInfo rasterizer{};
         rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
         rasterizer.depthClampEnable = VK_FALSE;
         rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.polygonMode = state.polygonMode;
         rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.cullMode = state.cullMode;
+        rasterizer.frontFace = state.frontFace;
 
         VkPipelineMultisampleStateCreateInfo multisampling{};
         multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
@@ -121,7 +169,13 @@ public:
         VkPipelineColorBlendAttachmentState colorBlendAttachment{};
         colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
                                             VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
+        colorBlendAttachment.blendEnable = state.blend ? VK_TRUE : VK_FALSE;
+        colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+        colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
         VkPipelineColorBlendStateCreateInfo colorBlending{};
         colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -130,20 +184,11 @@ public:
         colorBlending.pAttachments = &colorBlendAttachment;
                     
 
-        std::vector<VkDescriptorSetLayout> descLayouts{sceneDataUBDescriptor.getLayout(), objectsUBDescriptor.getLayout()};
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = descLayouts.size();                          // number of descriptor set layouts
-        pipelineLayoutInfo.pSetLayouts = descLayouts.data();      // pointer to your descriptor set layout
-        pipelineLayoutInfo.pushConstantRangeCount = 0;
-        pipelineLayoutInfo.pPushConstantRanges = nullptr;
-        vkCreatePipelineLayout(device.getDevice(), &pipelineLayoutInfo, nullptr, &layout);
-        
         VkPipelineDepthStencilStateCreateInfo depthStencil{};
         depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-        depthStencil.depthTestEnable = VK_TRUE;               // enable depth test
-        depthStencil.depthWriteEnable = VK_TRUE;              // enable writing to depth buffer
-        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;     // standard depth test
+        depthStencil.depthTestEnable = state.depthTest ? VK_TRUE : VK_FALSE;
+        depthStencil.depthWriteEnable = state.depthWrite ? VK_TRUE : VK_FALSE;
+        depthStencil.depthCompareOp = state.depthCompareOp;
         depthStencil.depthBoundsTestEnable = VK_FALSE;
         depthStencil.stencilTestEnable = VK_FALSE;
        
@@ -163,28 +208,22 @@ public:
         pipelineInfo.renderPass = renderPass.getRenderPass(); // your render pass
         pipelineInfo.subpass = 0;
         pipelineInfo.pDepthStencilState = &depthStencil;       
+        pipelineInfo.pDynamicState = &dynamicState;
              
-        if(vkCreateGraphicsPipelines(device.getDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS){
+        auto buildStart = std::chrono::steady_clock::now();
+        VkResult result = vkCreateGraphicsPipelines(device.getDevice(), device.getPipelineCache().getCache(), 1, &pipelineInfo, nullptr, &pipeline);
+        device.getPipelineCache().addBuildTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
+        vkDestroyShaderModule(device.getDevice(), vertShaderModule, nullptr); // not needed once the pipeline exists
+        vkDestroyShaderModule(device.getDevice(), fragShaderModule, nullptr);
+        if(result != VK_SUCCESS){
             throw std::runtime_error("Couldn't create pipeline !");
         }
-        device.nameObject((uint64_t)pipeline, VK_OBJECT_TYPE_PIPELINE, "Graphics Pipeline");
+        device.nameObject((uint64_t)pipeline, VK_OBJECT_TYPE_PIPELINE, name);
     }
     ~VulkanPipeline(){
         destroy();
     }
     void destroy() {
-        if (vertShaderModule != VK_NULL_HANDLE) {
-            vkDestroyShaderModule(pDevice.getDevice(), vertShaderModule, nullptr);
-            vertShaderModule = VK_NULL_HANDLE;
-        }
-        if (fragShaderModule != VK_NULL_HANDLE) {
-            vkDestroyShaderModule(pDevice.getDevice(), fragShaderModule, nullptr);
-            fragShaderModule = VK_NULL_HANDLE;
-        }
-        if (layout != VK_NULL_HANDLE) {
-            vkDestroyPipelineLayout(pDevice.getDevice(), layout, nullptr);
-            layout = VK_NULL_HANDLE;
-        }
         if (pipeline != VK_NULL_HANDLE) {
             vkDestroyPipeline(pDevice.getDevice(), pipeline, nullptr);
             pipeline = VK_NULL_HANDLE;
@@ -0,0 +1,192 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include "debug.hpp"
+
+#define PIPELINE_CACHE_MAGIC 0x43504C43 // "CLPC" read as a little endian uint32
+#define PIPELINE_CACHE_VERSION 1
+#define PIPELINE_CACHE_FILE "pipeline_cache.bin"
+
+// Pipeline cache file layout : header, then dataSize bytes from vkGetPipelineCacheData. The data
+// carries its own header with the device UUID but not the driver version, an updated driver may
+// reject or misread it, so both are checked before anything reaches the driver.
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+};
+
+// VkPipelineCache every pipeline of a device is created through. It is filled from path when the file
+// was written by the same device and driver, and written back to it on destroy. An empty path keeps
+// the cache in memory only.
+class VulkanPipelineCache {
+private:
+    VkDevice device;
+    VkPhysicalDeviceProperties properties;
+    std::string path;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    size_t loadedBytes = 0;        // of initial data accepted, 0 for a cold cache
+    mutable std::mutex statsMutex; // pipelines may be built on background threads
+    double buildMilliseconds = 0;  // spent in vkCreate*Pipelines
+    uint32_t pipelineCount = 0;
+
+    PipelineCacheFileHeader makeHeader(uint64_t dataSize) const{
+        PipelineCacheFileHeader header{};
+        header.magic = PIPELINE_CACHE_MAGIC;
+        header.version = PIPELINE_CACHE_VERSION;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.dataSize = dataSize;
+        return header;
+    }
+
+    // Data of the file at path if it matches this device and driver, empty otherwise
+    std::vector<char> readValidData() const{
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return {}; // first launch
+        size_t fileSize = (size_t)file.tellg();
+        file.seekg(0);
+
+        PipelineCacheFileHeader header{};
+        if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            Debug::LogWarning("Pipeline cache " + path + " is truncated, starting cold");
+            return {};
+        }
+        PipelineCacheFileHeader expected = makeHeader(fileSize - sizeof(header));
+        if (header.magic != expected.magic || header.version != expected.version) {
+            Debug::LogWarning("Pipeline cache " + path + " has an unknown format, starting cold");
+            return {};
+        }
+        if (header.vendorID != expected.vendorID || header.deviceID != expected.deviceID ||
+            header.driverVersion != expected.driverVersion ||
+            memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            Debug::Log("Pipeline cache " + path + " was written by another device or driver, starting cold");
+            return {};
+        }
+        if (header.dataSize != expected.dataSize || header.dataSize < sizeof(VkPipelineCacheHeaderVersionOne)) {
+            Debug::LogWarning("Pipeline cache " + path + " has a wrong size, starting cold");
+            return {};
+        }
+
+        std::vector<char> data(header.dataSize);
+        if (!file.read(data.data(), data.size()))
+            return {};
+        return data;
+    }
+
+public:
+    VulkanPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& path)
+        : device(device), properties(properties), path(path)
+    {
+        std::vector<char> data;
+        if (!path.empty())
+            data = readValidData();
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = data.size();
+        cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS) {
+            if (data.empty())
+                throw std::runtime_error("Couldn't create pipeline cache!");
+            // the driver refused the data after all, an empty cache still works
+            Debug::LogWarning("Pipeline cache " + path + " was rejected by the driver, starting cold");
+            data.clear();
+            cacheInfo.initialDataSize = 0;
+            cacheInfo.pInitialData = nullptr;
+            if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+                throw std::runtime_error("Couldn't create pipeline cache!");
+        }
+        loadedBytes = data.size();
+    }
+
+    VulkanPipelineCache(const VulkanPipelineCache&) = delete;
+    VulkanPipelineCache& operator=(const VulkanPipelineCache&) = delete;
+
+    ~VulkanPipelineCache(){
+        destroy();
+    }
+
+    // Writes the cache back to path first
+    void destroy(){
+        if (cache == VK_NULL_HANDLE)
+            return;
+        save();
+        vkDestroyPipelineCache(device, cache, nullptr);
+        cache = VK_NULL_HANDLE;
+    }
+
+    // Written to a temporary file then renamed, a crash never leaves a half written cache behind
+    void save() const{
+        if (path.empty() || cache == VK_NULL_HANDLE)
+            return;
+        size_t dataSize = 0;
+        if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+            return;
+        std::vector<char> data(dataSize);
+        if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS)
+            return;
+        data.resize(dataSize);
+
+        PipelineCacheFileHeader header = makeHeader(data.size());
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(data.data(), data.size());
+            if (!out.good()) {
+                Debug::LogWarning("Couldn't write pipeline cache " + tempPath);
+                return;
+            }
+        }
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+            Debug::LogWarning("Couldn't replace pipeline cache " + path);
+    }
+
+    VkPipelineCache getCache() const{
+        return cache;
+    }
+
+    // Pipelines report how long their creation took, startup cost with a cold or warm cache
+    void addBuildTime(double milliseconds){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        buildMilliseconds += milliseconds;
+        pipelineCount++;
+    }
+
+    double getBuildMilliseconds() const{
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return buildMilliseconds;
+    }
+
+    uint32_t getPipelineCount() const{
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return pipelineCount;
+    }
+
+    bool isWarm() const{
+        return loadedBytes > 0;
+    }
+
+    size_t getLoadedBytes() const{
+        return loadedBytes;
+    }
+
+    const std::string& getPath() const{
+        return path;
+    }
+};
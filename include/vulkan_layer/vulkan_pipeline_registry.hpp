@@ -0,0 +1,291 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <stdexcept>
+#include "debug.hpp"
+#include "profiler.hpp"
+#include "vulkan_device.hpp"
+#include "vulkan_pipeline.hpp"
+#include "vulkan_render_pass.hpp"
+
+#define SHADER_RELOAD_CHECK_INTERVAL 30 // frames between two checks of the shader files
+
+using PipelineHandle = uint64_t; // hash of the GraphicsPipelineState
+
+// Graphics pipeline variants sharing one layout, keyed by the hash of their state. The default variant
+// is built on construction and stands in for any variant still compiling, or that failed to. The others
+// are compiled on a thread of their own : job system workers would also be drained by the frame waiting
+// on its recording jobs, a compile picked up there is the very hitch this avoids.
+// Variants are compiled again when one of their .spv files changes, the previous pipeline keeps drawing
+// until the new one is ready and is destroyed once no frame in flight uses it.
+class VulkanPipelineRegistry {
+private:
+    struct Variant {
+        GraphicsPipelineState state;
+        std::unique_ptr<VulkanPipeline> pipeline; // null until the first compile succeeded
+        bool compiling = false;
+        bool stale = false; // a shader changed during the compile, it runs again once done
+    };
+
+    struct Compiled {
+        PipelineHandle handle;
+        std::unique_ptr<VulkanPipeline> pipeline; // null if the compile failed
+        std::string error;
+    };
+
+    VulkanDevice& device;
+    VulkanRenderPass& renderPass;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    PipelineHandle defaultHandle = 0;
+    std::unordered_map<PipelineHandle, Variant> variants;
+
+    // Compile thread, the queue and results are guarded by compileMutex
+    std::thread compileThread;
+    std::mutex compileMutex;
+    std::condition_variable compileCondition;
+    std::deque<std::pair<PipelineHandle, GraphicsPipelineState>> compileQueue;
+    std::vector<Compiled> compiled;
+    bool stopping = false;
+
+    // Replaced pipelines with the frame serial they were last used in
+    std::deque<std::pair<uint64_t, std::unique_ptr<VulkanPipeline>>> retired;
+
+    // the path is converted once, building one from the string on every check would allocate
+    struct WatchedShader {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+    };
+    std::unordered_map<std::string, WatchedShader> shaderTimes;
+    uint64_t framesSinceCheck = 0;
+
+    std::unique_ptr<VulkanPipeline> build(const GraphicsPipelineState& state, PipelineHandle handle){
+        return std::make_unique<VulkanPipeline>(device, renderPass, layout, state,
+                                                "Graphics Pipeline " + std::to_string(handle));
+    }
+
+    void queueCompile(PipelineHandle handle, Variant& variant){
+        variant.compiling = true;
+        {
+            std::lock_guard<std::mutex> lock(compileMutex);
+            compileQueue.push_back({handle, variant.state});
+        }
+        compileCondition.notify_one();
+    }
+
+    void compileLoop(){
+        CRUMBS_PROFILE_THREAD("Pipeline Compile");
+        while (true) {
+            std::pair<PipelineHandle, GraphicsPipelineState> job;
+            {
+                std::unique_lock<std::mutex> lock(compileMutex);
+                compileCondition.wait(lock, [&]{ return stopping || !compileQueue.empty(); });
+                if (stopping)
+                    return;
+                job = std::move(compileQueue.front());
+                compileQueue.pop_front();
+            }
+
+            Compiled result{job.first, nullptr, ""};
+            try {
+                CRUMBS_PROFILE_SCOPE("Compile Pipeline");
+                result.pipeline = build(job.second, job.first);
+            }
+            catch (const std::exception& e) {
+                result.error = e.what();
+            }
+            std::lock_guard<std::mutex> lock(compileMutex);
+            compiled.push_back(std::move(result));
+        }
+    }
+
+    static std::filesystem::file_time_type lastWriteTime(const std::filesystem::path& path){
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(path, error);
+        return error ? std::filesystem::file_time_type::min() : time;
+    }
+
+    void watchShaders(const GraphicsPipelineState& state){
+        for (const std::string* path : {&state.vertPath, &state.fragPath}) {
+            if (shaderTimes.find(*path) == shaderTimes.end()) {
+                std::filesystem::path shaderPath(*path);
+                shaderTimes[*path] = {shaderPath, lastWriteTime(shaderPath)};
+            }
+        }
+    }
+
+    // Moves finished compiles into their variants, the pipelines they replace are retired at frameSerial
+    void collectCompiled(uint64_t frameSerial){
+        std::vector<Compiled> done;
+        {
+            std::lock_guard<std::mutex> lock(compileMutex);
+            done.swap(compiled);
+        }
+        for (Compiled& result : done) {
+            Variant& variant = variants.at(result.handle);
+            variant.compiling = false;
+            if (result.pipeline) {
+                if (variant.pipeline)
+                    retired.push_back({frameSerial, std::move(variant.pipeline)});
+                variant.pipeline = std::move(result.pipeline);
+                Debug::Log("Pipeline " + std::to_string(result.handle) + " ready (" + variant.state.vertPath + ", " + variant.state.fragPath + ")");
+            }
+            else {
+                Debug::LogError("Pipeline " + std::to_string(result.handle) + " failed to compile, " +
+                                (variant.pipeline ? "keeping the previous one" : "drawing with the default one") + " : " + result.error);
+            }
+            if (variant.stale) {
+                variant.stale = false;
+                queueCompile(result.handle, variant);
+            }
+        }
+    }
+
+    // Compiles again every variant reading a shader file written since the last check
+    void reloadChangedShaders(){
+        std::vector<std::string> changed;
+        for (auto& [path, watched] : shaderTimes) {
+            auto current = lastWriteTime(watched.path);
+            if (current != watched.time) {
+                watched.time = current;
+                changed.push_back(path);
+            }
+        }
+        if (changed.empty())
+            return;
+
+        for (auto& [handle, variant] : variants) {
+            bool usesChanged = false;
+            for (const std::string& path : changed) {
+                usesChanged |= variant.state.vertPath == path || variant.state.fragPath == path;
+            }
+            if (!usesChanged)
+                continue;
+            if (variant.compiling)
+                variant.stale = true;
+            else
+                queueCompile(handle, variant);
+        }
+        for (const std::string& path : changed) {
+            Debug::Log("Shader " + path + " changed, reloading");
+        }
+    }
+
+public:
+    // The default variant is compiled right away and must succeed. descLayouts are the sets every
+    // variant reads.
+    VulkanPipelineRegistry(VulkanDevice& device, VulkanRenderPass& renderPass,
+                           const std::vector<VkDescriptorSetLayout>& descLayouts, const GraphicsPipelineState& defaultState)
+        : device(device), renderPass(renderPass)
+    {
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = descLayouts.size();
+        pipelineLayoutInfo.pSetLayouts = descLayouts.data();
+        if (vkCreatePipelineLayout(device.getDevice(), &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+            throw std::runtime_error("Couldn't create graphics pipeline layout !");
+        device.nameObject((uint64_t)layout, VK_OBJECT_TYPE_PIPELINE_LAYOUT, "Graphics Pipeline Layout");
+
+        defaultHandle = defaultState.hash();
+        Variant& variant = variants[defaultHandle];
+        variant.state = defaultState;
+        try {
+            variant.pipeline = build(defaultState, defaultHandle);
+        }
+        catch (...) {
+            vkDestroyPipelineLayout(device.getDevice(), layout, nullptr);
+            layout = VK_NULL_HANDLE;
+            throw;
+        }
+        watchShaders(defaultState);
+        compileThread = std::thread(&VulkanPipelineRegistry::compileLoop, this);
+    }
+
+    ~VulkanPipelineRegistry(){
+        destroy();
+    }
+
+    // Abandons queued compiles, waits for the running one. The GPU must be done with every pipeline.
+    void destroy(){
+        if (layout == VK_NULL_HANDLE)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(compileMutex);
+            stopping = true;
+        }
+        compileCondition.notify_all();
+        if (compileThread.joinable())
+            compileThread.join();
+        compiled.clear();
+        compileQueue.clear();
+        retired.clear();
+        variants.clear();
+        vkDestroyPipelineLayout(device.getDevice(), layout, nullptr);
+        layout = VK_NULL_HANDLE;
+    }
+
+    // Handle of the variant for state, its compile is queued the first time it is asked for
+    PipelineHandle request(const GraphicsPipelineState& state){
+        PipelineHandle handle = state.hash();
+        auto it = variants.find(handle);
+        if (it != variants.end()) {
+            if (!(it->second.state == state))
+                throw std::runtime_error("Pipeline state hash collision!");
+            return handle;
+        }
+        Variant& variant = variants[handle];
+        variant.state = state;
+        watchShaders(state);
+        queueCompile(handle, variant);
+        return handle;
+    }
+
+    // Once per frame, after the fence of the frame is waited on. frameSerial counts the frames submitted
+    // so far, pipelines replaced more than framesInFlight frames ago are destroyed.
+    void update(uint64_t frameSerial, uint32_t framesInFlight){
+        collectCompiled(frameSerial);
+        while (!retired.empty() && retired.front().first + framesInFlight <= frameSerial) {
+            retired.pop_front();
+        }
+        if (++framesSinceCheck >= SHADER_RELOAD_CHECK_INTERVAL) {
+            framesSinceCheck = 0;
+            reloadChangedShaders();
+        }
+    }
+
+    // Pipeline to draw handle with this frame, the default one until it is ready
+    VulkanPipeline& resolve(PipelineHandle handle){
+        auto it = variants.find(handle);
+        if (it != variants.end() && it->second.pipeline)
+            return *it->second.pipeline;
+        return *variants.at(defaultHandle).pipeline;
+    }
+
+    bool isReady(PipelineHandle handle) const{
+        auto it = variants.find(handle);
+        return it != variants.end() && it->second.pipeline != nullptr;
+    }
+
+    PipelineHandle getDefaultHandle() const{
+        return defaultHandle;
+    }
+
+    const GraphicsPipelineState& getDefaultState() const{
+        return variants.at(defaultHandle).state;
+    }
+
+    VkPipelineLayout getLayout() const{
+        return layout;
+    }
+
+    uint32_t getVariantCount() const{
+        return variants.size();
+    }
+};
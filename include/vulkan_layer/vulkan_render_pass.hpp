@@ -23,7 +23,8 @@ public:
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // ready for presentation
+        colorAttachment.finalLayout = swapchain.isHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL  // ready for readback
+                                                             : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;       // ready for presentation
         colorAttachment.flags = 0;
         
         VkAttachmentReference colorAttachmentRef{};
@@ -60,6 +61,32 @@ public:
         renderPassInfo.subpassCount = 1;
         renderPassInfo.pSubpasses = &subpass;
 
+        // Frames in flight share the depth image, the clear of a frame waits for the depth writes of the
+        // one before. Also orders the color layout transition after the acquire semaphore wait, which is
+        // at the color output stage.
+        VkSubpassDependency frameDependency{};
+        frameDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        frameDependency.dstSubpass = 0;
+        frameDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                       VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        frameDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        frameDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                       VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        frameDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        // Headless frames are read back with a transfer, make the color writes visible to it
+        VkSubpassDependency readbackDependency{};
+        readbackDependency.srcSubpass = 0;
+        readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+        readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        std::array<VkSubpassDependency, 2> dependencies = { frameDependency, readbackDependency };
+        renderPassInfo.dependencyCount = swapchain.isHeadless() ? 2 : 1;
+        renderPassInfo.pDependencies = dependencies.data();
+
         if (vkCreateRenderPass(device.getDevice(), &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create render pass!");
         }
@@ -2,195 +2,1136 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <deque>
 #include <glm/gtc/matrix_transform.hpp>
 #include "vulkan_wrappers.hpp"
 #include "vertex.hpp"
 #include "ubo.hpp"
 #include "scene_ubo.hpp"
 #include "mesh.hpp"
+#include "model.hpp"
 #include "mesh_draw_info.hpp"
+#include "job_system.hpp"
+#include "mesh_cache.hpp"
+#include "cull_params.hpp"
+#include "meshlet_builder.hpp"
+#include "frame_limiter.hpp"
+#include "profiler.hpp"
 
 #define MAX_VERTEX_NUMBER 100000
 #define MAX_INDEX_NUMBER 100000
-#define MAX_OBJECTS_UB 100000
+#define VERTEX_BUFFER_SIZE (MAX_VERTEX_NUMBER * sizeof(Vertex)) // bytes per geometry page, compact vertex formats fit more vertices
+#define MAX_OBJECTS 100000
+#define MAX_MESHES 4096
 #define MAX_SCENE_DATA 1
+#define MAX_MESHLETS 65536         // of every loaded mesh
+#define MAX_MESHLET_COMMANDS 65536 // indirect commands of meshlet draws in one frame
+#define MAX_MESHLET_DRAWS 4096     // draw calls culled per meshlet in one frame, the next ones per object
+#define LOD_ERROR_THRESHOLD 1.0f // pixels a level may deviate from the full mesh on screen
 class VulkanRenderer {
 private:
     // Shader paths
     std::string vertShaderPath = "./shaders/test.vert.spv";
     std::string fragShaderPath = "./shaders/test.frag.spv";
+    std::string cullShaderPath = "./shaders/cull.comp.spv";
+    std::string meshletCullShaderPath = "./shaders/meshlet_cull.comp.spv";
 
     // Window info
     GLFWwindow* window;
     uint32_t width;
     uint32_t height;
+    uint32_t framesInFlight;
+    VertexFormat vertexFormat;
+
+    // Engine worker threads, the renderer records its large draw lists with them
+    JobSystem jobSystem;
 
     // Core Vulkan objects
     VulkanInstance instance;
     VulkanDevice device;
+    VulkanAllocator allocator;
     VulkanSwapchain swapchain;
     VulkanRenderPass renderPass;
 
     // Vertex/index buffers
-    VkDeviceSize vertexSize = sizeof(Vertex);
+    VkDeviceSize vertexSize; // stride of vertexFormat
     VkDeviceSize indexSize = sizeof(uint32_t);
 
-    VulkanBuffer vertexBuffer;
-    VulkanBuffer indexBuffer;
+    VulkanGeometryPool geometry;
+    VulkanStagingRing stagingRing;
 
-    // Uniform buffers
-    VkDeviceSize uboSize = sizeof(UniformBufferObject);
+    // Uniform and storage buffers
     VkDeviceSize alignment;
-    VkDeviceSize uboAlignedSize;
+    VkDeviceSize storageAlignment;
+    VkDeviceSize objectsFrameSize;   // one slice of objectsSB per frame in flight
+    VkDeviceSize instancesFrameSize; // one slice of instanceIndicesSB per frame in flight
+    VkDeviceSize indirectFrameSize;  // one slice of indirectBuffer per frame in flight
+    VkDeviceSize sceneFrameSize;     // one slice of sceneDataUB per frame in flight
+    VkDeviceSize cullFrameSize;      // one slice of objectCullSB per frame in flight
+    VkDeviceSize meshletDrawFrameSize; // one slice of meshletDrawSB per frame in flight
 
-    VulkanBuffer objectsUB;
+    VulkanBuffer objectsSB;          // transforms in submission order
+    VulkanBuffer instanceIndicesSB;  // draw indices grouped by mesh, read with gl_InstanceIndex
     VulkanBuffer sceneDataUB;
+    VulkanBuffer indirectBuffer;     // draw count + one VkDrawIndexedIndirectCommand per drawn mesh
+    VulkanBuffer objectCullSB;       // (mesh, indirect command slot) of every draw call, read by the cull pass and compact vertex shaders
+    VulkanBuffer meshBoundsSB;       // one MeshBounds per loaded mesh
+    VulkanBuffer meshQuantizationSB; // one MeshQuantization per loaded mesh
+    VulkanBuffer meshletSB;          // MeshletBounds of every mesh split into meshlets, ranges from meshletSpace
+    VulkanBuffer meshletDrawSB;      // MeshletDraw of every draw call culled per meshlet
+    VulkanDrawPath drawPath;
+    uint32_t drawCount = 0;
 
-    VulkanDescriptor objectsUBDescriptor;
+    VulkanDescriptor objectsDescriptor;
     VulkanDescriptor sceneDataUBDescriptor;
+    VulkanDescriptor cullDescriptor;
 
-    // Pipeline and framebuffers
-    VulkanPipeline graphicsPipeline;
+    // Pipelines and framebuffers
+    VulkanPipelineRegistry pipelines;
+    PipelineHandle activePipeline; // drawn with once compiled, the default variant until then
+    VulkanComputePipeline cullPipeline;
+    VulkanComputePipeline meshletCullPipeline;
     VulkanFramebuffers framebuffers;
 
     // Command buffers
     VulkanCommandBuffers commandBuffers;
+    std::unique_ptr<VulkanSecondaryRecorder> recorder; // per thread secondary buffers for large draw lists
+    std::vector<VkDrawIndexedIndirectCommand> syntheticCommands; // recordSyntheticDraws only
+    VulkanGpuProfiler gpuProfiler; // per pass GPU times and pipeline statistics, off until enabled
 
-    // Synchronization
-    VulkanSyncObjects syncObjects;
+    // Per frame in flight command buffer, sync objects and uniform slices
+    std::vector<std::unique_ptr<VulkanFrameContext>> frames;
     std::vector<VkPipelineStageFlags> waitStages{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
     // Scene / draw data
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
     std::vector<MeshDrawInfo> meshPool;
+    std::vector<MeshBounds> meshBounds;
+    std::vector<bool> meshLoaded;          // false once unloadMesh was called, the slot may still be in use
+    std::vector<uint32_t> meshGeometry;    // geometry block of every mesh
+    std::vector<uint32_t> freeMeshSlots;   // released slots, reused by the next loads
     std::vector<uint32_t> drawCallMeshIndices;
 
+    // Simplified levels of a mesh, each registered as a mesh of its own sharing the bounds and vertices
+    struct LodLevel {
+        uint32_t mesh;
+        float error; // model units
+    };
+    std::vector<std::vector<LodLevel>> meshLods; // per mesh, finest first
+    float lodThreshold = LOD_ERROR_THRESHOLD;
+    LodStats lodStats{};      // frame being built
+    LodStats lastLodStats{};  // last frame drawn
+
+    // Frame pacing
+    FrameLimiter frameLimiter;
+    uint32_t maxQueuedFrames; // submitted frames the GPU may still be working on when a frame starts
+    FramePacingStats pacingStats{};     // frame being built
+    FramePacingStats lastPacingStats{}; // last frame drawn
+    std::chrono::steady_clock::time_point frameWorkStart;
+
+    // Pool allocations, shared by the submeshes of a model and freed with the last of them
+    struct GeometryBlock {
+        GeometryAllocation allocation;
+        uint32_t meshCount;
+    };
+    std::vector<GeometryBlock> geometryBlocks;
+    std::vector<uint32_t> freeGeometryBlocks;
+
+    // Meshes unloaded while frame serial was being built, released once that frame is done on the GPU
+    std::deque<std::pair<uint64_t, uint32_t>> pendingUnloads;
+    uint64_t frameSerial = 0; // frames submitted so far
+    std::vector<GeometryDrawRange> drawRanges; // indirect commands of every geometry page this frame
+    // per mesh, rebuilt every frame by groupInstances, sized at loadMesh
+    std::vector<uint32_t> meshInstanceCounts;
+    std::vector<uint32_t> meshInstanceCursors;
+    std::vector<uint32_t> meshDrawSlots; // indirect command of each mesh this frame
+
+    // Meshlets of the large meshes, culled on the GPU along with the objects
+    struct MeshletRange {
+        FreeListAllocator::Range range; // in meshletSB entries
+        uint32_t count;
+    };
+    std::vector<MeshletRange> meshMeshlets; // per mesh, count 0 if not split
+    FreeListAllocator meshletSpace{MAX_MESHLETS};
+    std::vector<uint32_t> meshMeshletCommands; // next meshlet command of every mesh this frame, MESHLET_DRAW if drawn as a whole
+    uint32_t meshletDrawCount = 0;
+    bool meshletCullingEnabled = true;
+
     SceneUBO sceneData;
-    std::vector<UniformBufferObject> ubos;
+    CullParams cullParams{};
+    bool cullingEnabled;     // the cull pass fills instance counts and indices on the GPU
 
     int currentFrame = 0;
+    bool frameStarted = false; // currentFrame fence waited on, its uniform slices are writable
+    uint32_t lastImageIndex = 0;
+
+    // Host visible copy target for readFrame, created on first use
+    std::unique_ptr<VulkanBuffer> readbackBuffer;
+
+    // Swapchain recreation, width and height are the size asked for
+    bool swapchainDirty = false; // out of date, suboptimal or resized, recreated at the next drawFrame
+    float lastResizeMilliseconds = 0.0f;
+    uint32_t resizeCount = 0;
+
+    // Waits until the GPU is done with the resources of currentFrame so draw calls can be written
+    // straight into its slice of objectsSB
+    VulkanFrameContext& beginFrame(){
+        VulkanFrameContext& frame = *frames[currentFrame];
+        if(!frameStarted){
+            CRUMBS_PROFILE_FRAME();
+            {
+                CRUMBS_PROFILE_SCOPE("Frame Limiter");
+                pacingStats.limiterWaitMs = frameLimiter.wait();
+            }
+            auto waitStart = std::chrono::steady_clock::now();
+            {
+                CRUMBS_PROFILE_SCOPE("vkWaitForFences");
+                // fewer queued frames than in flight : the CPU also waits for the later submissions and
+                // builds the frame just in time instead of running ahead of the GPU
+                if(maxQueuedFrames < framesInFlight){
+                    frames[(currentFrame + framesInFlight - maxQueuedFrames) % framesInFlight]->wait();
+                }
+                frame.wait();
+            }
+            frameWorkStart = std::chrono::steady_clock::now();
+            pacingStats.gpuWaitMs = std::chrono::duration<float, std::milli>(frameWorkStart - waitStart).count();
+            frameStarted = true;
+            releaseUnloadedMeshes();
+        }
+        return frame;
+    }
+
+    // Waits for the GPU then rebuilds the swapchain, its depth image and the framebuffers at the asked
+    // size. Pipelines, descriptors and buffers don't depend on the extent and are kept. False while the
+    // surface has no area, swapchainDirty stays set and the next frame tries again.
+    bool recreateSwapchain(){
+        CRUMBS_PROFILE_FUNCTION();
+        auto startTime = std::chrono::steady_clock::now();
+        vkDeviceWaitIdle(device.getDevice());
+        framebuffers.destroy();
+        if(!swapchain.recreate(width, height)){
+            return false;
+        }
+        framebuffers.create();
+        readbackBuffer.reset(); // sized for the previous extent
+        width = swapchain.getExtent().width;
+        height = swapchain.getExtent().height;
+        updateProjection();
+        swapchainDirty = false;
+
+        lastResizeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        resizeCount++;
+        Debug::Log("Swapchain recreated at " + std::to_string(width) + "x" + std::to_string(height) + " in " + std::to_string(lastResizeMilliseconds) + "ms");
+        return true;
+    }
+
+    // The draw calls of a frame that can't be drawn are discarded, its fence is left signaled
+    void dropFrame(){
+        drawCallMeshIndices.clear();
+        lodStats = {};
+    }
+
+    void updateProjection(){
+        sceneData.proj = glm::perspective(glm::radians(45.0f),
+                                          swapchain.getExtent().width / (float)swapchain.getExtent().height,
+                                          0.1f, 100.0f);
+        sceneData.proj[1][1] *= -1;
+    }
+
+    // Frees the geometry and slots of unloaded meshes no frame in flight can draw anymore
+    void releaseUnloadedMeshes(){
+        while (!pendingUnloads.empty() && pendingUnloads.front().first + framesInFlight <= frameSerial) {
+            uint32_t meshIndex = pendingUnloads.front().second;
+            pendingUnloads.pop_front();
+
+            GeometryBlock& block = geometryBlocks[meshGeometry[meshIndex]];
+            if (--block.meshCount == 0) {
+                geometry.free(block.allocation);
+                freeGeometryBlocks.push_back(meshGeometry[meshIndex]);
+            }
+            meshPool[meshIndex] = {};
+            meshLods[meshIndex].clear();
+            if (meshMeshlets[meshIndex].count > 0)
+                meshletSpace.free(meshMeshlets[meshIndex].range);
+            meshMeshlets[meshIndex] = {};
+            freeMeshSlots.push_back(meshIndex);
+        }
+    }
+
+    // Throws unless meshCount more meshes fit
+    void reserveMeshSlots(size_t meshCount) const{
+        if(meshPool.size() + meshCount > MAX_MESHES + freeMeshSlots.size()){
+            throw std::runtime_error("Too many meshes loaded!");
+        }
+    }
+
+    uint32_t addGeometryBlock(const GeometryAllocation& allocation, uint32_t meshCount){
+        if (freeGeometryBlocks.empty()) {
+            geometryBlocks.push_back({allocation, meshCount});
+            return geometryBlocks.size() - 1;
+        }
+        uint32_t block = freeGeometryBlocks.back();
+        freeGeometryBlocks.pop_back();
+        geometryBlocks[block] = {allocation, meshCount};
+        return block;
+    }
+
+    // Registers geometry already queued for upload as a mesh, returns its index
+    uint32_t addMesh(uint32_t page, uint32_t vertexOffset, uint32_t indexOffset, uint32_t indexCount, const MeshBounds& bounds,
+                     const MeshQuantization& quantization, uint32_t block){
+        uint32_t meshIndex = meshPool.size();
+        if (!freeMeshSlots.empty()) {
+            meshIndex = freeMeshSlots.back();
+            freeMeshSlots.pop_back();
+        }
+        else {
+            meshPool.emplace_back();
+            meshBounds.emplace_back();
+            meshLoaded.push_back(false);
+            meshGeometry.push_back(0);
+            meshLods.emplace_back();
+            meshMeshlets.emplace_back();
+            meshMeshletCommands.push_back(MESHLET_DRAW);
+            meshInstanceCounts.resize(meshPool.size());
+            meshInstanceCursors.resize(meshPool.size());
+            meshDrawSlots.resize(meshPool.size());
+        }
+
+        // read by frames still in flight only for meshes they already knew, the slot is new or was released
+        // once no frame could draw its previous mesh
+        meshBoundsSB.write(bounds, meshIndex * sizeof(MeshBounds));
+        meshBoundsSB.flush(meshIndex * sizeof(MeshBounds), sizeof(MeshBounds));
+        meshQuantizationSB.write(quantization, meshIndex * sizeof(MeshQuantization));
+        meshQuantizationSB.flush(meshIndex * sizeof(MeshQuantization), sizeof(MeshQuantization));
+
+        meshBounds[meshIndex] = bounds;
+        meshPool[meshIndex] = {vertexOffset, indexOffset, indexCount, page};
+        meshLoaded[meshIndex] = true;
+        meshGeometry[meshIndex] = block;
+        return meshIndex;
+    }
+
+    // Bounding sphere around the AABB center, not minimal but cheap and stable
+    static MeshBounds computeBounds(const Vertex* vertices, uint32_t vertexCount){
+        glm::vec3 minPos(0.0f), maxPos(0.0f);
+        if (vertexCount > 0) {
+            minPos = maxPos = vertices[0].pos;
+        }
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            minPos = glm::min(minPos, vertices[v].pos);
+            maxPos = glm::max(maxPos, vertices[v].pos);
+        }
+        MeshBounds bounds{(minPos + maxPos) * 0.5f, 0.0f};
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            bounds.radius = std::max(bounds.radius, glm::length(vertices[v].pos - bounds.center));
+        }
+        return bounds;
+    }
+
+    // Stores the meshlets of meshIndex in meshletSB. Meshes whose meshlets don't fit anymore, and every
+    // mesh on the direct path which can't cull on the GPU, are culled as a whole.
+    void addMeshlets(uint32_t meshIndex, const Meshlet* meshlets, uint32_t meshletCount){
+        FreeListAllocator::Range range;
+        if (meshletCount == 0 || drawPath == VulkanDrawPath::Direct || !meshletSpace.allocate(meshletCount, 1, range))
+            return;
+        std::vector<MeshletBounds> bounds(meshletCount);
+        for (uint32_t m = 0; m < meshletCount; ++m) {
+            const Meshlet& meshlet = meshlets[m];
+            bounds[m] = {glm::vec4(meshlet.center, meshlet.radius), glm::vec4(meshlet.coneAxis, meshlet.coneCutoff),
+                         meshlet.firstIndex, meshlet.triangleCount * 3, {0, 0}};
+        }
+        // a new range, no frame in flight reads it
+        meshletSB.update(bounds.data(), bounds.size() * sizeof(MeshletBounds), range.offset * sizeof(MeshletBounds));
+        meshMeshlets[meshIndex] = {range, meshletCount};
+    }
+
+    // Registers the levels of baseMesh, their indices already queued at lodIndexOffset of the base mesh page
+    void addLods(uint32_t baseMesh, uint32_t lodIndexOffset, const MeshLod* lods, uint32_t lodCount,
+                 const MeshQuantization& quantization){
+        MeshDrawInfo base = meshPool[baseMesh]; // addMesh may grow meshPool
+        MeshBounds bounds = meshBounds[baseMesh];
+        uint32_t block = meshGeometry[baseMesh];
+        for (uint32_t l = 0; l < lodCount; ++l) {
+            uint32_t lodMesh = addMesh(base.page, base.vertexOffset, lodIndexOffset + lods[l].firstIndex, lods[l].indexCount,
+                                       bounds, quantization, block);
+            meshLods[baseMesh].push_back({lodMesh, lods[l].error});
+        }
+    }
+
+    static uint32_t lodIndexCount(const MeshLod* lods, uint32_t lodCount){
+        uint32_t count = 0;
+        for (uint32_t l = 0; l < lodCount; ++l) {
+            count = std::max(count, lods[l].firstIndex + lods[l].indexCount);
+        }
+        return count;
+    }
 
-    std::vector<uint8_t> padData(std::vector<UniformBufferObject> ubos, VkDeviceSize alignedSize){
-        std::vector<uint8_t> paddedData(alignedSize * ubos.size(), 0); // zero-initialized
+    // Coarsest level of meshIndex whose error stays within lodThreshold pixels once transform places it,
+    // measured at the point of its bounding sphere closest to the camera
+    uint32_t selectLod(uint32_t meshIndex, const glm::mat4& transform) const{
+        const std::vector<LodLevel>& levels = meshLods[meshIndex];
+        if (levels.empty() || lodThreshold <= 0.0f)
+            return meshIndex;
+        const MeshBounds& bounds = meshBounds[meshIndex];
+        float scale = std::sqrt(std::max({glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+                                          glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+                                          glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))}));
+        glm::vec3 center = glm::vec3(sceneData.view * transform * glm::vec4(bounds.center, 1.0f));
+        float distance = glm::length(center) - bounds.radius * scale;
+        if (distance <= 0.0f)
+            return meshIndex; // camera inside the bounds
+
+        // proj[1][1] is the cotangent of half the vertical field of view, negated for Vulkan
+        float pixelsPerUnit = std::abs(sceneData.proj[1][1]) * swapchain.getExtent().height * 0.5f * scale / distance;
+        uint32_t selected = meshIndex;
+        for (const LodLevel& level : levels) {
+            if (level.error * pixelsPerUnit > lodThreshold)
+                break;
+            selected = level.mesh;
+        }
+        return selected;
+    }
+
+    // Converts the vertices of one mesh to vertexFormat into out, count * vertexSize bytes. Returns the
+    // quantization the vertex shader undoes.
+    MeshQuantization encodeVertices(const Vertex* vertices, uint32_t count, uint8_t* out) const{
+        MeshQuantization quantization = Vertex::computeQuantization(vertices, count, vertexFormat);
+        Vertex::encode(vertices, count, vertexFormat, quantization, out);
+        return quantization;
+    }
+
+    GraphicsPipelineState defaultPipelineState() const{
+        GraphicsPipelineState state;
+        state.vertPath = vertShaderPath;
+        state.fragPath = fragShaderPath;
+        state.vertexFormat = vertexFormat;
+        return state;
+    }
+
+    static std::string vertexShaderPathFor(VertexFormat format){
+        switch (format) {
+            case VertexFormat::Compact:      return "./shaders/compact.vert.spv";
+            case VertexFormat::CompactColor: return "./shaders/compact_color.vert.spv";
+            default:                         return "./shaders/test.vert.spv";
+        }
+    }
 
-        for (size_t i = 0; i < ubos.size(); ++i) {
-            std::memcpy(paddedData.data() + i * alignedSize, &ubos[i], sizeof(UniformBufferObject));
+    // Imported meshes are white
+    static void appendVertices(const Mesh& mesh, std::vector<Vertex>& vertices){
+        const auto& meshVertices = mesh.getVertices();
+        const auto& meshNormals  = mesh.getNormals();
+        vertices.reserve(vertices.size() + meshVertices.size());
+        for (size_t i = 0; i < meshVertices.size(); ++i){
+            vertices.push_back({meshVertices[i], {1.0f,1.0f,1.0f}, meshNormals[i]});
         }
-        return paddedData;
+    }
+
+    // Counting sort of the frame draw calls by mesh : every mesh gets one contiguous run of
+    // instance indices and one indirect command drawing that run as instances. With culling the
+    // commands start empty and the cull pass appends the visible instances to them. Meshes split
+    // into meshlets instead get one command per meshlet and draw call, written by the meshlet cull
+    // pass, as long as they fit in the frame meshlet budget.
+    void groupInstances(VulkanFrameContext& frame){
+        CRUMBS_PROFILE_FUNCTION();
+        std::fill(meshInstanceCounts.begin(), meshInstanceCounts.end(), 0);
+        for (uint32_t meshIndex : drawCallMeshIndices) {
+            meshInstanceCounts[meshIndex]++;
+        }
+
+        // commands are grouped by geometry page, each group drawn with the buffers of its page bound
+        auto* commands = indirectBuffer.data<VkDrawIndexedIndirectCommand>(frame.indirectOffset + INDIRECT_COMMANDS_OFFSET);
+        uint32_t first = 0;
+        uint32_t meshletCommands = 0;
+        uint32_t meshletDraws = 0;
+        drawCount = 0;
+        drawRanges.clear();
+        // reset once, every page only sets the meshes it owns
+        std::fill(meshMeshletCommands.begin(), meshMeshletCommands.end(), MESHLET_DRAW);
+        for (uint32_t page = 0; page < geometry.getPageCount(); ++page) {
+            uint32_t pageFirst = drawCount;
+            for (size_t m = 0; m < meshPool.size(); ++m) {
+                const MeshDrawInfo& drawInfo = meshPool[m];
+                if (meshInstanceCounts[m] == 0 || drawInfo.page != page)
+                    continue;
+                meshInstanceCursors[m] = first;
+                first += meshInstanceCounts[m];
+
+                uint32_t meshletCount = meshMeshlets[m].count * meshInstanceCounts[m];
+                if (cullingEnabled && meshletCullingEnabled && meshMeshlets[m].count > 0 &&
+                    meshletCommands + meshletCount <= MAX_MESHLET_COMMANDS && meshletDraws + meshInstanceCounts[m] <= MAX_MESHLET_DRAWS) {
+                    // commands left to the meshlet cull pass
+                    meshMeshletCommands[m] = drawCount;
+                    meshDrawSlots[m] = MESHLET_DRAW;
+                    drawCount += meshletCount;
+                    meshletCommands += meshletCount;
+                    meshletDraws += meshInstanceCounts[m];
+                    continue;
+                }
+                uint32_t instanceCount = cullingEnabled ? 0 : meshInstanceCounts[m];
+                meshDrawSlots[m] = drawCount;
+                commands[drawCount++] = {drawInfo.indexCount, instanceCount, drawInfo.indexOffset, (int32_t)drawInfo.vertexOffset,
+                                         meshInstanceCursors[m]};
+            }
+            if (drawCount > pageFirst)
+                drawRanges.push_back({page, pageFirst, drawCount - pageFirst});
+        }
+        indirectBuffer.write(drawCount, frame.indirectOffset);
+        indirectBuffer.flush(frame.indirectOffset, INDIRECT_COMMANDS_OFFSET + drawCount * sizeof(VkDrawIndexedIndirectCommand));
+
+        // the compact vertex shaders find the quantization of their mesh through it, filled even without culling
+        uint32_t* cullInputs = objectCullSB.data<uint32_t>(frame.cullOffset);
+        for (uint32_t j = 0; j < drawCallMeshIndices.size(); ++j) {
+            cullInputs[2 * j] = drawCallMeshIndices[j];
+            cullInputs[2 * j + 1] = meshDrawSlots[drawCallMeshIndices[j]];
+        }
+        objectCullSB.flush(frame.cullOffset, drawCallMeshIndices.size() * 2 * sizeof(uint32_t));
+
+        // meshlet draws have a fixed instance each, the cull pass only decides which meshlets draw it
+        uint32_t* instanceIndices = instanceIndicesSB.data<uint32_t>(frame.instancesOffset);
+        MeshletDraw* meshletDrawInputs = meshletDrawSB.data<MeshletDraw>(frame.meshletDrawOffset);
+        meshletDrawCount = 0;
+        for (uint32_t j = 0; j < drawCallMeshIndices.size(); ++j) {
+            uint32_t m = drawCallMeshIndices[j];
+            if (cullingEnabled && meshMeshletCommands[m] == MESHLET_DRAW)
+                continue;
+            uint32_t slot = meshInstanceCursors[m]++;
+            instanceIndices[slot] = j;
+            if (meshMeshletCommands[m] == MESHLET_DRAW)
+                continue;
+            const MeshDrawInfo& drawInfo = meshPool[m];
+            meshletDrawInputs[meshletDrawCount++] = {j, slot, meshMeshlets[m].range.offset, meshMeshlets[m].count, meshMeshletCommands[m],
+                                                     drawInfo.indexOffset, (int32_t)drawInfo.vertexOffset, 0};
+            meshMeshletCommands[m] += meshMeshlets[m].count;
+        }
+        meshletDrawSB.flush(frame.meshletDrawOffset, meshletDrawCount * sizeof(MeshletDraw));
+        instanceIndicesSB.flush(frame.instancesOffset, drawCallMeshIndices.size() * sizeof(uint32_t));
+    }
+
+    VulkanDrawPath chooseDrawPath() const{
+        const VkPhysicalDeviceFeatures& features = device.getEnabledFeatures();
+        if (!features.drawIndirectFirstInstance)
+            return VulkanDrawPath::Direct;
+        if (device.supportsDrawIndirectCount())
+            return VulkanDrawPath::IndirectCount;
+        if (features.multiDrawIndirect)
+            return VulkanDrawPath::MultiDrawIndirect;
+        return VulkanDrawPath::Indirect;
+    }
+
+    // Gribb-Hartmann planes of proj * view, normals point inside and are normalized so the cull
+    // shader can compare distances against sphere radii. Vulkan clip space depth is [0, w].
+    void updateCullParams(){
+        glm::mat4 m = sceneData.proj * sceneData.view;
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        glm::vec4 planes[6] = {row3 + row0, row3 - row0, row3 + row1, row3 - row1, row2, row3 - row2};
+        for (int p = 0; p < 6; ++p) {
+            cullParams.frustumPlanes[p] = planes[p] / glm::length(glm::vec3(planes[p]));
+        }
+        cullParams.cameraPosition = glm::inverse(sceneData.view)[3];
+        cullParams.objectCount = drawCallMeshIndices.size();
+        cullParams.meshletDrawCount = meshletDrawCount;
     }
 public:
-    VulkanRenderer(GLFWwindow* _window, uint32_t _width, uint32_t _height)
-        : window(_window), width(_width), height(_height),
+    VulkanRenderer(GLFWwindow* _window, uint32_t _width, uint32_t _height, uint32_t _framesInFlight = DEFAULT_FRAMES_IN_FLIGHT,
+                   VertexFormat _vertexFormat = VertexFormat::Float, const VulkanPresentPolicy& presentPolicy = {})
+        : vertShaderPath(vertexShaderPathFor(_vertexFormat)),
+          window(_window), width(_width), height(_height), framesInFlight(_framesInFlight), vertexFormat(_vertexFormat),
           instance(_window),
           device(instance),
-          swapchain(device, instance, width, height),
+          allocator(device),
+          swapchain(device, allocator, instance, width, height, framesInFlight, presentPolicy), // headless : one offscreen image per frame
           renderPass(device, swapchain),
+          vertexSize(Vertex::getStride(vertexFormat)),
 
           // alignment must be initialized before using it
           alignment(device.getProperties().limits.minUniformBufferOffsetAlignment),
-          uboAlignedSize((uboSize + alignment - 1) & ~(alignment - 1)),
+          storageAlignment(device.getProperties().limits.minStorageBufferOffsetAlignment),
+          objectsFrameSize((MAX_OBJECTS * sizeof(UniformBufferObject) + storageAlignment - 1) & ~(storageAlignment - 1)),
+          instancesFrameSize((MAX_OBJECTS * sizeof(uint32_t) + storageAlignment - 1) & ~(storageAlignment - 1)),
+          indirectFrameSize((INDIRECT_COMMANDS_OFFSET + (MAX_MESHES + MAX_MESHLET_COMMANDS) * sizeof(VkDrawIndexedIndirectCommand) + storageAlignment - 1) & ~(storageAlignment - 1)),
+          sceneFrameSize((MAX_SCENE_DATA * sizeof(SceneUBO) + alignment - 1) & ~(alignment - 1)),
+          cullFrameSize((MAX_OBJECTS * 2 * sizeof(uint32_t) + storageAlignment - 1) & ~(storageAlignment - 1)),
+          meshletDrawFrameSize((MAX_MESHLET_DRAWS * sizeof(MeshletDraw) + storageAlignment - 1) & ~(storageAlignment - 1)),
 
-          vertexBuffer(device, VulkanBufferType::Vertex, MAX_VERTEX_NUMBER * sizeof(Vertex), nullptr, false, 0, "Vertex Buffer"),
-          indexBuffer(device, VulkanBufferType::Index, MAX_INDEX_NUMBER * sizeof(uint32_t), nullptr, false, 0, "Index Buffer"),
+          geometry(allocator, vertexSize, VERTEX_BUFFER_SIZE / vertexSize, MAX_INDEX_NUMBER),
+          stagingRing(allocator),
 
-          objectsUB(device, VulkanBufferType::Uniform, MAX_OBJECTS_UB * uboAlignedSize, nullptr, true, uboAlignedSize, "Objects UB"),
-          sceneDataUB(device, VulkanBufferType::Uniform, MAX_SCENE_DATA * sizeof(SceneUBO), nullptr, false, 0, "SceneData UB"),
+          objectsSB(allocator, VulkanBufferType::Storage, framesInFlight * objectsFrameSize, nullptr, false, 0, "Objects SB"),
+          instanceIndicesSB(allocator, VulkanBufferType::Storage, framesInFlight * instancesFrameSize, nullptr, false, 0, "Instance Indices SB"),
+          sceneDataUB(allocator, VulkanBufferType::Uniform, framesInFlight * sceneFrameSize, nullptr, false, 0, "SceneData UB"),
+          indirectBuffer(allocator, VulkanBufferType::Indirect, framesInFlight * indirectFrameSize, nullptr, false, 0, "Indirect Buffer"),
+          objectCullSB(allocator, VulkanBufferType::Storage, framesInFlight * cullFrameSize, nullptr, false, 0, "Object Cull SB"),
+          meshBoundsSB(allocator, VulkanBufferType::Storage, MAX_MESHES * sizeof(MeshBounds), nullptr, false, 0, "Mesh Bounds SB"),
+          meshQuantizationSB(allocator, VulkanBufferType::Storage, MAX_MESHES * sizeof(MeshQuantization), nullptr, false, 0, "Mesh Quantization SB"),
+          meshletSB(allocator, VulkanBufferType::Storage, MAX_MESHLETS * sizeof(MeshletBounds), nullptr, false, 0, "Meshlet SB"),
+          meshletDrawSB(allocator, VulkanBufferType::Storage, framesInFlight * meshletDrawFrameSize, nullptr, false, 0, "Meshlet Draw SB"),
+          drawPath(chooseDrawPath()),
 
-          objectsUBDescriptor(device, objectsUB, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, uboSize),
-          sceneDataUBDescriptor(device, sceneDataUB, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(SceneUBO)),
+          objectsDescriptor(device, {{&objectsSB, objectsFrameSize, objectsFrameSize},
+                                     {&instanceIndicesSB, instancesFrameSize, instancesFrameSize},
+                                     {&objectCullSB, cullFrameSize, cullFrameSize},
+                                     {&meshQuantizationSB, MAX_MESHES * sizeof(MeshQuantization)}},
+                            VK_SHADER_STAGE_VERTEX_BIT, framesInFlight),
+          sceneDataUBDescriptor(device, sceneDataUB, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(SceneUBO), framesInFlight, sceneFrameSize),
+          cullDescriptor(device, {{&objectsSB, objectsFrameSize, objectsFrameSize},
+                                  {&objectCullSB, cullFrameSize, cullFrameSize},
+                                  {&meshBoundsSB, MAX_MESHES * sizeof(MeshBounds)},
+                                  {&indirectBuffer, indirectFrameSize, indirectFrameSize},
+                                  {&instanceIndicesSB, instancesFrameSize, instancesFrameSize},
+                                  {&meshletSB, MAX_MESHLETS * sizeof(MeshletBounds)},
+                                  {&meshletDrawSB, meshletDrawFrameSize, meshletDrawFrameSize}},
+                         VK_SHADER_STAGE_COMPUTE_BIT, framesInFlight),
 
-          graphicsPipeline(device, renderPass, swapchain, sceneDataUBDescriptor, objectsUBDescriptor, vertShaderPath, fragShaderPath),
+          pipelines(device, renderPass, {sceneDataUBDescriptor.getLayout(), objectsDescriptor.getLayout()}, defaultPipelineState()),
+          activePipeline(pipelines.getDefaultHandle()),
+          cullPipeline(device, {cullDescriptor.getLayout()}, cullShaderPath, sizeof(CullParams), "Cull Pipeline"),
+          meshletCullPipeline(device, {cullDescriptor.getLayout()}, meshletCullShaderPath, sizeof(CullParams), "Meshlet Cull Pipeline"),
           framebuffers(device, swapchain, renderPass),
-          commandBuffers(device, framebuffers),
-          syncObjects(device, 3)
+          commandBuffers(device, framesInFlight),
+          gpuProfiler(device, framesInFlight)
     {
-        std::cout << "Vertex buffer size: " << MAX_VERTEX_NUMBER * vertexSize << std::endl;
-        std::cout << "Index buffer size: " << MAX_INDEX_NUMBER * indexSize << std::endl;
-        std::cout << "Objects UB size: " << MAX_OBJECTS_UB * uboAlignedSize << std::endl;
-        std::cout << "Scene data UB size: " << MAX_SCENE_DATA * sizeof(SceneUBO) << std::endl;
+        if(framesInFlight == 0){
+            throw std::runtime_error("At least one frame in flight is required!");
+        }
+        maxQueuedFrames = framesInFlight;
+        for (uint32_t i = 0; i < framesInFlight; ++i) {
+            frames.push_back(std::make_unique<VulkanFrameContext>(device, i));
+            VulkanFrameContext& frame = *frames.back();
+            frame.commandBuffer = commandBuffers.getCommandBuffers()[i];
+            frame.objectsOffset = i * objectsFrameSize;
+            frame.instancesOffset = i * instancesFrameSize;
+            frame.indirectOffset = i * indirectFrameSize;
+            frame.sceneOffset = i * sceneFrameSize;
+            frame.objectsSet = objectsDescriptor.getDescriptorSet(i);
+            frame.sceneSet = sceneDataUBDescriptor.getDescriptorSet(i);
+            frame.cullOffset = i * cullFrameSize;
+            frame.cullSet = cullDescriptor.getDescriptorSet(i);
+            frame.meshletDrawOffset = i * meshletDrawFrameSize;
+        }
+        // the direct path reads instance counts on the CPU, it can't see what the cull pass kept
+        cullingEnabled = drawPath != VulkanDrawPath::Direct;
+        recorder = std::make_unique<VulkanSecondaryRecorder>(device, jobSystem, framesInFlight);
+        drawCallMeshIndices.reserve(MAX_OBJECTS); // never grows, clear() keeps the capacity
+        std::cout << "Vertex buffer page size: " << VERTEX_BUFFER_SIZE << " (" << VERTEX_BUFFER_SIZE / vertexSize << " vertices of " << vertexSize << " bytes)" << std::endl;
+        std::cout << "Index buffer page size: " << MAX_INDEX_NUMBER * indexSize << std::endl;
+        std::cout << "Geometry pages: " << MAX_GEOMETRY_PAGES << " at most" << std::endl;
+        std::cout << "Objects SB size: " << framesInFlight * (objectsFrameSize + instancesFrameSize) << std::endl;
+        std::cout << "Scene data UB size: " << framesInFlight * sceneFrameSize << std::endl;
+        std::cout << "Frames in flight: " << framesInFlight << std::endl;
+        if(!swapchain.isHeadless()){
+            std::cout << "Present mode: " << VulkanSwapchain::getPresentModeName(swapchain.getPresentMode()) << ", "
+                      << swapchain.getImages().size() << " images" << std::endl;
+        }
+        const char* drawPathNames[] = {"indirect count", "multi draw indirect", "indirect", "direct"};
+        std::cout << "Draw path: " << drawPathNames[(int)drawPath] << std::endl;
+        std::cout << "GPU culling: " << (cullingEnabled ? "on" : "off") << std::endl;
+        std::cout << "Meshlets: up to " << MESHLET_MAX_VERTICES << " vertices and " << MESHLET_MAX_TRIANGLES << " triangles, meshes from "
+                  << MESHLET_MIN_TRIANGLES << " triangles" << std::endl;
+        std::cout << "Job system threads: " << jobSystem.getThreadCount() << std::endl;
+        const VulkanPipelineCache& pipelineCache = device.getPipelineCache();
+        std::cout << "Pipeline cache: " << (pipelineCache.isWarm() ? "warm (" + std::to_string(pipelineCache.getLoadedBytes()) + " bytes)" : std::string("cold"))
+                  << ", " << pipelineCache.getPipelineCount() << " pipelines built in " << pipelineCache.getBuildMilliseconds() << "ms" << std::endl;
+        std::cout << "GPU profiler: timestamps " << (gpuProfiler.supportsTimestamps() ? "on" : "unsupported")
+                  << ", pipeline statistics " << (gpuProfiler.supportsStatistics() ? "on" : "unsupported") << std::endl;
     }
 
+    // Headless renderer : no window, surface or swapchain, frames are rendered into device images
+    // and can be copied back to host memory with readFrame
+    VulkanRenderer(uint32_t _width, uint32_t _height, uint32_t _framesInFlight = DEFAULT_FRAMES_IN_FLIGHT,
+                   VertexFormat _vertexFormat = VertexFormat::Float)
+        : VulkanRenderer(nullptr, _width, _height, _framesInFlight, _vertexFormat){}
+
+    VertexFormat getVertexFormat() const{
+        return vertexFormat;
+    }
+
+    bool isHeadless() const{
+        return swapchain.isHeadless();
+    }
+
+    VkExtent2D getExtent() const{
+        return swapchain.getExtent();
+    }
+
+    uint32_t getFramesInFlight() const{
+        return framesInFlight;
+    }
+
+    // Screen space error in pixels the LOD selection accepts, 0 always draws the full meshes
+    void setLodThreshold(float pixels){
+        lodThreshold = pixels;
+    }
+
+    float getLodThreshold() const{
+        return lodThreshold;
+    }
+
+    // Of the last frame drawn
+    const LodStats& getLodStats() const{
+        return lastLodStats;
+    }
+
+    // Present mode and image count, applied by recreating the swapchain before the next frame
+    void setPresentPolicy(const VulkanPresentPolicy& policy){
+        swapchain.setPresentPolicy(policy);
+        if(!swapchain.isHeadless()){
+            swapchainDirty = true;
+        }
+    }
+
+    VkPresentModeKHR getPresentMode() const{
+        return swapchain.getPresentMode();
+    }
+
+    // Frames start at most fps times per second, 0 for no limit
+    void setFrameRateLimit(float fps){
+        frameLimiter.setTargetFps(fps);
+    }
+
+    // 1 keeps a single frame ahead of the GPU for the lowest latency, framesInFlight (the default)
+    // lets the CPU run furthest ahead for the best throughput
+    void setMaxQueuedFrames(uint32_t count){
+        maxQueuedFrames = std::clamp(count, 1u, framesInFlight);
+    }
+
+    uint32_t getMaxQueuedFrames() const{
+        return maxQueuedFrames;
+    }
+
+    // Paces and waits for the frame about to be built, otherwise done by its first draw call. Called
+    // before sampling input, the frame is built from the freshest input there is.
+    void waitFrame(){
+        beginFrame();
+    }
+
+    // Of the last frame drawn
+    const FramePacingStats& getPacingStats() const{
+        return lastPacingStats;
+    }
+
+    const VulkanGeometryPool& getGeometryPool() const{
+        return geometry;
+    }
+
+    // Ignored on the direct draw path
+    void setCullingEnabled(bool enabled){
+        cullingEnabled = enabled && drawPath != VulkanDrawPath::Direct;
+    }
+
+    bool isCullingEnabled() const{
+        return cullingEnabled;
+    }
+
+    // Large meshes are culled per meshlet when culling is on, or as a whole like the others
+    void setMeshletCullingEnabled(bool enabled){
+        meshletCullingEnabled = enabled;
+    }
+
+    bool isMeshletCullingEnabled() const{
+        return meshletCullingEnabled;
+    }
+
+    // Graphics pipeline variant for state, compiled in the background. Draws keep using the default
+    // variant until it is ready.
+    PipelineHandle requestPipeline(const GraphicsPipelineState& state){
+        return pipelines.request(state);
+    }
+
+    // Every draw uses handle from the next frame on, or the default variant while it compiles
+    void setPipeline(PipelineHandle handle){
+        activePipeline = handle;
+    }
+
+    bool isPipelineReady(PipelineHandle handle) const{
+        return pipelines.isReady(handle);
+    }
+
+    // State of the variant the renderer starts with, the base of other variants
+    const GraphicsPipelineState& getDefaultPipelineState() const{
+        return pipelines.getDefaultState();
+    }
+
+    const VkPhysicalDeviceFeatures& getEnabledFeatures() const{
+        return device.getEnabledFeatures();
+    }
+
+    const VulkanPipelineCache& getPipelineCache() const{
+        return device.getPipelineCache();
+    }
+
+    // Times the passes of every frame and counts their pipeline statistics, results come in
+    // framesInFlight frames after the frame they measure
+    void setGpuProfilingEnabled(bool enabled){
+        gpuProfiler.setEnabled(enabled);
+    }
+
+    const VulkanGpuProfiler& getGpuProfiler() const{
+        return gpuProfiler;
+    }
+
+    JobSystem& getJobSystem(){
+        return jobSystem;
+    }
+
+    // Threads recording the draws of a frame at most, 1 records everything on the calling thread.
+    // Capped by the job system thread count.
+    void setRecordThreadCount(uint32_t threadCount){
+        recorder->setMaxChunks(threadCount);
+    }
+
+    uint32_t getRecordThreadCount() const{
+        return recorder->getMaxChunks();
+    }
+
+    // Records drawCount direct draws of mesh meshIndex into the secondary buffers of the current frame,
+    // the way drawFrame records a large draw list, without submitting them. Only meant to measure
+    // recording time, the next drawFrame records over them.
+    void recordSyntheticDraws(uint32_t meshIndex, uint32_t drawCount){
+        VulkanFrameContext& frame = beginFrame();
+        const MeshDrawInfo& drawInfo = meshPool.at(meshIndex);
+        syntheticCommands.assign(drawCount, {drawInfo.indexCount, 1, drawInfo.indexOffset, (int32_t)drawInfo.vertexOffset, 0});
+        recorder->record(frame.getIndex(), renderPass.getRenderPass(), framebuffers.getFramebuffers()[0], drawCount,
+            [&](VkCommandBuffer chunk, uint32_t first, uint32_t count){
+                VulkanCommandBuffers::bindDrawState(chunk, pipelines.resolve(activePipeline), frame, swapchain.getExtent());
+                VulkanCommandBuffers::bindGeometry(chunk, geometry.getVertexBuffer(drawInfo.page), geometry.getIndexBuffer(drawInfo.page));
+                VulkanCommandBuffers::recordDraws(device, chunk, indirectBuffer, VulkanDrawPath::Direct, 0, 0,
+                                                  syntheticCommands.data(), first, count, 0);
+            });
+    }
+
+
+    // Vertices are converted to the renderer vertex format on their way to the staging ring. bounds is
+    // computed from the positions when not given. lods are ranges of lodIndices, uploaded after the
+    // mesh indices and picked by addMeshDrawCall. meshlets are ranges of meshIndices, as
+    // generateMeshlets builds them at conversion, without them the mesh is culled as a whole.
+    uint32_t loadMesh(const Vertex* meshVertices, uint32_t vertexCount, const uint32_t* meshIndices, uint32_t indexCount,
+                      const MeshBounds* bounds = nullptr, const uint32_t* lodIndices = nullptr, const MeshLod* lods = nullptr,
+                      uint32_t lodCount = 0, const Meshlet* meshlets = nullptr, uint32_t meshletCount = 0){
+        reserveMeshSlots(1 + lodCount);
+        uint32_t lodIndicesCount = lodIndexCount(lods, lodCount);
+        GeometryAllocation allocation = geometry.allocate(vertexCount, indexCount + lodIndicesCount);
+
+        // copied into the staging ring right away, submitted in one batch with every other load at the next drawFrame
+        std::vector<uint8_t> encoded(vertexCount * vertexSize);
+        MeshQuantization quantization = encodeVertices(meshVertices, vertexCount, encoded.data());
+        stagingRing.upload(geometry.getVertexBuffer(allocation.page), encoded.data(), encoded.size(), allocation.getVertexOffset() * vertexSize);
+        stagingRing.upload(geometry.getIndexBuffer(allocation.page), meshIndices, indexCount * sizeof(uint32_t),
+                           allocation.getIndexOffset() * sizeof(uint32_t));
+        if (lodIndicesCount > 0)
+            stagingRing.upload(geometry.getIndexBuffer(allocation.page), lodIndices, lodIndicesCount * sizeof(uint32_t),
+                               (allocation.getIndexOffset() + indexCount) * sizeof(uint32_t));
+
+        uint32_t meshIndex = addMesh(allocation.page, allocation.getVertexOffset(), allocation.getIndexOffset(), indexCount,
+                                     bounds != nullptr ? *bounds : computeBounds(meshVertices, vertexCount), quantization,
+                                     addGeometryBlock(allocation, 1 + lodCount));
+        addLods(meshIndex, allocation.getIndexOffset() + indexCount, lods, lodCount, quantization);
+        addMeshlets(meshIndex, meshlets, meshletCount);
+        return meshIndex;
+    }
 
     uint32_t loadMesh(const Mesh& mesh){
-        VkDeviceSize vertexOffset = vertices.size();
-        VkDeviceSize indexOffset = indices.size();
+        std::vector<Vertex> vertices;
+        appendVertices(mesh, vertices);
+        const auto& meshIndices = mesh.getTriangles();
+        return loadMesh(vertices.data(), vertices.size(), meshIndices.data(), meshIndices.size(), nullptr,
+                        mesh.getLodIndices().data(), mesh.getLods().data(), mesh.getLods().size(),
+                        mesh.getMeshlets().data(), mesh.getMeshlets().size());
+    }
 
-        const auto& meshVertices = mesh.getVertices();
-        const auto& meshNormals  = mesh.getNormals();
-        const auto& meshIndices  = mesh.getTriangles();
+    // Every submesh of model, packed back to back in one pool allocation and uploaded with a single
+    // copy per buffer. Returns the mesh index of each submesh, in model order.
+    std::vector<uint32_t> loadModel(const Model& model){
+        const std::vector<Mesh>& meshes = model.getMeshes();
+        size_t vertexCount = 0, indexCount = 0, levelCount = 0;
+        for (const Mesh& mesh : meshes) {
+            vertexCount += mesh.getVertices().size();
+            indexCount += mesh.getTriangles().size() + mesh.getLodIndices().size();
+            levelCount += 1 + mesh.getLods().size();
+        }
+        reserveMeshSlots(levelCount);
+        GeometryAllocation allocation = geometry.allocate(vertexCount, indexCount);
 
-        for (size_t i = 0; i < meshVertices.size(); ++i){
-            vertices.push_back({meshVertices[i], {1.0f,1.0f,1.0f}, meshNormals[i]});
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        vertices.reserve(vertexCount);
+        indices.reserve(indexCount);
+        for (const Mesh& mesh : meshes) {
+            appendVertices(mesh, vertices);
+            indices.insert(indices.end(), mesh.getTriangles().begin(), mesh.getTriangles().end());
+            indices.insert(indices.end(), mesh.getLodIndices().begin(), mesh.getLodIndices().end());
+        }
+        // compact positions are relative to their own submesh, each one is encoded on its own
+        std::vector<MeshQuantization> quantizations;
+        quantizations.reserve(meshes.size());
+        std::vector<uint8_t> encoded(vertexCount * vertexSize);
+        size_t firstVertex = 0;
+        for (const Mesh& mesh : meshes) {
+            quantizations.push_back(encodeVertices(vertices.data() + firstVertex, mesh.getVertices().size(),
+                                                   encoded.data() + firstVertex * vertexSize));
+            firstVertex += mesh.getVertices().size();
         }
-        indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
 
-        vertexBuffer.update(vertices.data() + vertexOffset, meshVertices.size() * sizeof(Vertex), vertexOffset * sizeof(Vertex));
-        indexBuffer.update(indices.data() + indexOffset, meshIndices.size() * sizeof(uint32_t), indexOffset * sizeof(uint32_t));
+        uint32_t vertexOffset = allocation.getVertexOffset();
+        uint32_t indexOffset = allocation.getIndexOffset();
+        stagingRing.upload(geometry.getVertexBuffer(allocation.page), encoded.data(), encoded.size(), vertexOffset * vertexSize);
+        stagingRing.upload(geometry.getIndexBuffer(allocation.page), indices.data(), indices.size() * sizeof(uint32_t),
+                           indexOffset * sizeof(uint32_t));
+
+        // indices stay local to their submesh, the draw adds its vertex offset. The allocation is freed
+        // with the last submesh unloaded.
+        uint32_t block = addGeometryBlock(allocation, levelCount);
+        std::vector<uint32_t> meshIndices;
+        meshIndices.reserve(meshes.size());
+        const Vertex* meshVertices = vertices.data();
+        for (size_t m = 0; m < meshes.size(); ++m) {
+            uint32_t meshVertexCount = meshes[m].getVertices().size();
+            uint32_t meshIndexCount = meshes[m].getTriangles().size();
+            uint32_t meshIndex = addMesh(allocation.page, vertexOffset, indexOffset, meshIndexCount,
+                                         computeBounds(meshVertices, meshVertexCount), quantizations[m], block);
+            addLods(meshIndex, indexOffset + meshIndexCount, meshes[m].getLods().data(), meshes[m].getLods().size(), quantizations[m]);
+            addMeshlets(meshIndex, meshes[m].getMeshlets().data(), meshes[m].getMeshlets().size());
+            meshIndices.push_back(meshIndex);
+            meshVertices += meshVertexCount;
+            vertexOffset += meshVertexCount;
+            indexOffset += meshIndexCount + meshes[m].getLodIndices().size();
+        }
+        return meshIndices;
+    }
 
-        meshPool.push_back({(uint32_t)vertexOffset, (uint32_t)indexOffset, (uint32_t)mesh.getTriangles().size()});
-        return meshPool.size() - 1;
+    // Straight from the mapping, the file stores the Vertex layout and its bounds
+    uint32_t loadMesh(const MappedMeshFile& meshFile){
+        static_assert(sizeof(MeshFileVertex) == sizeof(Vertex) &&
+                      offsetof(MeshFileVertex, pos) == offsetof(Vertex, pos) &&
+                      offsetof(MeshFileVertex, color) == offsetof(Vertex, color) &&
+                      offsetof(MeshFileVertex, normal) == offsetof(Vertex, normal),
+                      "MeshFileVertex must match the Vertex layout");
+        MeshBounds bounds{meshFile.getHeader().boundsCenter, meshFile.getHeader().boundsRadius};
+        return loadMesh(reinterpret_cast<const Vertex*>(meshFile.getVertices()), meshFile.getVertexCount(),
+                        meshFile.getIndices(), meshFile.getIndexCount(), &bounds,
+                        meshFile.getLodIndices(), meshFile.getLods(), meshFile.getLodCount(),
+                        meshFile.getMeshlets(), meshFile.getMeshletCount());
     }
 
-    void addMeshDrawCall(uint32_t meshIndex, glm::mat4 transform){
-        drawCallMeshIndices.push_back(meshIndex);
-        ubos.push_back({transform});
+    // The mesh and its levels can't be drawn from now on. Their geometry and indices are reused once
+    // the frames in flight, which may still draw them, are done.
+    void unloadMesh(uint32_t meshIndex){
+        if(meshIndex >= meshPool.size() || !meshLoaded[meshIndex]){
+            throw std::runtime_error("Unloading a mesh that isn't loaded!");
+        }
+        meshLoaded[meshIndex] = false;
+        pendingUnloads.push_back({frameSerial, meshIndex});
+        for (const LodLevel& level : meshLods[meshIndex]) {
+            meshLoaded[level.mesh] = false;
+            pendingUnloads.push_back({frameSerial, level.mesh});
+        }
+    }
+
+    // meshIndices as returned by loadModel
+    void unloadModel(const std::vector<uint32_t>& meshIndices){
+        for (uint32_t meshIndex : meshIndices) {
+            unloadMesh(meshIndex);
+        }
+    }
+
+    // The transform goes straight into the mapped objectsSB slice of the frame being built. Calls
+    // sharing a mesh are drawn together as instances, whatever their submission order. Meshes with LODs
+    // are drawn with the coarsest level that looks the same within the LOD threshold, the scene data
+    // must be set before.
+    void addMeshDrawCall(uint32_t meshIndex, const glm::mat4& transform){
+        if(drawCallMeshIndices.size() >= MAX_OBJECTS){
+            throw std::runtime_error("Too many draw calls in one frame!");
+        }
+        if(meshIndex >= meshPool.size() || !meshLoaded[meshIndex]){
+            throw std::runtime_error("Drawing a mesh that isn't loaded!");
+        }
+        VkDeviceSize offset = beginFrame().objectsOffset + drawCallMeshIndices.size() * sizeof(UniformBufferObject);
+        std::memcpy(objectsSB.data<uint8_t>(offset), &transform, sizeof(UniformBufferObject));
+
+        uint32_t drawnMesh = selectLod(meshIndex, transform);
+        lodStats.trianglesDrawn += meshPool[drawnMesh].indexCount / 3;
+        lodStats.trianglesSaved += (meshPool[meshIndex].indexCount - meshPool[drawnMesh].indexCount) / 3;
+        drawCallMeshIndices.push_back(drawnMesh);
+    }
+
+    // One draw call per submesh of every node, meshIndices as returned by loadModel
+    void addModelDrawCall(const Model& model, const std::vector<uint32_t>& meshIndices, const glm::mat4& transform){
+        const std::vector<ModelNode>& nodes = model.getNodes();
+        for (uint32_t n = 0; n < nodes.size(); ++n) {
+            if (nodes[n].meshes.empty())
+                continue;
+            glm::mat4 nodeTransform = transform * model.getWorldTransform(n);
+            for (uint32_t mesh : nodes[n].meshes) {
+                addMeshDrawCall(meshIndices.at(mesh), nodeTransform);
+            }
+        }
     }
 
+    // The projection follows the swapchain aspect ratio, resizes included
     void initSceneData(const glm::mat4 view, const glm::vec3 lightDir, const glm::vec3 lightColor){
-        glm::mat4 proj = glm::perspective(glm::radians(45.0f),
-                                          swapchain.getExtent().width / (float)swapchain.getExtent().height,
-                                          0.1f, 100.0f);
-        proj[1][1] *= -1;
-        sceneData = {view, proj, lightDir, lightColor};
-        sceneDataUB.update(&sceneData, sizeof(SceneUBO), 0);
+        sceneData = {view, glm::mat4(1.0f), lightDir, lightColor}; // copied into the frame slice at every drawFrame
+        updateProjection();
     }
 
-    void drawFrame(){
-        // pad and upload object UBOs
-        std::vector<uint8_t> paddedUBOs = padData(ubos, uboAlignedSize);
-        objectsUB.update(paddedUBOs.data(), paddedUBOs.size(), 0);
+    // The swapchain is recreated at this size before the next frame. Windowed, the surface size wins
+    // when the platform fixes it, 0 while minimized skips frames until the next resize.
+    void resize(uint32_t newWidth, uint32_t newHeight){
+        width = newWidth;
+        height = newHeight;
+        swapchainDirty = true;
+    }
 
-        vkWaitForFences(device.getDevice(), 1, &syncObjects.inFlightFence[currentFrame], VK_TRUE, UINT64_MAX);
-        vkResetFences(device.getDevice(), 1, &syncObjects.inFlightFence[currentFrame]);
+    // Duration of the last swapchain recreation, GPU wait included
+    float getLastResizeMilliseconds() const{
+        return lastResizeMilliseconds;
+    }
+
+    uint32_t getResizeCount() const{
+        return resizeCount;
+    }
+
+    void drawFrame(){
+        CRUMBS_PROFILE_SCOPE("drawFrame");
+        VulkanFrameContext& frame = beginFrame();
+        if(swapchainDirty && !recreateSwapchain()){
+            dropFrame(); // minimized, nothing to draw into
+            return;
+        }
 
         uint32_t imageIndex;
-        vkAcquireNextImageKHR(device.getDevice(), swapchain.getSwapchain(),
-                              UINT64_MAX, syncObjects.imageAvailableSemaphore[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        if(swapchain.isHeadless()){
+            imageIndex = currentFrame; // one offscreen image per frame in flight, its fence was just waited on
+        }
+        else{
+            // acquired before the fence is reset, a frame dropped here leaves it signaled for the next one
+            auto acquireStart = std::chrono::steady_clock::now();
+            VkResult acquired;
+            {
+                CRUMBS_PROFILE_SCOPE("vkAcquireNextImageKHR");
+                acquired = vkAcquireNextImageKHR(device.getDevice(), swapchain.getSwapchain(),
+                                                 UINT64_MAX, frame.getImageAvailableSemaphore(), VK_NULL_HANDLE, &imageIndex);
+            }
+            pacingStats.acquireWaitMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - acquireStart).count();
+            if(acquired == VK_ERROR_OUT_OF_DATE_KHR){
+                swapchainDirty = true;
+                dropFrame();
+                return;
+            }
+            if(acquired == VK_SUBOPTIMAL_KHR){
+                swapchainDirty = true; // still presentable, recreated after this frame
+            }
+            else if(acquired != VK_SUCCESS){
+                throw std::runtime_error("Failed to acquire swapchain image!");
+            }
+        }
+
+        frame.resetFence();
+        pipelines.update(frameSerial, framesInFlight);
+        objectsSB.flush(frame.objectsOffset, drawCallMeshIndices.size() * sizeof(UniformBufferObject));
+        groupInstances(frame);
+        sceneDataUB.update(&sceneData, sizeof(SceneUBO), frame.sceneOffset);
+        updateCullParams();
+
+        // pending mesh uploads go to the queue ahead of this frame, the batch barrier orders them before its draws
+        stagingRing.collect();
+        stagingRing.flush();
 
         // record command buffer for this image
         commandBuffers.record2(device, swapchain, renderPass, framebuffers,
-                               vertexBuffer, indexBuffer, sceneDataUBDescriptor,
-                               objectsUBDescriptor, graphicsPipeline, meshPool,
-                               drawCallMeshIndices, imageIndex);
+                               geometry, drawRanges, pipelines.resolve(activePipeline),
+                               indirectBuffer, drawPath, drawCount, drawCount,
+                               cullingEnabled ? &cullPipeline : nullptr, &meshletCullPipeline, cullParams, recorder.get(), &gpuProfiler,
+                               frame, imageIndex);
 
         VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = &syncObjects.imageAvailableSemaphore[currentFrame];
-        submitInfo.pWaitDstStageMask = waitStages;
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &syncObjects.renderFinishedSemaphore[currentFrame];
+        if(!swapchain.isHeadless()){
+            submitInfo.waitSemaphoreCount = 1;
+            submitInfo.pWaitSemaphores = &frame.getImageAvailableSemaphore();
+            submitInfo.pWaitDstStageMask = waitStages;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &frame.getRenderFinishedSemaphore();
+        }
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffers.getCommandBuffers()[imageIndex];
+        submitInfo.pCommandBuffers = &frame.commandBuffer;
 
-        vkQueueSubmit(device.getGraphicsQueue(), 1, &submitInfo, syncObjects.inFlightFence[currentFrame]);
+        {
+            CRUMBS_PROFILE_SCOPE("vkQueueSubmit");
+            vkQueueSubmit(device.getGraphicsQueue(), 1, &submitInfo, frame.getFence());
+        }
 
-        VkPresentInfoKHR presentInfo{};
-        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = &syncObjects.renderFinishedSemaphore[currentFrame];
-        presentInfo.swapchainCount = 1;
-        presentInfo.pSwapchains = &swapchain.getSwapchain();
-        presentInfo.pImageIndices = &imageIndex;
-        vkQueuePresentKHR(device.getGraphicsQueue(), &presentInfo);
+        if(!swapchain.isHeadless()){
+            VkPresentInfoKHR presentInfo{};
+            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            presentInfo.waitSemaphoreCount = 1;
+            presentInfo.pWaitSemaphores = &frame.getRenderFinishedSemaphore();
+            presentInfo.swapchainCount = 1;
+            presentInfo.pSwapchains = &swapchain.getSwapchain();
+            presentInfo.pImageIndices = &imageIndex;
+            VkResult presented;
+            {
+                CRUMBS_PROFILE_SCOPE("vkQueuePresentKHR");
+                presented = vkQueuePresentKHR(device.getGraphicsQueue(), &presentInfo);
+            }
+            if(presented == VK_ERROR_OUT_OF_DATE_KHR || presented == VK_SUBOPTIMAL_KHR){
+                swapchainDirty = true;
+            }
+            else if(presented != VK_SUCCESS){
+                throw std::runtime_error("Failed to present swapchain image!");
+            }
+        }
 
-        currentFrame = (currentFrame + 1) % 3;
-        ubos.clear();
+        lastImageIndex = imageIndex;
+        frameSerial++;
+        lastLodStats = lodStats;
+        lodStats = {};
+        pacingStats.cpuWorkMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameWorkStart).count()
+                                - pacingStats.acquireWaitMs;
+        lastPacingStats = pacingStats;
+        pacingStats = {};
+        currentFrame = (currentFrame + 1) % framesInFlight;
+        frameStarted = false;
         drawCallMeshIndices.clear();
     }
 
+    // Copies the last rendered frame to host memory as tightly packed RGBA8 rows. Headless only,
+    // waits for the GPU to finish the frame.
+    void readFrame(std::vector<uint8_t>& pixels){
+        if(!swapchain.isHeadless()){
+            throw std::runtime_error("readFrame is only available on a headless renderer!");
+        }
+        VkExtent2D extent = swapchain.getExtent();
+        VkDeviceSize frameSize = (VkDeviceSize)extent.width * extent.height * 4;
+        if(!readbackBuffer){
+            readbackBuffer = std::make_unique<VulkanBuffer>(allocator, VulkanBufferType::Readback, frameSize, nullptr, false, 0, "Readback Buffer",
+                                                            VulkanMemoryPlacement::HostCached);
+        }
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;   // tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {extent.width, extent.height, 1};
+
+        // the render pass leaves the image in TRANSFER_SRC_OPTIMAL and its dependency orders the copy after the frame
+        VkCommandBuffer commandBuffer = device.beginSingleTimeCommands();
+        vkCmdCopyImageToBuffer(commandBuffer, swapchain.getImages()[lastImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               readbackBuffer->getBuffer(), 1, &region);
+        device.endSingleTimeCommands(commandBuffer);
+
+        pixels.resize(frameSize);
+        readbackBuffer->read(pixels.data(), frameSize, 0);
+    }
+
     ~VulkanRenderer(){
         destroy();
     }
@@ -201,18 +1142,33 @@ public:
             return;
         }
         vkDeviceWaitIdle(device.getDevice());
-        syncObjects.destroy();
+        frames.clear();
+        recorder.reset();
+        readbackBuffer.reset();
         framebuffers.destroy();
         commandBuffers.destroy();
-        graphicsPipeline.destroy();
+        gpuProfiler.destroy();
+        cullPipeline.destroy();
+        meshletCullPipeline.destroy();
+        pipelines.destroy();
+        cullDescriptor.destroy();
         sceneDataUBDescriptor.destroy();
         sceneDataUB.destroy();
-        objectsUBDescriptor.destroy();
-        objectsUB.destroy();
-        vertexBuffer.destroy();
-        indexBuffer.destroy();
+        objectsDescriptor.destroy();
+        meshBoundsSB.destroy();
+        meshQuantizationSB.destroy();
+        meshletSB.destroy();
+        meshletDrawSB.destroy();
+        objectCullSB.destroy();
+        indirectBuffer.destroy();
+        instanceIndicesSB.destroy();
+        objectsSB.destroy();
+        stagingRing.destroy();
+        geometry.destroy();
         renderPass.destroy();
         swapchain.destroy();
+        allocator.logStats();
+        allocator.destroy();
         device.destroy();
         instance.destroy(); 
     }
@@ -0,0 +1,192 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include "vulkan_device.hpp"
+#include "job_system.hpp"
+#include "profiler.hpp"
+
+#define MIN_DRAWS_PER_SECONDARY 256 // below this a chunk costs more to dispatch than to record
+
+// Records the draws of one render pass into secondary command buffers, one chunk per job system thread.
+// Every (chunk, frame in flight) pair has its own command pool : a chunk is recorded by a single job so
+// threads never share a pool, and a pool is only reset once the fence of its frame has been waited on.
+// The calling thread records chunk 0 and helps with the others while it waits.
+class VulkanSecondaryRecorder {
+public:
+    // Records draws [first, first + count) into commandBuffer. Bound state is not inherited from the
+    // primary buffer, the function has to bind everything its draws use. Only refers to the callable :
+    // record() returns once every chunk is recorded, and a std::function would allocate every frame
+    // for captures larger than a couple of pointers.
+    class RecordFunction {
+    private:
+        const void* callable;
+        void (*invoke)(const void* callable, VkCommandBuffer commandBuffer, uint32_t first, uint32_t count);
+
+    public:
+        template <typename Function>
+        RecordFunction(const Function& function)
+            : callable(&function),
+              invoke([](const void* callable, VkCommandBuffer commandBuffer, uint32_t first, uint32_t count){
+                  (*static_cast<const Function*>(callable))(commandBuffer, first, count);
+              }){}
+
+        void operator()(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count) const{
+            invoke(callable, commandBuffer, first, count);
+        }
+    };
+
+private:
+    VulkanDevice& pDevice;
+    JobSystem& jobs;
+    uint32_t chunkCapacity;
+    uint32_t maxChunks;
+    uint32_t frameCount;
+    std::vector<VkCommandPool> pools;            // [frame * chunkCapacity + chunk]
+    std::vector<VkCommandBuffer> commandBuffers; // one per pool
+    std::vector<VkCommandBuffer> recorded;       // chunks of the last record() in draw order
+
+    // current record() call, read by the chunk jobs
+    const RecordFunction* job = nullptr;
+    VkCommandBufferInheritanceInfo inheritance{};
+    uint32_t jobFrame = 0;
+    uint32_t jobDrawCount = 0;
+    uint32_t jobChunkCount = 0;
+    std::vector<std::exception_ptr> errors;
+
+    void recordChunk(uint32_t chunk){
+        CRUMBS_PROFILE_SCOPE("Record Secondary Chunk");
+        try {
+            uint32_t first = (uint64_t)jobDrawCount * chunk / jobChunkCount;
+            uint32_t last = (uint64_t)jobDrawCount * (chunk + 1) / jobChunkCount;
+            uint32_t slot = jobFrame * chunkCapacity + chunk;
+            VkCommandBuffer commandBuffer = commandBuffers[slot];
+
+            // the whole pool is recycled at once, cheaper than resetting buffers one by one
+            vkResetCommandPool(pDevice.getDevice(), pools[slot], 0);
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo = &inheritance;
+            if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+                throw std::runtime_error("Failed to begin recording secondary command buffer!");
+
+            (*job)(commandBuffer, first, last - first);
+
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+                throw std::runtime_error("Failed to record secondary command buffer!");
+        } catch (...) {
+            errors[chunk] = std::current_exception();
+        }
+    }
+
+public:
+    VulkanSecondaryRecorder(VulkanDevice& device, JobSystem& jobs, uint32_t frameCount)
+        : pDevice(device), jobs(jobs), chunkCapacity(jobs.getThreadCount()), maxChunks(chunkCapacity), frameCount(frameCount)
+    {
+        pools.resize(frameCount * chunkCapacity, VK_NULL_HANDLE);
+        commandBuffers.resize(pools.size(), VK_NULL_HANDLE);
+        errors.resize(chunkCapacity);
+
+        for (size_t i = 0; i < pools.size(); ++i) {
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.queueFamilyIndex = device.getGraphicsFamilyIndex();
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // rerecorded every time the frame comes around
+
+            if (vkCreateCommandPool(device.getDevice(), &poolInfo, nullptr, &pools[i]) != VK_SUCCESS) {
+                destroy();
+                throw std::runtime_error("Failed to create secondary command pool!");
+            }
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = pools[i];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            if (vkAllocateCommandBuffers(device.getDevice(), &allocInfo, &commandBuffers[i]) != VK_SUCCESS) {
+                destroy();
+                throw std::runtime_error("Failed to allocate secondary command buffer!");
+            }
+            device.nameObject((uint64_t)pools[i], VK_OBJECT_TYPE_COMMAND_POOL,
+                              "Secondary Pool " + std::to_string(i / chunkCapacity) + "." + std::to_string(i % chunkCapacity));
+        }
+    }
+
+    ~VulkanSecondaryRecorder(){
+        destroy();
+    }
+
+    // The pools must not be in use by the GPU anymore
+    void destroy(){
+        for (VkCommandPool pool : pools) {
+            if (pool != VK_NULL_HANDLE)
+                vkDestroyCommandPool(pDevice.getDevice(), pool, nullptr); // frees its buffers
+        }
+        pools.clear();
+        commandBuffers.clear();
+        recorded.clear();
+    }
+
+    // Threads a frame is recorded with at most, between 1 and the job system thread count
+    void setMaxChunks(uint32_t chunks){
+        maxChunks = std::max(1u, std::min(chunks, chunkCapacity));
+    }
+
+    uint32_t getMaxChunks() const{
+        return maxChunks;
+    }
+
+    // Chunk count worth using for drawCount draws, 1 means recording inline is as good
+    uint32_t chunkCountFor(uint32_t drawCount) const{
+        uint32_t chunks = drawCount / MIN_DRAWS_PER_SECONDARY;
+        return std::max(1u, std::min(chunks, maxChunks));
+    }
+
+    // Splits [0, drawCount) across the threads and records every chunk inside subpass 0 of renderPass.
+    // Blocks until all chunks are recorded. The returned list is meant for vkCmdExecuteCommands and is
+    // overwritten by the next record(), the buffers themselves stay valid until their frame comes around.
+    // pipelineStatistics are the counters of the query active in the primary buffer, 0 if none.
+    const std::vector<VkCommandBuffer>& record(uint32_t frameIndex, VkRenderPass renderPass, VkFramebuffer framebuffer,
+                                               uint32_t drawCount, const RecordFunction& recordDraws,
+                                               VkQueryPipelineStatisticFlags pipelineStatistics = 0)
+    {
+        if (frameIndex >= frameCount)
+            throw std::runtime_error("Secondary recorder frame index out of range!");
+
+        inheritance = {};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance.renderPass = renderPass;
+        inheritance.subpass = 0;
+        inheritance.framebuffer = framebuffer;
+        inheritance.pipelineStatistics = pipelineStatistics;
+
+        job = &recordDraws;
+        jobFrame = frameIndex;
+        jobDrawCount = drawCount;
+        jobChunkCount = chunkCountFor(drawCount);
+        std::fill(errors.begin(), errors.end(), nullptr);
+
+        JobCounter counter;
+        for (uint32_t chunk = 1; chunk < jobChunkCount; ++chunk) {
+            jobs.run([this, chunk]{ recordChunk(chunk); }, &counter);
+        }
+        recordChunk(0);
+        jobs.wait(counter);
+        job = nullptr;
+
+        for (const std::exception_ptr& error : errors) {
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        recorded.assign(commandBuffers.begin() + frameIndex * chunkCapacity,
+                        commandBuffers.begin() + frameIndex * chunkCapacity + jobChunkCount);
+        return recorded;
+    }
+};
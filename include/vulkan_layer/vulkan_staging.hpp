@@ -0,0 +1,250 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include "vulkan_device.hpp"
+#include "vulkan_allocator.hpp"
+#include "vulkan_buffer.hpp"
+
+#define STAGING_RING_SIZE (8 * 1024 * 1024)
+#define STAGING_ALIGNMENT 16
+
+// Host visible ring buffer used to copy data into DeviceLocal buffers.
+// Uploads are recorded into a batch command buffer and only submitted on flush(), each batch
+// gets its own fence so ring space is reclaimed once the GPU is done with it. The batches go to
+// the graphics queue and end with a barrier, so draws submitted afterwards see the data without
+// the CPU ever waiting on the copy.
+class VulkanStagingRing {
+private:
+    struct Batch {
+        VkCommandBuffer commandBuffer{ VK_NULL_HANDLE };
+        VkFence fence{ VK_NULL_HANDLE };
+        VkDeviceSize consumed = 0; // ring bytes held by this batch, wrap padding included
+        uint32_t copyCount = 0;
+    };
+
+    VulkanDevice& device;
+    VulkanBuffer ringBuffer;
+    VkCommandPool commandPool{ VK_NULL_HANDLE };
+
+    VkDeviceSize capacity;
+    VkDeviceSize head = 0;      // next write offset
+    VkDeviceSize usedBytes = 0; // bytes between the oldest in flight batch and head
+
+    std::vector<Batch> batches;
+    std::deque<uint32_t> inFlight;  // submitted batches, oldest first
+    std::vector<uint32_t> freeBatches;
+    int32_t recording = -1;         // batch currently recording, -1 if none
+
+    uint32_t acquireBatch(){
+        if (freeBatches.empty()) {
+            Batch batch;
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+            if (vkAllocateCommandBuffers(device.getDevice(), &allocInfo, &batch.commandBuffer) != VK_SUCCESS)
+                throw std::runtime_error("Failed to allocate staging command buffer!");
+
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            if (vkCreateFence(device.getDevice(), &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS)
+                throw std::runtime_error("Failed to create staging fence!");
+
+            batches.push_back(batch);
+            freeBatches.push_back(batches.size() - 1);
+        }
+        uint32_t index = freeBatches.back();
+        freeBatches.pop_back();
+        return index;
+    }
+
+    Batch& currentBatch(){
+        if (recording < 0) {
+            recording = acquireBatch();
+            Batch& batch = batches[recording];
+            batch.consumed = 0;
+            batch.copyCount = 0;
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkResetCommandBuffer(batch.commandBuffer, 0);
+            if (vkBeginCommandBuffer(batch.commandBuffer, &beginInfo) != VK_SUCCESS)
+                throw std::runtime_error("Failed to begin staging command buffer!");
+        }
+        return batches[recording];
+    }
+
+    void retireOldest(bool wait){
+        Batch& batch = batches[inFlight.front()];
+        if (wait)
+            vkWaitForFences(device.getDevice(), 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        vkResetFences(device.getDevice(), 1, &batch.fence);
+        usedBytes -= batch.consumed;
+        freeBatches.push_back(inFlight.front());
+        inFlight.pop_front();
+    }
+
+    bool tryAllocate(VkDeviceSize size, VkDeviceSize& offset){
+        if (usedBytes == 0)
+            head = 0;
+        if (usedBytes == capacity)
+            return false;
+
+        VkDeviceSize tail = (head + capacity - usedBytes) % capacity;
+        VkDeviceSize taken;
+        if (head >= tail) {
+            // free space is [head, capacity) then [0, tail)
+            if (capacity - head >= size) {
+                offset = head;
+                taken = size;
+            } else if (tail >= size) {
+                offset = 0;
+                taken = capacity - head + size; // the end of the ring is skipped
+            } else {
+                return false;
+            }
+        } else {
+            if (tail - head < size)
+                return false;
+            offset = head;
+            taken = size;
+        }
+        head = (offset + size) % capacity;
+        usedBytes += taken;
+        currentBatch().consumed += taken;
+        return true;
+    }
+
+    VkDeviceSize allocate(VkDeviceSize size){
+        VkDeviceSize offset;
+        while (!tryAllocate(size, offset)) {
+            if (!inFlight.empty())
+                retireOldest(true);         // ring full, wait for the oldest batch
+            else if (recording >= 0 && batches[recording].copyCount > 0)
+                flush();                    // the pending batch itself fills the ring
+            else
+                throw std::runtime_error("Staging allocation larger than the ring!");
+        }
+        return offset;
+    }
+
+public:
+    VulkanStagingRing(VulkanAllocator& allocator, VkDeviceSize capacity = STAGING_RING_SIZE)
+        : device(allocator.getDevice()),
+          ringBuffer(allocator, VulkanBufferType::Staging, capacity, nullptr, false, 0, "Staging Ring"),
+          capacity(capacity)
+    {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = device.getGraphicsFamilyIndex();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        if (vkCreateCommandPool(device.getDevice(), &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+            throw std::runtime_error("Failed to create staging command pool!");
+    }
+
+    ~VulkanStagingRing(){
+        destroy();
+    }
+
+    void destroy(){
+        if (commandPool == VK_NULL_HANDLE)
+            return;
+        waitIdle();
+        for (auto& batch : batches) {
+            vkDestroyFence(device.getDevice(), batch.fence, nullptr);
+        }
+        batches.clear();
+        freeBatches.clear();
+        vkDestroyCommandPool(device.getDevice(), commandPool, nullptr);
+        commandPool = VK_NULL_HANDLE;
+        ringBuffer.destroy();
+    }
+
+    // Queues a copy of size bytes from data into dst at dstOffset. Nothing reaches the GPU before flush().
+    void upload(VulkanBuffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset){
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        // uploads bigger than half the ring are split so a chunk always fits after a wrap
+        VkDeviceSize maxChunk = capacity / 2;
+        while (size > 0) {
+            VkDeviceSize chunk = std::min(size, maxChunk);
+            VkDeviceSize alignedChunk = (chunk + STAGING_ALIGNMENT - 1) & ~(VkDeviceSize)(STAGING_ALIGNMENT - 1);
+            VkDeviceSize ringOffset = allocate(alignedChunk);
+            ringBuffer.update(src, chunk, ringOffset);
+
+            VkBufferCopy region{};
+            region.srcOffset = ringOffset;
+            region.dstOffset = dstOffset;
+            region.size = chunk;
+            Batch& batch = currentBatch();
+            vkCmdCopyBuffer(batch.commandBuffer, ringBuffer.getBuffer(), dst.getBuffer(), 1, &region);
+            batch.copyCount++;
+
+            src += chunk;
+            dstOffset += chunk;
+            size -= chunk;
+        }
+    }
+
+    // Submits every upload queued since the last flush as one batch. Does not wait.
+    void flush(){
+        CRUMBS_PROFILE_SCOPE("StagingRing::flush");
+        if (recording < 0)
+            return;
+        Batch& batch = batches[recording];
+        if (batch.copyCount == 0) {
+            vkEndCommandBuffer(batch.commandBuffer);
+            freeBatches.push_back(recording);
+            recording = -1;
+            return;
+        }
+
+        // make the copies visible to anything that reads geometry or buffers afterwards on this queue
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(batch.commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                             VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        if (vkEndCommandBuffer(batch.commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error("Failed to record staging command buffer!");
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+        if (vkQueueSubmit(device.getGraphicsQueue(), 1, &submitInfo, batch.fence) != VK_SUCCESS)
+            throw std::runtime_error("Failed to submit staging batch!");
+
+        inFlight.push_back(recording);
+        recording = -1;
+    }
+
+    // Reclaims the ring space of every batch the GPU already finished, without blocking
+    void collect(){
+        while (!inFlight.empty() && vkGetFenceStatus(device.getDevice(), batches[inFlight.front()].fence) == VK_SUCCESS) {
+            retireOldest(false);
+        }
+    }
+
+    void waitIdle(){
+        flush();
+        while (!inFlight.empty()) {
+            retireOldest(true);
+        }
+    }
+
+    bool hasPendingUploads() const{
+        return recording >= 0 && batches[recording].copyCount > 0;
+    }
+};
@@ -1,12 +1,32 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <vulkan_device.hpp>
+#include <vulkan_allocator.hpp>
+#include "debug.hpp"
+
+#define HEADLESS_IMAGE_COUNT 3
+
+enum class VulkanPresentMode {
+    Fifo,      // vsync, every image is shown, the only mode every surface supports
+    Mailbox,   // vsync, a newer image replaces the queued one, no tearing and less latency than Fifo
+    Immediate  // no vsync, lowest latency, may tear
+};
+
+// How the swapchain presents. A mode the surface lacks falls back to Fifo, the image count is clamped
+// to the surface limits.
+struct VulkanPresentPolicy {
+    VulkanPresentMode mode = VulkanPresentMode::Immediate;
+    uint32_t imageCount = 3;
+};
 
 class VulkanSwapchain {
 private:
     VulkanDevice& pDevice;
-    VkSwapchainKHR swapchain;
+    VulkanAllocator& pAllocator;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
     VkExtent2D extent;
     std::vector<VkImage> swapchainImages;
     std::vector<VkImageView> swapchainImageViews;
@@ -15,47 +35,52 @@ private:
     VkImage depthImage;
     VkImageView depthImageView;
     VkFormat depthFormat; 
-    VkDeviceMemory depthMemory;
-public:
-    
-    const VkSwapchainKHR& getSwapchain() const {
-        return swapchain;
-    }
-
-    VkFormat getFormat() const{
-        return colorFormat;
-    }
+    VulkanAllocation depthMemory;
 
-    VkExtent2D getExtent() const{
-        return extent;
-    }
+    bool headless = false;
+    std::vector<VulkanAllocation> offscreenMemory;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
 
-    const std::vector<VkImageView>& getImageViews() const{
-        return swapchainImageViews;
-    }
+    VulkanPresentPolicy presentPolicy;
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR; // the one in use
 
-    const VkImageView& getDepthView() const{
-        return depthImageView;
+    static VkPresentModeKHR toVkPresentMode(VulkanPresentMode mode){
+        switch (mode) {
+            case VulkanPresentMode::Mailbox:   return VK_PRESENT_MODE_MAILBOX_KHR;
+            case VulkanPresentMode::Immediate: return VK_PRESENT_MODE_IMMEDIATE_KHR;
+            default:                           return VK_PRESENT_MODE_FIFO_KHR;
+        }
     }
 
-    const VkFormat& getDepthFormat() const{
-        return depthFormat;
+    // The surface size when the platform fixes it, the requested one clamped to the limits otherwise
+    static VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR& capabilities, uint32_t width, uint32_t height){
+        if (capabilities.currentExtent.width != UINT32_MAX)
+            return capabilities.currentExtent;
+        return {std::clamp(width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width),
+                std::clamp(height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height)};
     }
-    VulkanSwapchain(VulkanDevice& device, VulkanInstance& instance, uint32_t width, uint32_t height): pDevice(device){
-        
-        VkSurfaceKHR surface = instance.getSurface();
 
+    // oldSwapchain (may be null) is retired by the new one, images it already handed out stay
+    // presentable meanwhile. False without creating anything when the surface has no area.
+    bool createSwapchain(VulkanDevice& device, uint32_t width, uint32_t height, VkSwapchainKHR oldSwapchain){
         colorFormat = VK_FORMAT_B8G8R8A8_SRGB; 
         VkSurfaceCapabilitiesKHR surfaceCapabilities;
         vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device.getPhysicalDevice(), surface, &surfaceCapabilities);
+        VkExtent2D surfaceExtent = chooseExtent(surfaceCapabilities, width, height);
+        if (surfaceExtent.width == 0 || surfaceExtent.height == 0)
+            return false; // minimized
 
         VkSwapchainCreateInfoKHR swapchainInfo{};
         swapchainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
         swapchainInfo.surface = surface;
-        swapchainInfo.minImageCount = 3; // triple buffering
+        // maxImageCount 0 means no upper limit
+        uint32_t imageCount = std::max(presentPolicy.imageCount, surfaceCapabilities.minImageCount);
+        if (surfaceCapabilities.maxImageCount > 0)
+            imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+        swapchainInfo.minImageCount = imageCount;
         swapchainInfo.imageFormat = colorFormat; // pick first supported format
         swapchainInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-        swapchainInfo.imageExtent = surfaceCapabilities.currentExtent;
+        swapchainInfo.imageExtent = surfaceExtent;
         swapchainInfo.imageArrayLayers = 1; //just means 2d image
         swapchainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
         swapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -68,18 +93,23 @@ public:
         std::vector<VkPresentModeKHR> availablePresentModes(presentModeCount);
         vkGetPhysicalDeviceSurfacePresentModesKHR(device.getPhysicalDevice(), surface, &presentModeCount, availablePresentModes.data());
         
-        VkPresentModeKHR chosenMode = VK_PRESENT_MODE_FIFO_KHR;
+        VkPresentModeKHR requestedMode = toVkPresentMode(presentPolicy.mode);
+        VkPresentModeKHR chosenMode = VK_PRESENT_MODE_FIFO_KHR; // guaranteed to be available
 
         for (const auto& availableMode : availablePresentModes) {
-            if (availableMode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-                chosenMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            if (availableMode == requestedMode) {
+                chosenMode = requestedMode;
                 break;
             }
         }
+        if (chosenMode != requestedMode) {
+            Debug::LogWarning("Present mode " + std::string(getPresentModeName(requestedMode)) + " isn't supported by the surface, using fifo");
+        }
+        presentMode = chosenMode;
         
-        swapchainInfo.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR; // guaranteed to be available
+        swapchainInfo.presentMode = chosenMode;
         swapchainInfo.clipped = VK_TRUE;
-        swapchainInfo.oldSwapchain = VK_NULL_HANDLE;
+        swapchainInfo.oldSwapchain = oldSwapchain;
         
 
         if (vkCreateSwapchainKHR(device.getDevice(), &swapchainInfo, nullptr, &swapchain) != VK_SUCCESS) {
@@ -88,13 +118,17 @@ public:
 
         extent = swapchainInfo.imageExtent;
 
-        // 1. Get swapchain images (3 because triple buffering)
-        uint32_t imageCount = 0;
+        // 1. Get swapchain images, the driver may create more than asked for
+        imageCount = 0;
         vkGetSwapchainImagesKHR(device.getDevice(), swapchain, &imageCount, nullptr);
         swapchainImages.resize(imageCount);
 
         vkGetSwapchainImagesKHR(device.getDevice(), swapchain, &imageCount, swapchainImages.data());
+        return true;
+    }
 
+    void createImageViews(VulkanDevice& device){
+        uint32_t imageCount = swapchainImages.size();
         // 2. Create image views
         swapchainImageViews.resize(imageCount);
         for (int i = 0; i < imageCount; i++) {
@@ -119,14 +153,16 @@ public:
             
             device.nameObject((uint64_t)swapchainImageViews[i], VK_OBJECT_TYPE_IMAGE_VIEW, "Image View " + std::to_string(i));
         }
-        
+    }
+
+    void createDepthResources(VulkanDevice& device){
         //Depth buffer
         depthFormat = VK_FORMAT_D32_SFLOAT;
         VkImageCreateInfo imageInfo{};
         imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.extent.width  = swapchainInfo.imageExtent.width;
-        imageInfo.extent.height = swapchainInfo.imageExtent.height;
+        imageInfo.extent.width  = extent.width;
+        imageInfo.extent.height = extent.height;
         imageInfo.extent.depth  = 1;
         imageInfo.mipLevels = 1;
         imageInfo.arrayLayers = 1;
@@ -145,17 +181,8 @@ public:
         VkMemoryRequirements memReq; 
         vkGetImageMemoryRequirements(device.getDevice(), depthImage, &memReq);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memReq.size;
-        allocInfo.memoryTypeIndex = device.findMemoryType(
-            memReq.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        );
-
-        
-        vkAllocateMemory(device.getDevice(), &allocInfo, nullptr, &depthMemory);
-        vkBindImageMemory(device.getDevice(), depthImage, depthMemory, 0);
+        depthMemory = pAllocator.allocate(memReq, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VulkanResourceKind::Image);
+        vkBindImageMemory(device.getDevice(), depthImage, depthMemory.memory, depthMemory.offset);
 
         VkImageViewCreateInfo viewInfo{};
         viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -171,11 +198,164 @@ public:
         vkCreateImageView(device.getDevice(), &viewInfo, nullptr, &depthImageView);
 
     }
+
+    // Headless mode : plain device images stand in for the swapchain images so the rest of the
+    // renderer (render pass, framebuffers, command buffers) works unchanged
+    void createOffscreenImages(VulkanDevice& device, uint32_t width, uint32_t height, uint32_t imageCount){
+        colorFormat = VK_FORMAT_R8G8B8A8_SRGB;
+        extent = {width, height};
+        swapchainImages.resize(imageCount);
+        offscreenMemory.resize(imageCount);
+
+        for (uint32_t i = 0; i < imageCount; i++) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent.width  = width;
+            imageInfo.extent.height = height;
+            imageInfo.extent.depth  = 1;
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.format = colorFormat;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT; // transfer src for readback
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateImage(device.getDevice(), &imageInfo, nullptr, &swapchainImages[i]) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create offscreen image!");
+            }
+            device.nameObject((uint64_t)swapchainImages[i], VK_OBJECT_TYPE_IMAGE, "Offscreen Image " + std::to_string(i));
+
+            VkMemoryRequirements memReq; 
+            vkGetImageMemoryRequirements(device.getDevice(), swapchainImages[i], &memReq);
+
+            offscreenMemory[i] = pAllocator.allocate(memReq, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VulkanResourceKind::Image);
+            vkBindImageMemory(device.getDevice(), swapchainImages[i], offscreenMemory[i].memory, offscreenMemory[i].offset);
+        }
+    }
+
+public:
+    const VkSwapchainKHR& getSwapchain() const {
+        return swapchain;
+    }
+
+    bool isHeadless() const{
+        return headless;
+    }
+
+    const std::vector<VkImage>& getImages() const{
+        return swapchainImages;
+    }
+
+    static const char* getPresentModeName(VkPresentModeKHR mode){
+        switch (mode) {
+            case VK_PRESENT_MODE_MAILBOX_KHR:   return "mailbox";
+            case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+            case VK_PRESENT_MODE_FIFO_KHR:      return "fifo";
+            default:                            return "other";
+        }
+    }
+
+    VkPresentModeKHR getPresentMode() const{
+        return presentMode;
+    }
+
+    const VulkanPresentPolicy& getPresentPolicy() const{
+        return presentPolicy;
+    }
+
+    // Applied by the next recreate, headless swapchains ignore it
+    void setPresentPolicy(const VulkanPresentPolicy& policy){
+        presentPolicy = policy;
+    }
+
+    VkFormat getFormat() const{
+        return colorFormat;
+    }
+
+    VkExtent2D getExtent() const{
+        return extent;
+    }
+
+    const std::vector<VkImageView>& getImageViews() const{
+        return swapchainImageViews;
+    }
+
+    const VkImageView& getDepthView() const{
+        return depthImageView;
+    }
+
+    const VkFormat& getDepthFormat() const{
+        return depthFormat;
+    }
+    VulkanSwapchain(VulkanDevice& device, VulkanAllocator& allocator, VulkanInstance& instance, uint32_t width, uint32_t height,
+                    uint32_t headlessImageCount = HEADLESS_IMAGE_COUNT, const VulkanPresentPolicy& policy = {})
+        : pDevice(device), pAllocator(allocator), presentPolicy(policy){
+        headless = instance.isHeadless();
+        if(headless){
+            createOffscreenImages(device, width, height, headlessImageCount);
+        }
+        else{
+            surface = instance.getSurface();
+            if(!createSwapchain(device, width, height, VK_NULL_HANDLE)){
+                throw std::runtime_error("Can't create a swapchain for a surface without area!");
+            }
+        }
+        createImageViews(device);
+        createDepthResources(device);
+    }
     ~VulkanSwapchain(){
         destroy();
     }
 
+    // Rebuilds the images, their views and the depth image at the new surface size, width and height
+    // only count when the platform leaves the size to the swapchain (and in headless mode). The old
+    // swapchain is passed to the new one. The format doesn't change, render passes and pipelines stay
+    // valid. Returns false and keeps nothing when the surface has no area, call again once it has.
+    // The GPU must be done with the previous images.
+    bool recreate(uint32_t width, uint32_t height){
+        destroyImages();
+        if(headless){
+            uint32_t imageCount = swapchainImages.size();
+            swapchainImages.clear();
+            createOffscreenImages(pDevice, width, height, imageCount);
+        }
+        else{
+            VkSwapchainKHR oldSwapchain = swapchain;
+            swapchainImages.clear();
+            bool created = createSwapchain(pDevice, width, height, oldSwapchain);
+            if(oldSwapchain != VK_NULL_HANDLE){
+                vkDestroySwapchainKHR(pDevice.getDevice(), oldSwapchain, nullptr);
+                if(!created)
+                    swapchain = VK_NULL_HANDLE;
+            }
+            if(!created)
+                return false;
+        }
+        createImageViews(pDevice);
+        createDepthResources(pDevice);
+        return true;
+    }
+
+    // False once a recreate hit an empty surface, until one succeeds
+    bool isValid() const{
+        return headless || swapchain != VK_NULL_HANDLE;
+    }
+
     void destroy(){
+        destroyImages();
+        swapchainImages.clear();
+        if(swapchain != VK_NULL_HANDLE){
+            vkDestroySwapchainKHR(pDevice.getDevice(), swapchain, nullptr);
+            swapchain = VK_NULL_HANDLE;
+        }
+    }
+
+private:
+    // Everything sized by the extent but the swapchain itself
+    void destroyImages(){
         for (int i = 0; i < swapchainImageViews.size(); i++) {
             if(swapchainImageViews[i] != VK_NULL_HANDLE){
                 vkDestroyImageView(pDevice.getDevice(), swapchainImageViews[i], nullptr);
@@ -193,14 +373,18 @@ public:
             vkDestroyImage(pDevice.getDevice(), depthImage, nullptr);
             depthImage = VK_NULL_HANDLE;
         }
-        if(depthMemory != VK_NULL_HANDLE){
-            vkFreeMemory(pDevice.getDevice(), depthMemory, nullptr);
-            depthMemory = VK_NULL_HANDLE;
+        pAllocator.free(depthMemory);
+        if(headless){
+            // offscreen images are owned by us, swapchain images by the swapchain
+            for (auto& image : swapchainImages) {
+                vkDestroyImage(pDevice.getDevice(), image, nullptr);
+                image = VK_NULL_HANDLE;
+            }
         }
-        if(swapchain != VK_NULL_HANDLE){
-            vkDestroySwapchainKHR(pDevice.getDevice(), swapchain, nullptr);
-            swapchain = VK_NULL_HANDLE;
+        for (auto& memory : offscreenMemory) {
+            pAllocator.free(memory);
         }
+        offscreenMemory.clear();
     }
 
 };
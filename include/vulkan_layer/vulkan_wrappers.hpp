@@ -1,9 +1,18 @@
+#include "free_list_allocator.hpp"
+#include "vulkan_allocator.hpp"
 #include "vulkan_buffer.hpp"
 #include "vulkan_command_buffers.hpp"
+#include "vulkan_compute_pipeline.hpp"
 #include "vulkan_device.hpp"
+#include "vulkan_frame_context.hpp"
 #include "vulkan_framebuffers.hpp"
+#include "vulkan_geometry_pool.hpp"
+#include "vulkan_gpu_profiler.hpp"
 #include "vulkan_instance.hpp"
 #include "vulkan_pipeline.hpp"
+#include "vulkan_pipeline_cache.hpp"
+#include "vulkan_pipeline_registry.hpp"
 #include "vulkan_render_pass.hpp"
-#include "vulkan_swapchain.hpp"
-#include "vulkan_sync_objects.hpp"
\ No newline at end of file
+#include "vulkan_secondary_recorder.hpp"
+#include "vulkan_staging.hpp"
+#include "vulkan_swapchain.hpp"
\ No newline at end of file
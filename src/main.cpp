@@ -1,22 +1,317 @@
 #define GLFW_INCLUDE_VULKAN
 
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cstring>
 #include "vulkan_renderer.hpp"
 #include "primitive_meshes.hpp"
 using Clock = std::chrono::high_resolution_clock;
 
-int main(){
-    if(!glfwInit()){
-        std::cout << "Failed to initialize GLFW\n";
-        return -1;
+void writePPM(const std::string& path, const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height){
+    std::ofstream file(path, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        file.write(reinterpret_cast<const char*>(&rgba[i * 4]), 3); // drop alpha
     }
-    std::cout << "GLFW initialized!\n";
+}
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+void submitScene(VulkanRenderer& renderer, uint32_t meshIndex, float elapsedTime){
+    renderer.addMeshDrawCall(meshIndex, glm::rotate(glm::translate(glm::mat4(1.0f), {cos(elapsedTime), -1.0f, -4.0f+sin(elapsedTime)}), elapsedTime, {0.0f, 1.0f, 0.0f}));
+    renderer.addMeshDrawCall(meshIndex, glm::rotate(glm::translate(glm::mat4(1.0f), {0.0f, sin(elapsedTime), -4.0f+cos(elapsedTime)}), elapsedTime, {0.0f, 1.0f, 0.0f}));
+}
+
+// Draws with a line variant of the default pipeline, frames drawn before it compiled are filled
+void useWireframe(VulkanRenderer& renderer){
+    if (!renderer.getEnabledFeatures().fillModeNonSolid) {
+        Debug::LogWarning("Wireframe needs the fillModeNonSolid feature, drawing filled");
+        return;
+    }
+    GraphicsPipelineState state = renderer.getDefaultPipelineState();
+    state.polygonMode = VK_POLYGON_MODE_LINE;
+    state.cullMode = VK_CULL_MODE_NONE;
+    renderer.setPipeline(renderer.requestPipeline(state));
+}
+
+// CPU zones of the last frameCount frames as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev
+void writeTrace(const std::string& path, uint32_t frameCount){
+    if (path.empty())
+        return;
+    if (!Profiler::isCompiledIn())
+        Debug::LogWarning("Built without CRUMBS_ENABLE_PROFILER, " + path + " only lists the threads");
+    if (Profiler::writeChromeTrace(path, frameCount))
+        Debug::Log("Trace of the last " + std::to_string(frameCount) + " frames written to " + path);
+    else
+        Debug::LogWarning("Couldn't write trace " + path + ", " + std::to_string(Profiler::getFrameCount()) + " frames recorded");
+}
+
+// Per pass GPU times and pipeline statistics of the last frame the profiler read back
+void logGpuProfile(const VulkanRenderer& renderer){
+    const VulkanGpuProfiler& profiler = renderer.getGpuProfiler();
+    if (!profiler.hasTimings())
+        return;
+    std::string passes;
+    for (const GpuScopeTiming& scope : profiler.getScopeTimings()) {
+        passes += (passes.empty() ? "" : ", ") + scope.name + " " + std::to_string(scope.milliseconds) + "ms";
+    }
+    Debug::Log("GPU : " + passes);
+    if (profiler.supportsStatistics()) {
+        const GpuPipelineStats& stats = profiler.getPipelineStats();
+        Debug::Log("GPU : " + std::to_string(stats.vertexInvocations) + " vertex, " + std::to_string(stats.fragmentInvocations) + " fragment, "
+                   + std::to_string(stats.computeInvocations) + " compute invocations, " + std::to_string(stats.clippingPrimitives) + " primitives after clipping");
+    }
+}
+
+// Renders a fixed number of frames without a window, reports throughput and dumps the last frame
+int runHeadless(uint32_t width, uint32_t height, uint32_t frameCount, const std::string& outputPath, const glm::mat4& view,
+                VertexFormat vertexFormat, float lodThreshold, bool meshletCulling, bool wireframe, bool gpuProfile,
+                const std::string& tracePath, uint32_t traceFrames){
+    VulkanRenderer renderer (width, height, DEFAULT_FRAMES_IN_FLIGHT, vertexFormat);
+    renderer.setGpuProfilingEnabled(gpuProfile);
+    renderer.setLodThreshold(lodThreshold);
+    renderer.setMeshletCullingEnabled(meshletCulling);
+    if (wireframe) useWireframe(renderer);
+
+    MeshCache meshCache;
+    auto teapot = meshCache.load("teapot.fbx", importMesh); // imported once, mapped from the cache after
+    renderer.initSceneData(view, {0.0f, 1.0f, 1.0f}, {0.2f, 0.9f, 0.3f});
+    uint32_t quadIndex = renderer.loadMesh(*teapot);
+
+    auto startTime = Clock::now();
+    for (uint32_t frame = 0; frame < frameCount; ++frame) {
+        submitScene(renderer, quadIndex, frame / 60.0f); // fixed timestep so the output is deterministic
+        renderer.drawFrame();
+    }
+    std::vector<uint8_t> pixels;
+    renderer.readFrame(pixels); // waits for the last frame
+    float seconds = std::chrono::duration<float>(Clock::now() - startTime).count();
+
+    Debug::Log("Headless : " + std::to_string(frameCount) + " frames in " + std::to_string(seconds) + "s (" + std::to_string(frameCount / seconds) + " fps)");
+    const FramePacingStats& pacing = renderer.getPacingStats();
+    Debug::Log("Pacing : last frame " + std::to_string(pacing.cpuWorkMs) + "ms CPU work, " + std::to_string(pacing.gpuWaitMs) + "ms waiting on the GPU");
+    const LodStats& lodStats = renderer.getLodStats();
+    Debug::Log("LOD : " + std::to_string(lodStats.trianglesDrawn) + " triangles drawn, " + std::to_string(lodStats.trianglesSaved) + " saved in the last frame");
+    if (gpuProfile) logGpuProfile(renderer);
+    writeTrace(tracePath, traceFrames);
+    if (!outputPath.empty()) {
+        writePPM(outputPath, pixels, width, height);
+        Debug::Log("Last frame written to " + outputPath);
+    }
+    renderer.destroy();
+    return 0;
+}
+
+// Times how long recording drawCount draws into secondary command buffers takes for every thread count,
+// each configuration averaged over a few frames. 0 for drawCount or threadCount runs the whole sweep.
+int runRecordBenchmark(uint32_t drawCount, uint32_t threadCount){
+    VulkanRenderer renderer (64, 64);
+    uint32_t meshIndex = renderer.loadMesh(generateTetrahedron());
+
+    std::vector<uint32_t> drawCounts = {1000, 10000, 100000};
+    if (drawCount > 0) drawCounts = {drawCount};
+    std::vector<uint32_t> threadCounts;
+    if (threadCount > 0) threadCounts = {threadCount};
+    else for (uint32_t t = 1; t <= std::max(1u, std::thread::hardware_concurrency()); t *= 2) threadCounts.push_back(t);
+
+    const uint32_t iterations = 20;
+    for (uint32_t draws : drawCounts) {
+        float singleThreadMs = 0.0f;
+        for (uint32_t threads : threadCounts) {
+            renderer.setRecordThreadCount(threads);
+            renderer.recordSyntheticDraws(meshIndex, draws); // warm up, the pools allocate their memory here
+
+            auto startTime = Clock::now();
+            for (uint32_t i = 0; i < iterations; ++i) {
+                renderer.recordSyntheticDraws(meshIndex, draws);
+            }
+            float ms = std::chrono::duration<float, std::milli>(Clock::now() - startTime).count() / iterations;
+            if (threads == threadCounts[0]) singleThreadMs = ms;
+
+            Debug::Log("Record : " + std::to_string(draws) + " draws, " + std::to_string(threads) + " threads : "
+                       + std::to_string(ms) + "ms (x" + std::to_string(singleThreadMs / ms) + ")");
+        }
+    }
+    renderer.destroy();
+    return 0;
+}
+
+// Runs the same batch of independent CPU bound jobs with 1, 2, 4 ... 32 threads (capped by the cores
+// available) and reports the speedup over one thread. 0 for threadCount runs the whole sweep.
+int runJobBenchmark(uint32_t threadCount){
+    std::vector<uint32_t> threadCounts;
+    if (threadCount > 0) threadCounts = {threadCount};
+    else for (uint32_t t = 1; t <= std::min(32u, std::max(1u, std::thread::hardware_concurrency())); t *= 2) threadCounts.push_back(t);
+
+    const uint32_t jobCount = 1024;
+    std::vector<float> results(jobCount);
+    float singleThreadMs = 0.0f;
+    for (uint32_t threads : threadCounts) {
+        JobSystem jobs(threads);
+        auto startTime = Clock::now();
+        JobCounter counter;
+        for (uint32_t j = 0; j < jobCount; ++j) {
+            jobs.run([&results, j]{
+                float x = j;
+                for (int i = 0; i < 200000; ++i) x = std::sqrt(x * x + 1.0f) * 0.999f;
+                results[j] = x;
+            }, &counter);
+        }
+        jobs.wait(counter);
+        float ms = std::chrono::duration<float, std::milli>(Clock::now() - startTime).count();
+        if (threads == threadCounts[0]) singleThreadMs = ms;
+
+        Debug::Log("Jobs : " + std::to_string(jobCount) + " jobs, " + std::to_string(threads) + " threads : "
+                   + std::to_string(ms) + "ms (x" + std::to_string(singleThreadMs / ms) + ")");
+    }
+    return 0;
+}
+
+// Creates a headless renderer twice, the first time without a pipeline cache file and the second time
+// from the one the first wrote back, and reports both startup times
+int runStartupBenchmark(){
+    std::remove(PIPELINE_CACHE_FILE);
+    const char* runNames[] = {"cold", "warm"};
+    for (const char* run : runNames) {
+        auto startTime = Clock::now();
+        VulkanRenderer renderer (64, 64);
+        float ms = std::chrono::duration<float, std::milli>(Clock::now() - startTime).count();
+        const VulkanPipelineCache& pipelineCache = renderer.getPipelineCache();
+        Debug::Log("Startup " + std::string(run) + " (" + (pipelineCache.isWarm() ? "cache loaded" : "no cache") + ") : " + std::to_string(ms) + "ms, "
+                   + std::to_string(pipelineCache.getBuildMilliseconds()) + "ms of it building " + std::to_string(pipelineCache.getPipelineCount()) + " pipelines");
+        renderer.destroy(); // writes the cache for the warm run
+    }
+    return 0;
+}
+
+// Resizes a headless renderer back and forth between a few sizes, drawing a frame after each, and
+// reports how long the swapchain recreations took
+int runResizeBenchmark(uint32_t frameCount){
+    VulkanRenderer renderer (800, 600);
+    uint32_t meshIndex = renderer.loadMesh(generateTetrahedron());
+    renderer.initSceneData(glm::lookAt(glm::vec3(0.0f, 0.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+                           {0.0f, 1.0f, 1.0f}, {0.2f, 0.9f, 0.3f});
+
+    const VkExtent2D sizes[] = {{1280, 720}, {640, 480}, {1920, 1080}, {800, 600}};
+    float totalMs = 0.0f, maxMs = 0.0f;
+    for (uint32_t i = 0; i < frameCount; ++i) {
+        renderer.resize(sizes[i % 4].width, sizes[i % 4].height);
+        submitScene(renderer, meshIndex, i / 60.0f);
+        renderer.drawFrame();
+        totalMs += renderer.getLastResizeMilliseconds();
+        maxMs = std::max(maxMs, renderer.getLastResizeMilliseconds());
+    }
+    Debug::Log("Resize : " + std::to_string(renderer.getResizeCount()) + " recreations, " + std::to_string(totalMs / std::max(frameCount, 1u))
+               + "ms average, " + std::to_string(maxMs) + "ms max");
+    renderer.destroy();
+    return 0;
+}
+
+// Average cost of an empty profiler zone, on one thread then on every core at once
+int runProfilerBenchmark(){
+    if (!Profiler::isCompiledIn()) {
+        Debug::LogWarning("Built without CRUMBS_ENABLE_PROFILER, zones cost nothing");
+        return 0;
+    }
+    const uint32_t zoneCount = 10000000;
+    auto measure = [zoneCount]{
+        auto startTime = Clock::now();
+        for (uint32_t i = 0; i < zoneCount; ++i) {
+            CRUMBS_PROFILE_SCOPE("Empty Zone");
+        }
+        return std::chrono::duration<float, std::nano>(Clock::now() - startTime).count() / zoneCount;
+    };
+    measure(); // warm up, the ring of the thread is allocated here
+    Debug::Log("Profiler : " + std::to_string(measure()) + "ns per zone on one thread");
+
+    uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<float> results(threadCount);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&results, &measure, t]{ measure(); results[t] = measure(); });
+    }
+    float worst = 0.0f;
+    for (uint32_t t = 0; t < threadCount; ++t) {
+        threads[t].join();
+        worst = std::max(worst, results[t]);
+    }
+    Debug::Log("Profiler : " + std::to_string(worst) + "ns per zone at worst on " + std::to_string(threadCount) + " threads");
+    return 0;
+}
+
+int main(int argc, char** argv){
+    CRUMBS_PROFILE_THREAD("Main");
+    bool headless = false;
+    bool benchRecord = false;
+    bool benchJobs = false;
+    bool benchStartup = false;
+    bool benchResize = false;
+    bool benchProfiler = false;
+    uint32_t drawCount = 0;
+    uint32_t threadCount = 0;
+    uint32_t frameCount = 100;
+    std::string outputPath = "frame.ppm";
+    VertexFormat vertexFormat = VertexFormat::Float;
+    float lodThreshold = LOD_ERROR_THRESHOLD;
+    VulkanPresentPolicy presentPolicy;
+    float fpsLimit = 0.0f;
+    uint32_t maxQueuedFrames = DEFAULT_FRAMES_IN_FLIGHT;
+    bool meshletCulling = true;
+    bool wireframe = false;
+    bool gpuProfile = false;
+    std::string tracePath;
+    uint32_t traceFrames = 10;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frameCount = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) outputPath = argv[++i];
+        else if (strcmp(argv[i], "--bench-record") == 0) benchRecord = true;
+        else if (strcmp(argv[i], "--bench-jobs") == 0) benchJobs = true;
+        else if (strcmp(argv[i], "--bench-startup") == 0) benchStartup = true;
+        else if (strcmp(argv[i], "--bench-resize") == 0) benchResize = true;
+        else if (strcmp(argv[i], "--bench-profiler") == 0) benchProfiler = true;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) tracePath = argv[++i];
+        else if (strcmp(argv[i], "--trace-frames") == 0 && i + 1 < argc) traceFrames = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--draws") == 0 && i + 1 < argc) drawCount = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threadCount = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--lod-threshold") == 0 && i + 1 < argc) lodThreshold = std::stof(argv[++i]);
+        else if (strcmp(argv[i], "--no-meshlets") == 0) meshletCulling = false;
+        else if (strcmp(argv[i], "--wireframe") == 0) wireframe = true;
+        else if (strcmp(argv[i], "--gpu-profile") == 0) gpuProfile = true;
+        else if (strcmp(argv[i], "--vertex-format") == 0 && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "compact") vertexFormat = VertexFormat::Compact;
+            else if (format == "compact-color") vertexFormat = VertexFormat::CompactColor;
+            else if (format != "float") std::cout << "Unknown vertex format " << format << ", using float\n";
+        }
+        else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "fifo") presentPolicy.mode = VulkanPresentMode::Fifo;
+            else if (mode == "mailbox") presentPolicy.mode = VulkanPresentMode::Mailbox;
+            else if (mode == "immediate") presentPolicy.mode = VulkanPresentMode::Immediate;
+            else std::cout << "Unknown present mode " << mode << ", using immediate\n";
+        }
+        else if (strcmp(argv[i], "--images") == 0 && i + 1 < argc) presentPolicy.imageCount = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--fps-limit") == 0 && i + 1 < argc) fpsLimit = std::stof(argv[++i]);
+        else if (strcmp(argv[i], "--max-queued-frames") == 0 && i + 1 < argc) maxQueuedFrames = std::stoul(argv[++i]);
+    }
+
+    if(benchRecord){
+        return runRecordBenchmark(drawCount, threadCount);
+    }
+    if(benchJobs){
+        return runJobBenchmark(threadCount);
+    }
+    if(benchStartup){
+        return runStartupBenchmark();
+    }
+    if(benchResize){
+        return runResizeBenchmark(frameCount);
+    }
+    if(benchProfiler){
+        return runProfilerBenchmark();
+    }
 
     uint32_t width = 800;
     uint32_t height = 600;
-    GLFWwindow* window = glfwCreateWindow(width, height, "Vulkan Window", nullptr, nullptr); 
 
     glm::mat4 view = glm::lookAt(
         glm::vec3(0.0f, 0.0f, 2.0f), // camera position
@@ -24,32 +319,87 @@ int main(){
         glm::vec3(0.0f, 1.0f, 0.0f)  // up vector
     );
 
-    VulkanRenderer renderer (window, width, height);
+    if(headless){
+        return runHeadless(width, height, frameCount, outputPath, view, vertexFormat, lodThreshold, meshletCulling, wireframe, gpuProfile, tracePath, traceFrames);
+    }
+
+    if(!glfwInit()){
+        std::cout << "Failed to initialize GLFW\n";
+        return -1;
+    }
+    std::cout << "GLFW initialized!\n";
+
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
-    Mesh tetrahedron = importMesh("teapot.fbx");
+    GLFWwindow* window = glfwCreateWindow(width, height, "Vulkan Window", nullptr, nullptr);
+
+    VulkanRenderer renderer (window, width, height, DEFAULT_FRAMES_IN_FLIGHT, vertexFormat, presentPolicy);
+    renderer.setFrameRateLimit(fpsLimit);
+    renderer.setMaxQueuedFrames(maxQueuedFrames);
+    renderer.setLodThreshold(lodThreshold);
+    renderer.setMeshletCullingEnabled(meshletCulling);
+    renderer.setGpuProfilingEnabled(gpuProfile);
+    if (wireframe) useWireframe(renderer);
+    glfwSetWindowUserPointer(window, &renderer);
+    glfwSetFramebufferSizeCallback(window, [](GLFWwindow* resized, int newWidth, int newHeight){
+        static_cast<VulkanRenderer*>(glfwGetWindowUserPointer(resized))->resize(newWidth, newHeight);
+    });
+
+    MeshCache meshCache;
+    auto teapot = meshCache.load("teapot.fbx", importMesh);
     renderer.initSceneData(view, {0.0f, 1.0f, 1.0f}, {0.2f, 0.9f, 0.3f});
-    
-    uint32_t quadIndex = renderer.loadMesh(tetrahedron);
+
+    uint32_t quadIndex = renderer.loadMesh(*teapot);
     glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.3f, 0, -3.0f));
-    
-    float elapsedTime = 0; 
+
+    float elapsedTime = 0;
     auto lastTime = Clock::now();
 
+    // pacing reported once per second, averaged over its frames
+    FramePacingStats pacingSum{};
+    uint32_t pacingFrames = 0;
+    float pacingTime = 0.0f;
+
     while(!glfwWindowShouldClose(window)){
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        if(framebufferWidth == 0 || framebufferHeight == 0){
+            glfwWaitEvents(); // minimized, nothing to present until it is restored
+            lastTime = Clock::now();
+            continue;
+        }
+        renderer.waitFrame(); // paced before the input is sampled
+        glfwPollEvents();
         auto currentTime = Clock::now();
         float deltaTime = std::chrono::duration<float>(currentTime - lastTime).count(); // in seconds
         lastTime = currentTime;
         elapsedTime += deltaTime;
 
-        //Debug::Log(std::to_string(1/deltaTime));
-        renderer.addMeshDrawCall(quadIndex, glm::rotate(glm::translate(glm::mat4(1.0f), {cos(elapsedTime), -1.0f, -4.0f+sin(elapsedTime)}), elapsedTime, {0.0f, 1.0f, 0.0f}));
-         renderer.addMeshDrawCall(quadIndex, glm::rotate(glm::translate(glm::mat4(1.0f), {0.0f, sin(elapsedTime), -4.0f+cos(elapsedTime)}), elapsedTime, {0.0f, 1.0f, 0.0f}));
+        submitScene(renderer, quadIndex, elapsedTime);
         renderer.drawFrame();
-        glfwPollEvents();
+
+        const FramePacingStats& pacing = renderer.getPacingStats();
+        pacingSum.limiterWaitMs += pacing.limiterWaitMs;
+        pacingSum.gpuWaitMs += pacing.gpuWaitMs;
+        pacingSum.acquireWaitMs += pacing.acquireWaitMs;
+        pacingSum.cpuWorkMs += pacing.cpuWorkMs;
+        pacingFrames++;
+        pacingTime += deltaTime;
+        if (pacingTime >= 1.0f) {
+            Debug::Log("Pacing : " + std::to_string(pacingFrames / pacingTime) + " fps, per frame " + std::to_string(pacingSum.cpuWorkMs / pacingFrames) + "ms CPU work, waits "
+                       + std::to_string(pacingSum.limiterWaitMs / pacingFrames) + "ms limiter, " + std::to_string(pacingSum.gpuWaitMs / pacingFrames) + "ms GPU, "
+                       + std::to_string(pacingSum.acquireWaitMs / pacingFrames) + "ms acquire");
+            if (gpuProfile) logGpuProfile(renderer);
+            pacingSum = {};
+            pacingFrames = 0;
+            pacingTime = 0.0f;
+        }
     }
 
+    writeTrace(tracePath, traceFrames); // the frames before the window closed
     renderer.destroy();
     glfwDestroyWindow(window);
     glfwTerminate();
 
-}
\ No newline at end of file
+}
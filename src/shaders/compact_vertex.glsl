@@ -0,0 +1,70 @@
+// Body of the compact vertex shaders, included after HAS_COLOR is defined or not.
+// Same outputs as test.vert.glsl.
+
+layout(location = 0) in vec4 inPos;     // [0, 1] over the mesh bounds
+#ifdef HAS_COLOR
+layout(location = 1) in vec4 inColor;
+#endif
+layout(location = 2) in vec2 inNormal;  // octahedral
+
+layout(location = 0) out vec3 outNormal;
+layout(location = 1) out vec3 fragWorldPos;
+layout(location = 2) out vec3 outColor;
+
+// Scene UBO (set = 0)
+layout(set = 0, binding = 0) uniform SceneUBO {
+    mat4 view;
+    mat4 proj;
+    vec3 lightPos;
+    vec3 lightColor;
+} scene;
+
+// Per-object transforms in submission order (set = 1)
+layout(std430, set = 1, binding = 0) readonly buffer ObjectsSB {
+    mat4 models[];
+} objects;
+
+// Draw index of every instance, grouped by mesh (set = 1)
+layout(std430, set = 1, binding = 1) readonly buffer InstanceIndicesSB {
+    uint indices[];
+} instances;
+
+// Mesh index and indirect command slot of every object (set = 1)
+layout(std430, set = 1, binding = 2) readonly buffer ObjectMeshesSB {
+    uvec2 meshAndSlot[];
+} objectMeshes;
+
+// Position dequantization of every mesh : offset + inPos * scale (set = 1)
+struct MeshQuantization {
+    vec4 offset;
+    vec4 scale;
+};
+layout(std430, set = 1, binding = 3) readonly buffer MeshQuantizationSB {
+    MeshQuantization meshes[];
+} quantization;
+
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    uint objectIndex = instances.indices[gl_InstanceIndex];
+    mat4 model = objects.models[objectIndex];
+    MeshQuantization meshQuantization = quantization.meshes[objectMeshes.meshAndSlot[objectIndex].x];
+
+    vec3 pos = meshQuantization.offset.xyz + inPos.xyz * meshQuantization.scale.xyz;
+    vec4 worldPos = model * vec4(pos, 1.0);
+    gl_Position = scene.proj * scene.view * worldPos;
+    mat3 normalMatrix = transpose(inverse(mat3(model)));
+    outNormal = normalize(normalMatrix * decodeOctahedral(inNormal));
+    fragWorldPos = worldPos.xyz;
+#ifdef HAS_COLOR
+    outColor = inColor.rgb;
+#else
+    outColor = vec3(1.0);
+#endif
+}
@@ -0,0 +1,73 @@
+#version 450
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int  vertexOffset;
+    uint firstInstance;
+};
+
+// Per-object transforms in submission order
+layout(std430, set = 0, binding = 0) readonly buffer ObjectsSB {
+    mat4 models[];
+} objects;
+
+// Mesh index and indirect command slot of every object, MESHLET_DRAW for objects drawn per meshlet
+#define MESHLET_DRAW 0xFFFFFFFFu
+layout(std430, set = 0, binding = 1) readonly buffer ObjectCullSB {
+    uvec2 meshAndSlot[];
+} cullInputs;
+
+// Model space bounding sphere of every mesh
+layout(std430, set = 0, binding = 2) readonly buffer MeshBoundsSB {
+    vec4 spheres[];
+} meshBounds;
+
+// Indirect slice of the frame : draw count, then the commands. instanceCount starts at 0
+layout(std430, set = 0, binding = 3) buffer IndirectSB {
+    uint drawCount;
+    uint pad0, pad1, pad2;
+    DrawCommand commands[];
+} indirect;
+
+layout(std430, set = 0, binding = 4) writeonly buffer InstanceIndicesSB {
+    uint indices[];
+} instances;
+
+layout(push_constant) uniform CullParams {
+    vec4 frustumPlanes[6];
+    vec4 cameraPosition;
+    uint objectCount;
+    uint meshletDrawCount;
+} params;
+
+void main() {
+    uint objectIndex = gl_GlobalInvocationID.x;
+    if (objectIndex >= params.objectCount) {
+        return;
+    }
+    uvec2 meshAndSlot = cullInputs.meshAndSlot[objectIndex];
+    if (meshAndSlot.y == MESHLET_DRAW) {
+        return; // culled per meshlet by meshlet_cull.comp.glsl
+    }
+    vec4 sphere = meshBounds.spheres[meshAndSlot.x];
+    mat4 model = objects.models[objectIndex];
+
+    // world space sphere, the radius follows the largest axis scale
+    vec3 center = (model * vec4(sphere.xyz, 1.0)).xyz;
+    float maxScale = max(max(dot(model[0].xyz, model[0].xyz), dot(model[1].xyz, model[1].xyz)), dot(model[2].xyz, model[2].xyz));
+    float radius = sphere.w * sqrt(maxScale);
+
+    for (int p = 0; p < 6; ++p) {
+        if (dot(params.frustumPlanes[p].xyz, center) + params.frustumPlanes[p].w < -radius) {
+            return;
+        }
+    }
+
+    // survivors are compacted at the start of their mesh run
+    uint slot = atomicAdd(indirect.commands[meshAndSlot.y].instanceCount, 1);
+    instances.indices[indirect.commands[meshAndSlot.y].firstInstance + slot] = objectIndex;
+}
@@ -0,0 +1,96 @@
+#version 450
+
+// One workgroup per meshlet draw, its invocations go through the meshlets of the mesh
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int  vertexOffset;
+    uint firstInstance;
+};
+
+struct MeshletBounds {
+    vec4 sphere;      // model space
+    vec4 cone;        // axis, cutoff
+    uint firstIndex;  // relative to the mesh indices
+    uint indexCount;
+    uint pad0, pad1;
+};
+
+struct MeshletDraw {
+    uint objectIndex;
+    uint instanceSlot;  // firstInstance of the commands, the instance index holding objectIndex
+    uint firstMeshlet;
+    uint meshletCount;
+    uint commandBase;   // command of the first meshlet, the others follow
+    uint indexOffset;
+    int  vertexOffset;
+    uint pad;
+};
+
+// Per-object transforms in submission order
+layout(std430, set = 0, binding = 0) readonly buffer ObjectsSB {
+    mat4 models[];
+} objects;
+
+// Indirect slice of the frame : draw count, then the commands. Meshlet commands are all written here
+layout(std430, set = 0, binding = 3) buffer IndirectSB {
+    uint drawCount;
+    uint pad0, pad1, pad2;
+    DrawCommand commands[];
+} indirect;
+
+layout(std430, set = 0, binding = 5) readonly buffer MeshletSB {
+    MeshletBounds meshlets[];
+} meshlets;
+
+layout(std430, set = 0, binding = 6) readonly buffer MeshletDrawSB {
+    MeshletDraw draws[];
+} meshletDraws;
+
+layout(push_constant) uniform CullParams {
+    vec4 frustumPlanes[6];
+    vec4 cameraPosition;
+    uint objectCount;
+    uint meshletDrawCount;
+} params;
+
+shared mat4 model;
+shared float maxScale;
+shared vec3 cameraModel; // camera in model space, where the cones are
+
+void main() {
+    MeshletDraw draw = meshletDraws.draws[gl_WorkGroupID.x];
+    if (gl_LocalInvocationIndex == 0) {
+        model = objects.models[draw.objectIndex];
+        maxScale = sqrt(max(max(dot(model[0].xyz, model[0].xyz), dot(model[1].xyz, model[1].xyz)), dot(model[2].xyz, model[2].xyz)));
+        cameraModel = (inverse(model) * vec4(params.cameraPosition.xyz, 1.0)).xyz;
+    }
+    barrier();
+
+    for (uint m = gl_LocalInvocationIndex; m < draw.meshletCount; m += gl_WorkGroupSize.x) {
+        MeshletBounds meshlet = meshlets.meshlets[draw.firstMeshlet + m];
+        bool visible = true;
+
+        // back facing : every triangle normal points away from the camera
+        vec3 toCenter = meshlet.sphere.xyz - cameraModel;
+        if (dot(toCenter, meshlet.cone.xyz) >= meshlet.cone.w * length(toCenter) + meshlet.sphere.w) {
+            visible = false;
+        }
+
+        vec3 center = (model * vec4(meshlet.sphere.xyz, 1.0)).xyz;
+        float radius = meshlet.sphere.w * maxScale;
+        for (int p = 0; p < 6; ++p) {
+            if (dot(params.frustumPlanes[p].xyz, center) + params.frustumPlanes[p].w < -radius) {
+                visible = false;
+            }
+        }
+
+        // every meshlet keeps its command, culled ones draw no instance
+        indirect.commands[draw.commandBase + m] = DrawCommand(meshlet.indexCount, visible ? 1u : 0u,
+                                                              draw.indexOffset + meshlet.firstIndex, draw.vertexOffset,
+                                                              draw.instanceSlot);
+    }
+}
@@ -2,6 +2,7 @@
 
 layout(location = 0) in vec3 vertNormal;
 layout(location = 1) in vec3 fragWorldPos;
+layout(location = 2) in vec3 vertColor;
 
 layout(location = 0) out vec4 outColor;
 
@@ -13,10 +14,6 @@ layout(set = 0, binding = 0) uniform SceneUBO {
     vec3 lightColor;
 } scene;
 
-// Per-object UBO (if you want to use normals, not mandatory yet)
-layout(set = 1, binding = 0) uniform ObjectUBO {
-    mat4 model;
-} object;
 float saturate(float x){
     if(x < 0){
         return 0;
@@ -45,6 +42,6 @@ float computeSpecularLight(){
 void main() {
     float diff = max(dot(vertNormal, scene.lightDir), 0.0);
 
-    vec3 color = scene.lightColor * (computeSpecularLight() + diff);
+    vec3 color = vertColor * scene.lightColor * (computeSpecularLight() + diff);
     outColor = vec4(color, 1.0);
 }
@@ -6,6 +6,7 @@ layout(location = 2) in vec3 inNormal;
 
 layout(location = 0) out vec3 outNormal;
 layout(location = 1) out vec3 fragWorldPos;
+layout(location = 2) out vec3 outColor;
 
 // Scene UBO (set = 0)
 layout(set = 0, binding = 0) uniform SceneUBO {
@@ -15,16 +16,24 @@ layout(set = 0, binding = 0) uniform SceneUBO {
     vec3 lightColor;
 } scene;
 
-// Per-object UBO (set = 1, dynamic)
-layout(set = 1, binding = 0) uniform ObjectUBO {
-    mat4 model;
-} object;
+// Per-object transforms in submission order (set = 1)
+layout(std430, set = 1, binding = 0) readonly buffer ObjectsSB {
+    mat4 models[];
+} objects;
+
+// Draw index of every instance, grouped by mesh (set = 1)
+layout(std430, set = 1, binding = 1) readonly buffer InstanceIndicesSB {
+    uint indices[];
+} instances;
 
 void main() {
-    vec4 worldPos = object.model * vec4(inPos, 1.0);
+    // gl_InstanceIndex already includes the firstInstance of the draw
+    mat4 model = objects.models[instances.indices[gl_InstanceIndex]];
+    vec4 worldPos = model * vec4(inPos, 1.0);
     gl_Position = scene.proj * scene.view * worldPos;
-    mat3 normalMatrix = transpose(inverse(mat3(object.model)));
+    mat3 normalMatrix = transpose(inverse(mat3(model)));
     outNormal = normalize(normalMatrix * inNormal);
     fragWorldPos = worldPos.xyz;
+    outColor = inColor;
     
 }
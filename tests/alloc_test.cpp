@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include "vulkan_renderer.hpp"
+#include "primitive_meshes.hpp"
+
+// Every C++ heap allocation of the test, on any thread, goes through the replaced operator new
+// below and is counted. new[], nothrow and aligned nothrow new forward to the plain and aligned
+// overloads. Driver allocations made with malloc aren't counted. Built without sanitizers, the
+// replacement would hide their own interposition.
+static std::atomic<uint64_t> heapAllocations{0};
+
+void* operator new(std::size_t size){
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment){
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t align = static_cast<std::size_t>(alignment);
+    // aligned_alloc wants a size multiple of the alignment
+    if (void* memory = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept{
+    std::free(memory);
+}
+
+// Draws drawCount objects per frame without a window and fails unless frameCount frames in steady
+// state allocate nothing on the heap. The warm up lets every frame in flight, the per frame vectors
+// and the profiler rings reach their size, and covers a shader reload check. Large draw counts go
+// through the secondary recorder on the draw paths that split draws. The GPU profiler stays off.
+int runAllocTest(uint32_t frameCount, uint32_t drawCount){
+    VulkanRenderer renderer (64, 64);
+    uint32_t meshIndex = renderer.loadMesh(generateTetrahedron());
+    renderer.initSceneData(glm::lookAt(glm::vec3(0.0f, 0.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+                           {0.0f, 1.0f, 1.0f}, {0.2f, 0.9f, 0.3f});
+    drawCount = std::min<uint32_t>(drawCount, MAX_OBJECTS);
+    frameCount = std::max<uint32_t>(frameCount, 2 * SHADER_RELOAD_CHECK_INTERVAL); // at least one reload check counted
+
+    auto drawFrames = [&](uint32_t frames){
+        for (uint32_t frame = 0; frame < frames; ++frame) {
+            for (uint32_t d = 0; d < drawCount; ++d) {
+                glm::vec3 position((d % 64) * 0.05f - 1.6f, (d / 64 % 64) * 0.05f - 1.6f, -4.0f - d / 4096);
+                renderer.addMeshDrawCall(meshIndex, glm::rotate(glm::translate(glm::mat4(1.0f), position), frame / 60.0f, {0.0f, 1.0f, 0.0f}));
+            }
+            renderer.drawFrame();
+        }
+    };
+    drawFrames(SHADER_RELOAD_CHECK_INTERVAL + 2 * renderer.getFramesInFlight());
+
+    uint64_t before = heapAllocations.load();
+    drawFrames(frameCount);
+    uint64_t allocations = heapAllocations.load() - before;
+
+    std::string result = std::to_string(allocations) + " heap allocations in " + std::to_string(frameCount) + " frames of "
+                         + std::to_string(drawCount) + " draws";
+    renderer.destroy();
+    if (allocations != 0) {
+        Debug::LogError("Allocations : " + result + ", steady state frames must not allocate");
+        return 1;
+    }
+    Debug::Log("Allocations : " + result);
+    return 0;
+}
+
+int main(int argc, char** argv){
+    uint32_t frameCount = 100;
+    uint32_t drawCount = 4096;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frameCount = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--draws") == 0 && i + 1 < argc) drawCount = std::stoul(argv[++i]);
+    }
+    return runAllocTest(frameCount, drawCount);
+}
@@ -0,0 +1,113 @@
+#define GLFW_INCLUDE_VULKAN
+
+#include <GLFW/glfw3.h>
+#include <memory>
+#include "vulkan_instance.hpp"
+#include "vulkan_device.hpp"
+#include "vulkan_allocator.hpp"
+#include "vulkan_buffer.hpp"
+
+#define ALLOCATOR_TEST_BUFFER_SIZE (4ull * 1024 * 1024)
+
+bool check(bool condition, const std::string& what){
+    if (!condition)
+        Debug::LogError("Allocator test : " + what);
+    return condition;
+}
+
+// Linear blocks keep freed space dead until every allocation in them is gone, then start over
+bool testLinear(VulkanAllocator& allocator){
+    VulkanAllocatorStats empty = allocator.getStats();
+    std::vector<std::unique_ptr<VulkanBuffer>> buffers;
+    for (uint32_t i = 0; i < 8; ++i) {
+        buffers.push_back(std::make_unique<VulkanBuffer>(allocator, VulkanBufferType::Uniform, 64 * 1024, nullptr, false, 0, "Linear Buffer",
+                                                         VulkanMemoryPlacement::HostVisible, VulkanAllocationStrategy::Linear));
+    }
+    for (uint32_t i = 1; i < buffers.size(); ++i) {
+        if (!check(buffers[i]->getAllocation().offset > buffers[i - 1]->getAllocation().offset, "linear allocations aren't bumped forward"))
+            return false;
+    }
+
+    VulkanAllocatorStats full = allocator.getStats();
+    buffers[0].reset();
+    buffers[3].reset();
+    VulkanAllocatorStats holes = allocator.getStats();
+    if (!check(holes.bytesFree == full.bytesFree && holes.bytesWasted >= full.bytesWasted + 2 * 64 * 1024, "freed linear space was reused"))
+        return false;
+
+    buffers.clear();
+    VulkanAllocatorStats reset = allocator.getStats();
+    return check(reset.blockCount == empty.blockCount + 1 && reset.bytesFree == reset.bytesAllocated - empty.bytesAllocated + empty.bytesFree,
+                 "emptied linear block wasn't reset");
+}
+
+// Fills a second block, frees every other buffer of the first and moves the second one into the holes
+bool testDefragment(VulkanAllocator& allocator){
+    std::vector<std::unique_ptr<VulkanBuffer>> buffers;
+    auto createBuffer = [&]{
+        buffers.push_back(std::make_unique<VulkanBuffer>(allocator, VulkanBufferType::Storage, ALLOCATOR_TEST_BUFFER_SIZE, nullptr, false, 0,
+                                                         "Defragment Buffer " + std::to_string(buffers.size())));
+        uint32_t* words = buffers.back()->data<uint32_t>();
+        for (size_t w = 0; w < ALLOCATOR_TEST_BUFFER_SIZE / sizeof(uint32_t); ++w) {
+            words[w] = buffers.size() * 1000003u + w;
+        }
+    };
+    createBuffer();
+    uint32_t firstBlock = buffers[0]->getAllocation().block;
+    while (buffers.back()->getAllocation().block == firstBlock) {
+        createBuffer();
+    }
+    createBuffer(); // two in the second block
+    if (!check(buffers.back()->getAllocation().block != firstBlock, "buffers smaller than half a block were allocated dedicated"))
+        return false;
+
+    // the tags written stay with their buffer, whatever got freed
+    std::vector<uint32_t> tags;
+    std::vector<std::unique_ptr<VulkanBuffer>> kept;
+    for (uint32_t i = 0; i < buffers.size(); ++i) {
+        if (buffers[i]->getAllocation().block == firstBlock && i % 2 == 1)
+            continue;
+        tags.push_back(i + 1);
+        kept.push_back(std::move(buffers[i]));
+    }
+    buffers.clear();
+
+    VulkanAllocatorStats before = allocator.getStats();
+    VkDeviceSize moved = allocator.defragment([&](const VulkanAllocation& from, const VulkanAllocation& to){
+        for (auto& buffer : kept) {
+            if (buffer->relocate(from, to))
+                return true;
+        }
+        return false;
+    });
+    VulkanAllocatorStats after = allocator.getStats();
+    if (!check(moved == 2 * ALLOCATOR_TEST_BUFFER_SIZE, "moved " + std::to_string(moved) + " bytes instead of two buffers") ||
+        !check(after.blockCount == before.blockCount - 1 && after.allocationCount == before.allocationCount, "emptied block wasn't released"))
+        return false;
+
+    for (uint32_t i = 0; i < kept.size(); ++i) {
+        const uint32_t* words = kept[i]->data<uint32_t>();
+        if (!check(kept[i]->getAllocation().block == firstBlock, "a buffer is left out of the first block") ||
+            !check(words[0] == tags[i] * 1000003u && words[ALLOCATOR_TEST_BUFFER_SIZE / sizeof(uint32_t) - 1] == tags[i] * 1000003u + ALLOCATOR_TEST_BUFFER_SIZE / sizeof(uint32_t) - 1,
+                   "content lost in a move"))
+            return false;
+    }
+    return true;
+}
+
+int main(){
+    VulkanInstance instance;
+    VulkanDevice device(instance, ""); // pipeline cache kept in memory
+    bool passed;
+    {
+        VulkanAllocator allocator(device);
+        passed = testLinear(allocator) && testDefragment(allocator);
+        allocator.logStats();
+    }
+    device.destroy();
+    instance.destroy();
+    if (!passed)
+        return 1;
+    Debug::Log("Allocator test : linear blocks and defragmentation passed");
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Converts meshes to the binary mesh format ahead of time so the engine only maps them at startup.
+//   mesh_convert [--cache-dir dir] source...   fills the mesh cache the engine looks into
+//   mesh_convert --output file source          writes one mesh file at an explicit path
+//   --no-optimize                              keeps the source triangle and vertex order
+//   --no-lods                                  stores the full mesh only
+//   --no-meshlets                              doesn't split large meshes into meshlets
+#include <cstring>
+#include <string>
+#include <vector>
+#include "primitive_meshes.hpp"
+#include "mesh_cache.hpp"
+#include "job_system.hpp"
+
+JobSystem jobs;
+
+// Submeshes are converted in parallel then merged, the mesh file holds a single mesh
+Mesh importSource(const std::string& path){
+    bool isObj = path.size() >= 4 && path.compare(path.size() - 4, 4, ".obj") == 0;
+    return isObj ? loadOBJ(path, &jobs) : importModel(path, &jobs).flatten();
+}
+
+int main(int argc, char** argv){
+    std::string cacheDir = MESH_CACHE_DIR;
+    std::string outputPath;
+    bool optimize = true;
+    bool lods = true;
+    bool meshlets = true;
+    std::vector<std::string> sources;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) cacheDir = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) outputPath = argv[++i];
+        else if (strcmp(argv[i], "--no-optimize") == 0) optimize = false;
+        else if (strcmp(argv[i], "--no-lods") == 0) lods = false;
+        else if (strcmp(argv[i], "--no-meshlets") == 0) meshlets = false;
+        else sources.push_back(argv[i]);
+    }
+    if (sources.empty() || (!outputPath.empty() && sources.size() != 1)) {
+        std::cout << "Usage : mesh_convert [--no-optimize] [--no-lods] [--no-meshlets] [--cache-dir dir] source...\n"
+                  << "        mesh_convert [--no-optimize] [--no-lods] [--no-meshlets] --output file source\n";
+        return 1;
+    }
+
+    int failures = 0;
+    try {
+        if (!outputPath.empty()) {
+            uint32_t flags;
+            Mesh mesh = prepareMesh(importSource(sources[0]), sources[0], optimize, lods, meshlets, flags);
+            writeMeshFile(outputPath, mesh, hashFile(sources[0]), flags);
+            Debug::Log(sources[0] + " -> " + outputPath);
+            return 0;
+        }
+        MeshCache cache(cacheDir, optimize, lods, meshlets);
+        for (const std::string& source : sources) {
+            try {
+                Debug::Log(source + " -> " + cache.convert(source, importSource));
+            } catch (const std::exception& e) {
+                Debug::LogError(source + " : " + e.what());
+                failures++;
+            }
+        }
+    } catch (const std::exception& e) {
+        Debug::LogError(e.what());
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+// Compares the OBJ parser with the per line stringstream loader it replaced.
+//   obj_bench [--threads n] [file.obj]   without a file, a grid of 2M triangles with normals is generated
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "obj_parser.hpp"
+#include "debug.hpp"
+
+using Clock = std::chrono::high_resolution_clock;
+
+// The previous loadOBJ, kept as the baseline : one stringstream per line and per face corner,
+// triangles only, vn indices dropped
+Mesh loadOBJStringstream(const std::string& path) {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<uint32_t> indices;
+    std::ifstream file(path);
+    if (!file.is_open())
+        throw std::runtime_error("Couldn't load mesh " + path);
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::stringstream ss(line);
+        std::string prefix;
+        ss >> prefix;
+
+        if (prefix == "v") {
+            glm::vec3 v;
+            ss >> v.x >> v.y >> v.z;
+            vertices.push_back(v);
+        }
+        else if (prefix == "vn") {
+            glm::vec3 n;
+            ss >> n.x >> n.y >> n.z;
+            normals.push_back(n);
+        }
+        else if (prefix == "f") {
+            std::string vertStr;
+            for (int i = 0; i < 3; ++i) {
+                ss >> vertStr;
+                std::replace(vertStr.begin(), vertStr.end(), '/', ' ');
+                std::stringstream vss(vertStr);
+                int vi, ti, ni;
+                vss >> vi >> ti >> ni;
+                indices.push_back(vi - 1);
+            }
+        }
+    }
+    return Mesh(vertices, indices, normals);
+}
+
+// side x side quads split in two triangles, every corner as v/vt/vn
+void writeGrid(const std::string& path, uint32_t side){
+    std::ofstream out(path);
+    for (uint32_t y = 0; y <= side; ++y)
+        for (uint32_t x = 0; x <= side; ++x)
+            out << "v " << x * 0.01f << " " << y * 0.01f << " " << std::sin(x * 0.1f) * 0.05f << "\n";
+    out << "vt 0 0\nvn 0 0 1\n";
+    for (uint32_t y = 0; y < side; ++y) {
+        for (uint32_t x = 0; x < side; ++x) {
+            uint32_t a = y * (side + 1) + x + 1, b = a + 1, c = a + side + 1, d = c + 1;
+            out << "f " << a << "/1/1 " << b << "/1/1 " << d << "/1/1\n";
+            out << "f " << a << "/1/1 " << d << "/1/1 " << c << "/1/1\n";
+        }
+    }
+}
+
+template<typename F>
+float timeMs(F&& function){
+    auto start = Clock::now();
+    function();
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+    std::string path;
+    uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threadCount = std::stoul(argv[++i]);
+        else path = argv[i];
+    }
+    if (path.empty()) {
+        path = "obj_bench_grid.obj";
+        writeGrid(path, 1000);
+    }
+    {
+        // same warm page cache for everyone
+        MappedFile warm(path);
+        volatile uint8_t sink = 0;
+        for (size_t i = 0; i < warm.getSize(); i += 4096) sink = sink + warm.data()[i];
+    }
+
+    size_t triangles = 0;
+    float baseline = timeMs([&]{ triangles = loadOBJStringstream(path).getTriangles().size() / 3; });
+    Debug::Log("stringstream : " + std::to_string(baseline) + "ms, " + std::to_string(triangles) + " triangles");
+
+    float single = timeMs([&]{ triangles = parseOBJFile(path).getTriangles().size() / 3; });
+    Debug::Log("parser, 1 thread : " + std::to_string(single) + "ms (x" + std::to_string(baseline / single) + ")");
+
+    JobSystem jobs(threadCount);
+    float threaded = timeMs([&]{ triangles = parseOBJFile(path, &jobs).getTriangles().size() / 3; });
+    Debug::Log("parser, " + std::to_string(threadCount) + " threads : " + std::to_string(threaded) + "ms (x" +
+               std::to_string(baseline / threaded) + ")");
+    return 0;
+}